@@ -43,6 +43,8 @@
 #define PORTD_VLAN_ID_STRING_MAX_LEN 16
 #define PORT_INTERFACE_ADMIN_UP "up" /* Interface admin state "up" */
 #define PORT_INTERFACE_ADMIN_DOWN "down" /* Interface admin state "down" */
+/* Port status key holding the last kernel request failure of the port */
+#define PORT_STATUS_MAP_KERNEL_ERROR "kernel_error"
 #define LOOPBACK_INTERFACE_NAME "lo"
 #define RECV_BUFFER_SIZE 4096
 /* ifa_scope value of link local IPv6 address */
@@ -79,6 +81,16 @@
 #define SAFE_FREE(x) \
         if (x) {free(x);x = NULL;};
 
+/* Namespace wide /proc/sys/net entries.  They are opened once per namespace,
+ * so that they can be written without entering the namespace. */
+enum portd_sysctl {
+    PORTD_SYSCTL_IPV4_FORWARD,
+    PORTD_SYSCTL_IPV6_FORWARD,
+    PORTD_SYSCTL_ICMP_ECHO_IGNORE_BCAST,
+    PORTD_SYSCTL_ACCEPT_SOURCE_ROUTE,
+    PORTD_SYSCTL_MAX
+};
+
 /* Port configuration */
 struct port {
     struct hmap_node port_node; /* Element in struct vrf's "ports" hmap. */
@@ -95,6 +107,7 @@ struct port {
     struct hmap secondary_ip4addr; /* List of secondary IPv4 addresses */
     struct hmap secondary_ip6addr; /* List of secondary IPv6 addresses */
     struct vrf *vrf;
+    struct hmap_node name_node;    /* In the index of every vrf's ports. */
 };
 
 /* VRF configuration */
@@ -106,7 +119,14 @@ struct vrf {
     struct hmap ports;          /* "struct port"s indexed by name. */
     /* Used during reconfiguration. */
     struct shash wanted_ports;
+    bool ports_synced;          /* 'ports' was built from all the ports of
+                                 * 'cfg', only changes are applied since. */
     int nl_sock;
+    int nl_cmd_sock;            /* Unbound socket for requests and queries. */
+    int nsid;                   /* Namespace id, -1 if events are not
+                                 * received on the shared socket. */
+    struct hmap_node nsid_node; /* In 'vrfs_by_nsid', if 'nsid' is set. */
+    int sysctl_fd[PORTD_SYSCTL_MAX]; /* Namespace /proc/sys entries. */
     int64_t table_id;
 };
 
@@ -192,33 +212,50 @@ struct portd_arbiter_class {
 };
 
 struct ovsrec_port* portd_port_db_lookup(const char *);
+
+/* Per row change detection: true if COLUMN of the TABLE row ROW changed
+ * since the last reconfiguration. */
+bool portd_idl_col_changed(const struct ovsdb_idl_row *row,
+                           const struct ovsdb_idl_column *column);
+#define PORTD_IDL_COL_CHANGED(ROW, TABLE, COLUMN) \
+        portd_idl_col_changed(&(ROW)->header_, &ovsrec_##TABLE##_col_##COLUMN)
+
 /* Helper functions to identify intervlan interfaces */
-bool portd_interface_type_internal_check(const struct ovsrec_port *port,
-                                         const char *interface_name);
+bool portd_port_is_intervlan(const struct ovsrec_port *port);
 bool portd_port_in_bridge_check(const char *port_name,
                                 const char *bridge_name);
 bool portd_port_in_vrf_check(const char *port_name, const char *vrf_name);
 
 /* Netlink functions */
-void nl_msg_process(void *use_data, int sock, bool on_init);
-void parse_nl_ip_address_msg_on_init(struct nlmsghdr *nlh, int msglen,
+void nl_msg_process(void *use_data, struct vrf *vrf, int sock, bool on_init);
+struct portd_nl_addr_msg;
+void parse_nl_ip_address_msg_on_init(struct vrf *vrf,
+                                     const struct portd_nl_addr_msg *msg,
                                      struct shash *kernel_port_list);
-void nl_add_ip_address(int cmd, const char *port_name, char *ip_address,
+void nl_add_ip_address(int cmd, const struct port *port, char *ip_address,
                        int family, bool secondary);
 
-void portd_config_iprouting(const char *vrf_name, int enable);
+void portd_config_iprouting(struct vrf *vrf, int enable);
+void portd_sysctl_open(struct vrf *vrf, int *fds);
+void portd_sysctl_close(int *fds);
 void
 portd_config_src_routing(struct vrf *vrf, const char *port_name, bool enable);
 void portd_reconfig_ipaddr(struct port *port, struct ovsrec_port *port_row);
 void portd_del_ipaddr(struct port *port);
 void portd_ipaddr_config_on_init(void);
+void portd_ipaddr_resync(struct vrf *vrf, int cmd_sock);
 
 /* Inter-VLAN functions */
 void portd_add_vlan_interface(const char *parent_intf_name,
-                              const char *vlan_intf_name,
+                              const struct port *port,
                               const unsigned short vlan_tag);
 void portd_del_vlan_interface(const char *vlan_intf_name);
 struct vrf* get_vrf_for_port(const char *port_name);
+
+/* Ports of all the vrfs, by name. */
+void portd_port_insert(struct port *port);
+void portd_port_remove(struct port *port);
+struct port *portd_port_find(const char *name);
 /* Proxy ARP function */
 void portd_config_proxy_arp(struct port *port, char *str, int enable);
 
@@ -0,0 +1,85 @@
+/*
+ * (c) Copyright 2016 Hewlett Packard Enterprise Development LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _PORTD_INDEX_H_
+#define _PORTD_INDEX_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "hmap.h"
+#include "portd_vlan.h"
+
+struct ovsrec_interface;
+struct ovsrec_port;
+struct ovsrec_vlan;
+struct uuid;
+
+/* Port rows indexed by name, and by UUID to find the entry of a deleted
+ * row.  Several rows may have the same name, the first one is found.  The
+ * rows are also indexed by the UUIDs of their interfaces, and the rows
+ * named as a VLAN interface, "vlan" and a VLAN id, counted by VLAN id. */
+struct portd_port_index {
+    struct hmap by_name;
+    struct hmap by_uuid;
+    struct hmap by_iface;
+    uint16_t vlan_names[PORTD_VLAN_ID_MAX + 1];
+};
+
+void portd_port_index_init(struct portd_port_index *);
+void portd_port_index_destroy(struct portd_port_index *);
+void portd_port_index_set(struct portd_port_index *,
+                          const struct ovsrec_port *row);
+void portd_port_index_remove(struct portd_port_index *,
+                             const struct uuid *uuid);
+const struct ovsrec_port *
+portd_port_index_find(const struct portd_port_index *, const char *name);
+const struct ovsrec_port *
+portd_port_index_find_iface(const struct portd_port_index *,
+                            const struct uuid *iface_uuid);
+bool portd_port_index_has_vlan_name(const struct portd_port_index *,
+                                    int vid);
+
+/* The ports of the Bridge or VRF rows, by port UUID and row name. */
+struct portd_member_index {
+    struct hmap owners;
+    struct hmap members;
+};
+
+/* Class of a port, from the type of its interface of the same name. */
+enum portd_port_class {
+    PORTD_PORT_CLASS_OTHER,
+    PORTD_PORT_CLASS_INTERNAL,          /* Inter-VLAN interface. */
+    PORTD_PORT_CLASS_LOOPBACK,
+    PORTD_PORT_CLASS_VLANSUBINT,        /* Subinterface. */
+};
+
+/* Indexes of the IDL rows, kept up to date from the tracked changes. */
+void portd_index_run(void);
+const struct ovsrec_port *portd_index_port_find(const char *name);
+const struct ovsrec_port *
+portd_index_iface_port(const struct ovsrec_interface *);
+const struct ovsrec_interface *
+portd_index_port_iface(const struct ovsrec_port *);
+enum portd_port_class portd_index_port_class(const struct ovsrec_port *);
+bool portd_index_port_in_bridge(const char *port_name,
+                                const char *bridge_name);
+bool portd_index_port_in_vrf(const char *port_name, const char *vrf_name);
+bool portd_index_vlan_name_used(int vid);
+void portd_index_vlan_run(void);
+void portd_index_vlan_inserted(const struct ovsrec_vlan *);
+const struct ovsrec_vlan *portd_index_vlan_find(int vid);
+
+#endif /* _PORTD_INDEX_H_ */
@@ -0,0 +1,137 @@
+/*
+ * (c) Copyright 2016 Hewlett Packard Enterprise Development LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _PORTD_NETLINK_H_
+#define _PORTD_NETLINK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+
+/* Size of the buffer that queues the requests of one namespace.  A batch is
+ * flushed early when the next request would not fit. */
+#define PORTD_NL_BATCH_SIZE (32 * 1024)
+
+/* Receive buffers, each one large enough for the biggest datagrams the
+ * kernel builds for link and address dumps. */
+#define PORTD_NL_RECV_BUFFER_SIZE (32 * 1024)
+#define PORTD_NL_RECV_BATCH 8
+
+/* Time, in milliseconds, a blocking query waits for the kernel's reply. */
+#define PORTD_NL_REPLY_TIMEOUT 1000
+
+/* Maximum number of requests of a namespace sent and not acknowledged yet.
+ * Keeps the acknowledgements of a batch within the command socket's receive
+ * buffer.  A namespace without a command socket only bounds its batches. */
+#define PORTD_NL_ACK_WINDOW 128
+
+/* Default receive buffer size of the notification sockets, large enough to
+ * absorb the notifications of a mass interface creation. */
+#define PORTD_NL_RCVBUF_DEFAULT (8 * 1024 * 1024)
+
+/* Maximum number of datagrams read from one notification socket per main
+ * loop iteration, so that a burst of kernel events does not delay the
+ * processing of database changes. */
+#define PORTD_NL_RECV_BUDGET 256
+
+struct shash;
+
+/* Interface types portd tells apart, from IFLA_INFO_KIND. */
+enum portd_nl_kind {
+    PORTD_NL_KIND_NONE,         /* No IFLA_LINKINFO, e.g. a physical port. */
+    PORTD_NL_KIND_VLAN,
+    PORTD_NL_KIND_BOND,
+    PORTD_NL_KIND_BRIDGE,
+    PORTD_NL_KIND_OTHER,
+};
+
+/* A parsed link message.  The attributes point into the message, which must
+ * outlive it. */
+struct portd_nl_link_msg {
+    uint16_t type;                                /* RTM_*LINK. */
+    const struct ifinfomsg *ifi;
+    const struct rtattr *tb[IFLA_MAX + 1];        /* IFLA_* attributes. */
+    const struct rtattr *info[IFLA_INFO_MAX + 1]; /* Nested IFLA_LINKINFO. */
+    const struct rtattr *vlan[IFLA_VLAN_MAX + 1]; /* IFLA_INFO_DATA of a
+                                                   * VLAN link. */
+    enum portd_nl_kind kind;
+};
+
+/* A parsed address message. */
+struct portd_nl_addr_msg {
+    uint16_t type;                                /* RTM_*ADDR. */
+    const struct ifaddrmsg *ifa;
+    const struct rtattr *tb[IFA_MAX + 1];         /* IFA_* attributes. */
+};
+
+/* Attribute payload accessors. */
+#define PORTD_NL_ATTR_U16(RTA) (*(const uint16_t *) RTA_DATA(RTA))
+#define PORTD_NL_ATTR_U32(RTA) (*(const uint32_t *) RTA_DATA(RTA))
+#define PORTD_NL_ATTR_STR(RTA) ((RTA) ? (const char *) RTA_DATA(RTA) : NULL)
+
+void portd_nl_parse_attrs(const struct rtattr **tb, int max,
+                          const struct rtattr *rta, int len);
+bool portd_nl_parse_link(const struct nlmsghdr *nlh,
+                         struct portd_nl_link_msg *msg);
+bool portd_nl_parse_addr(const struct nlmsghdr *nlh,
+                         struct portd_nl_addr_msg *msg);
+
+/* Outcome of the requests made for one port. */
+struct portd_nl_result {
+    int type;                   /* RTM_* type of the first failed request. */
+    int error;                  /* Its errno value, 0 if none failed. */
+};
+
+int portd_nl_batch_add(int sock, const struct nlmsghdr *nlh,
+                       const char *owner);
+void portd_nl_batch_flush(int sock);
+void portd_nl_batch_flush_links(int sock);
+void portd_nl_batch_flush_all(void);
+
+void portd_nl_ack(int sock, const struct nlmsghdr *nlh);
+void portd_nl_ack_run(void);
+void portd_nl_ack_wait(void);
+void portd_nl_results_take(struct shash *results);
+const char *portd_nl_msg_type_to_string(int type);
+
+unsigned int portd_nl_ifindex_get(int sock, const char *name);
+void portd_nl_ifindex_update(int sock, const struct portd_nl_link_msg *msg);
+const char *portd_nl_ifindex_to_name(int sock, unsigned int ifindex);
+void portd_nl_ifindex_forget(int sock, const char *name);
+void portd_nl_addr_update(int sock, const struct portd_nl_addr_msg *msg);
+void portd_nl_link_move_prepare(int from_sock, int to_sock, const char *name);
+
+int portd_nl_recv(int sock, bool wait, struct nlmsghdr **msgs, int *lens,
+                  int *nsids);
+
+void portd_nl_overrun(int sock);
+bool portd_nl_strict_enable(int sock);
+bool portd_nl_dump_filtered(void);
+int portd_nl_dump_request(int cmd_sock, int type, int family,
+                          unsigned int ifindex);
+int portd_nl_resync_begin(int sock);
+void portd_nl_resync_end(int sock);
+
+struct ds;
+void portd_nl_ns_format(int sock, struct ds *ds);
+void portd_nl_ns_init(int sock, int cmd_sock);
+void portd_nl_ns_destroy(int sock);
+void portd_nl_parse_bench(int sock, int iterations, struct ds *ds);
+int portd_nl_nsid_get(int sock, int peer_sock);
+
+#endif /* _PORTD_NETLINK_H_ */
@@ -0,0 +1,41 @@
+/*
+ * (c) Copyright 2016 Hewlett Packard Enterprise Development LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _PORTD_RECONCILE_H_
+#define _PORTD_RECONCILE_H_
+
+#include <stdbool.h>
+
+struct ds;
+
+/* Default coalescing window, in milliseconds: the reconfiguration waits
+ * until the database has not changed for that long... */
+#define PORTD_RECONCILE_WINDOW_DEFAULT 10
+
+/* ...but no longer than this after the first change it waits for. */
+#define PORTD_RECONCILE_MAX_DELAY_DEFAULT 200
+
+void portd_reconcile_init(unsigned int seqno);
+void portd_reconcile_set(int window, int max_delay);
+
+void portd_reconcile_note(unsigned int seqno);
+bool portd_reconcile_due(void);
+void portd_reconcile_done(unsigned int seqno);
+void portd_reconcile_wait(void);
+
+void portd_reconcile_format(struct ds *);
+
+#endif /* _PORTD_RECONCILE_H_ */
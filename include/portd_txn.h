@@ -0,0 +1,70 @@
+/*
+ * (c) Copyright 2016 Hewlett Packard Enterprise Development LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _PORTD_TXN_H_
+#define _PORTD_TXN_H_
+
+#include <stdbool.h>
+
+struct ds;
+struct ovsdb_idl_txn;
+struct ovsrec_port;
+struct smap;
+
+/* Delay before the writes of a transaction that failed with an error are
+ * tried again, in milliseconds.  A conflict is retried on the next pass. */
+#define PORTD_TXN_RETRY_INTERVAL 1000
+
+/* Port columns written by portd. */
+enum portd_txn_port_col {
+    PORTD_TXN_PORT_HW_CONFIG,
+    PORTD_TXN_PORT_STATUS,
+    PORTD_TXN_PORT_FORWARDING_STATE,
+};
+
+/* Writes again the internal VLAN row 'vid' of 'port_name', added or handed
+ * over to the port if 'add' is true, deleted otherwise, after the
+ * transaction that made the change failed.  The function checks that the
+ * change is still wanted. */
+typedef void portd_txn_vlan_replay_func(int vid, const char *port_name,
+                                        bool add);
+
+void portd_txn_init(bool async, portd_txn_vlan_replay_func *);
+void portd_txn_destroy(void);
+
+struct ovsdb_idl_txn *portd_txn_get(void);
+bool portd_txn_run(void);
+void portd_txn_commit(void);
+void portd_txn_wait(void);
+bool portd_txn_in_flight(void);
+
+/* Changes to the Port columns, buffered until the end of the pass. */
+void portd_txn_port_setkey(const struct ovsrec_port *,
+                           enum portd_txn_port_col, const char *key,
+                           const char *value);
+void portd_txn_port_delkey(const struct ovsrec_port *,
+                           enum portd_txn_port_col, const char *key);
+void portd_txn_port_set(const struct ovsrec_port *,
+                        enum portd_txn_port_col, const struct smap *);
+const char *portd_txn_port_get(const struct ovsrec_port *,
+                               enum portd_txn_port_col, const char *key);
+void portd_txn_port_get_smap(const struct ovsrec_port *,
+                             enum portd_txn_port_col, struct smap *);
+void portd_txn_vlan_written(int vid, const char *port_name, bool add);
+
+void portd_txn_format(struct ds *);
+
+#endif /* _PORTD_TXN_H_ */
@@ -0,0 +1,129 @@
+/*
+ * (c) Copyright 2016 Hewlett Packard Enterprise Development LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _PORTD_VLAN_H_
+#define _PORTD_VLAN_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "hmap.h"
+#include "list.h"
+#include "shash.h"
+
+struct ds;
+struct ovsrec_bridge;
+struct ovsrec_port;
+
+#define PORTD_VLAN_ID_MIN 1
+#define PORTD_VLAN_ID_MAX 4094
+#define PORTD_VLAN_WORDS ((PORTD_VLAN_ID_MAX + 64) / 64)
+
+/* Default time, in milliseconds, an internal VLAN released by its L3 port
+ * stays reserved for it.  0 releases the VLAN at once. */
+#define PORTD_VLAN_GRACE_DEFAULT 0
+
+/* The VLAN ids used in the default bridge, which all the internal VLAN
+ * pools take their ids from. */
+struct portd_vlan_alloc {
+    uint64_t used[PORTD_VLAN_WORDS];
+    bool synced;                /* 'used' was loaded from the bridge. */
+};
+
+/* The internal VLANs of the L3 ports of a subsystem: the range and order
+ * in which they are given out, and whether the subsystem needs them. */
+struct portd_vlan_pool {
+    struct hmap_node node;      /* In 'by_subsystem' of the pools. */
+    char *subsystem;
+    int min, max;
+    bool ascending;
+    char *policy;               /* NULL if there is no System row. */
+    bool require_vlan;          /* Its L3 ports need an internal VLAN. */
+    bool stale;                 /* Not seen in the last load. */
+
+    /* Allocation sweep of the current pass. */
+    bool usable;                /* The policy is valid. */
+    bool exhausted;
+    int last;                   /* Last id given out, -1 if none. */
+
+    unsigned long long int n_allocated;
+    unsigned long long int n_failed;
+};
+
+/* The internal VLAN pools, by subsystem name and by interface name. */
+struct portd_vlan_pools {
+    struct hmap by_subsystem;
+    struct shash by_interface;
+    struct portd_vlan_pool *dflt;   /* For ports of no known subsystem. */
+};
+
+void portd_vlan_alloc_init(struct portd_vlan_alloc *);
+void portd_vlan_alloc_sync(struct portd_vlan_alloc *,
+                           const struct ovsrec_bridge *);
+void portd_vlan_alloc_mark(struct portd_vlan_alloc *, int vid, bool used);
+bool portd_vlan_alloc_is_used(const struct portd_vlan_alloc *, int vid);
+int portd_vlan_alloc_first(const struct portd_vlan_alloc *,
+                           const struct portd_vlan_pool *);
+int portd_vlan_alloc_next(const struct portd_vlan_alloc *,
+                          const struct portd_vlan_pool *, int vid);
+int portd_vlan_alloc_n_free(const struct portd_vlan_alloc *,
+                            const struct portd_vlan_pool *);
+
+void portd_vlan_pool_set_range(struct portd_vlan_pool *, int min, int max,
+                               bool ascending);
+bool portd_vlan_pool_in_range(const struct portd_vlan_pool *, int vid);
+
+void portd_vlan_pools_init(struct portd_vlan_pools *);
+void portd_vlan_pools_destroy(struct portd_vlan_pools *);
+void portd_vlan_pools_start(struct portd_vlan_pools *);
+struct portd_vlan_pool *portd_vlan_pools_get(struct portd_vlan_pools *,
+                                             const char *subsystem);
+void portd_vlan_pools_finish(struct portd_vlan_pools *);
+struct portd_vlan_pool *
+portd_vlan_pools_lookup_port(const struct portd_vlan_pools *,
+                             const struct ovsrec_port *);
+void portd_vlan_pools_format(const struct portd_vlan_pools *,
+                             const struct portd_vlan_alloc *, struct ds *);
+
+/* Internal VLANs released by their L3 ports, held for them by port name
+ * and ordered from the least recently released. */
+struct portd_vlan_quarantine {
+    struct hmap by_port;
+    struct ovs_list lru;
+};
+
+void portd_vlan_quarantine_init(struct portd_vlan_quarantine *);
+void portd_vlan_quarantine_destroy(struct portd_vlan_quarantine *);
+int portd_vlan_quarantine_add(struct portd_vlan_quarantine *,
+                              const char *port_name, int vid,
+                              long long int now);
+int portd_vlan_quarantine_take(struct portd_vlan_quarantine *,
+                               const char *port_name);
+int portd_vlan_quarantine_pop(struct portd_vlan_quarantine *,
+                              long long int released_before,
+                              char **port_name);
+int portd_vlan_quarantine_evict(struct portd_vlan_quarantine *,
+                                const struct portd_vlan_pool *,
+                                char **port_name);
+long long int
+portd_vlan_quarantine_oldest(const struct portd_vlan_quarantine *);
+void portd_vlan_quarantine_format(const struct portd_vlan_quarantine *,
+                                  long long int now, struct ds *);
+
+int portd_vlan_name_to_vid(const char *name);
+
+void portd_vlan_alloc_bench(int n_free, int iterations, struct ds *);
+
+#endif /* _PORTD_VLAN_H_ */
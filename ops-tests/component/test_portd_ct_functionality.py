@@ -359,3 +359,101 @@ def test_portd_ct_functionality(topology, step):
     portd_functionality_tc5(sw1, step)
     portd_functionality_tc6(sw1, step)
     portd_functionality_tc7(sw1, step)
+
+
+# Checks that a netlink request the kernel rejects is reported in the
+# status:kernel_error key of its port, and that the key is removed once the
+# kernel state is right again, even if nothing has to be sent for it.
+def test_portd_ct_kernel_error(topology, step):
+    sw1 = topology.get("sw1")
+    assert sw1 is not None
+    port = sw1.ports["if03"]
+
+    step("Setting an MTU the kernel rejects on interface 3")
+    sw1("set interface {} hw_intf_config:mtu=10".format(port),
+        shell='vsctl')
+    step("Verifying the failure is reported on port 3")
+    assert execute_command_and_verify_response(
+        sw1,
+        step,
+        "get port {} status".format(port),
+        'vsctl',
+        max_try=10,
+        str1="kernel_error")
+
+    step("Restoring the MTU of interface 3")
+    sw1("set interface {} hw_intf_config:mtu=1500".format(port),
+        shell='vsctl')
+    step("Verifying the failure is no longer reported on port 3")
+    for i in range(10):
+        output = sw1("get port {} status".format(port), shell='vsctl')
+        if "kernel_error" not in output:
+            break
+        sleep(1)
+    assert "kernel_error" not in output
+
+
+# Returns the internal VLAN of 'port', waiting for it to be assigned.
+def get_internal_vlan(sw1, port):
+    for i in range(10):
+        output = sw1("get port {} hw_config:internal_vlan_id".format(port),
+                     shell='vsctl')
+        vid = search('"(\d+)"', output)
+        if vid:
+            return vid.group(1)
+        sleep(1)
+    return None
+
+
+# Checks that a port that turns L2 and L3 again within the grace period
+# gets its internal VLAN back, even though another port became L3 meanwhile.
+def test_portd_ct_internal_vlan_reuse(topology, step):
+    sw1 = topology.get("sw1")
+    assert sw1 is not None
+    port1 = sw1.ports["if01"]
+    port2 = sw1.ports["if02"]
+
+    step("Holding released internal VLANs for 60 seconds")
+    sw1("set Subsystem base other_info:l3_port_requires_internal_vlan=1",
+        shell='vsctl')
+    sw1("ovs-appctl -t ops-portd portd/internal-vlan-quarantine 60000",
+        shell='bash')
+    sw1("configure terminal")
+    sw1("vlan internal range 200 300 ascending")
+
+    step("Making interface 1 an L3 port")
+    sw1("interface {}".format(port1))
+    sw1("routing")
+    sw1("ip address 20.1.1.1/24")
+    sw1("exit")
+    vid = get_internal_vlan(sw1, port1)
+    assert vid is not None
+
+    step("Making interface 1 an L2 port, then interface 2 an L3 port")
+    sw1("interface {}".format(port1))
+    sw1("no routing")
+    sw1("exit")
+    sw1("interface {}".format(port2))
+    sw1("no routing")
+    sw1("routing")
+    sw1("ip address 21.1.1.1/24")
+    sw1("exit")
+    vid2 = get_internal_vlan(sw1, port2)
+    assert vid2 is not None and vid2 != vid
+
+    step("Verifying interface 1 gets its internal VLAN back")
+    sw1("interface {}".format(port1))
+    sw1("routing")
+    sw1("ip address 20.1.1.1/24")
+    sw1("end")
+    # The port keeps its hw_config key while its VLAN is held, let portd
+    # handle the change before reading it.
+    sleep(5)
+    assert get_internal_vlan(sw1, port1) == vid
+
+    step("Removing the configuration")
+    sw1("ovs-appctl -t ops-portd portd/internal-vlan-quarantine 0",
+        shell='bash')
+    sw1("configure terminal")
+    sw1("no vlan internal range")
+    sw1("end")
@@ -15,6 +15,7 @@
 # Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 # 02111-1307, USA.
 
+from time import sleep
 
 TOPOLOGY = """
 # +-------+
@@ -91,3 +92,47 @@ def test_portd_ct_inter_vlan_interface(topology, step):
     return_ = sw1("ifconfig -a {vlan_interface}".format(**locals()),
                   shell='bash')
     assert 'does not exist' in return_
+
+
+def test_portd_ct_inter_vlan_interface_internal_vlan(topology, step):
+    sw1 = topology.get("sw1")
+    assert sw1 is not None
+
+    # A port named "vlan20" must not keep internal VLAN 2, a prefix of its
+    # VLAN id, from being allocated.
+    vlan_interface = "vlan20"
+    port = sw1.ports["if01"]
+    step("1-Creating inter-VLAN interface {vlan_interface}".format(**locals()))
+    sw1("set Subsystem base other_info:l3_port_requires_internal_vlan=1",
+        shell='vsctl')
+    sw1("configure terminal")
+    sw1("vlan 20")
+    sw1("no shutdown")
+    sw1("interface {vlan_interface}".format(**locals()))
+    sw1("exit")
+
+    step("2-Allocating internal VLANs from 2 in ascending order")
+    sw1("vlan internal range 2 100 ascending")
+    sw1("interface {port}".format(**locals()))
+    sw1("routing")
+    sw1("ip address 10.2.0.1/24")
+    sw1("end")
+
+    return_ = ""
+    for i in range(10):
+        return_ = sw1("get port {port} hw_config:internal_vlan_id"
+                      .format(**locals()), shell='vsctl')
+        if '"2"' in return_:
+            break
+        sleep(1)
+    assert '"2"' in return_
+
+    step("3-Removing the configuration")
+    sw1("configure terminal")
+    sw1("interface {port}".format(**locals()))
+    sw1("no ip address 10.2.0.1/24")
+    sw1("exit")
+    sw1("no vlan internal range")
+    sw1("no interface {vlan_interface}".format(**locals()))
+    sw1("no vlan 20")
+    sw1("end")
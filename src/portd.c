@@ -59,19 +59,32 @@
 #include "openswitch-dflt.h"
 #include "poll-loop.h"
 #include "stream.h"
+#include "timeval.h"
 #include "unixctl.h"
+#include "uuid.h"
 #include "vlan-bitmap.h"
 #include "eventlog.h"
 #include  <diag_dump.h>
 
 #include "portd.h"
 #include "linux_bond.h"
+#include "portd_index.h"
+#include "portd_reconcile.h"
+#include "portd_txn.h"
+#include "portd_vlan.h"
+#include "portd_netlink.h"
 
 #include "eventlog.h"
 
 VLOG_DEFINE_THIS_MODULE(ops_portd);
 
 COVERAGE_DEFINE(portd_reconfigure);
+COVERAGE_DEFINE(portd_nl_recv_budget);
+COVERAGE_DEFINE(portd_col_changed);
+COVERAGE_DEFINE(portd_col_unchanged);
+COVERAGE_DEFINE(portd_vlan_reused);
+COVERAGE_DEFINE(portd_vlan_evicted);
+COVERAGE_DEFINE(portd_vlan_expired);
 
 #define LAG_NAME_SUFFIX_LENGTH    3
 #define LAG_NAME_SUFFIX           "lag"
@@ -80,19 +93,46 @@ COVERAGE_DEFINE(portd_reconfigure);
 #define IPV4_ADDR_STR_MAXLEN  16
 #define MAX_LOOPBACK_CMD_LENGTH 128
 int nl_sock = -1; /* Netlink socket */
+int nl_cmd_sock = -1; /* Netlink socket for requests and queries */
+int sysctl_fd[PORTD_SYSCTL_MAX]; /* Default namespace /proc/sys entries */
+/* Receive buffer size of the notification sockets, 0 for the system default */
+static int nl_rcvbuf = PORTD_NL_RCVBUF_DEFAULT;
+/* Receive the events of every namespace on 'nl_sock', demultiplexed by
+ * namespace id, instead of opening a notification socket per VRF. */
+static bool nl_listen_all_nsid = false;
+static bool db_commit_async = true;
+/* Coalescing window and maximum delay of the reconfigurations, in ms. */
+static int reconcile_window = PORTD_RECONCILE_WINDOW_DEFAULT;
+static int reconcile_max_delay = PORTD_RECONCILE_MAX_DELAY_DEFAULT;
 int init_sock = -1; /* This sock will only be used during init */
 
 /* IDL variables */
 unsigned int idl_seqno;
 struct ovsdb_idl *idl;
-struct ovsdb_idl_txn *txn;
-
-bool commit_txn = false;
+struct ovsdb_idl_txn *txn;    /* Managed by portd_txn.c. */
 
 static unixctl_cb_func portd_unixctl_dump;
 static unixctl_cb_func portd_unixctl_getbondingconfiguration;
+static unixctl_cb_func portd_unixctl_netlink;
+static unixctl_cb_func portd_unixctl_netlink_parse_bench;
+static unixctl_cb_func portd_unixctl_txn;
+static unixctl_cb_func portd_unixctl_reconcile;
+static unixctl_cb_func portd_unixctl_vlan_alloc_bench;
+static unixctl_cb_func portd_unixctl_internal_vlan_quarantine;
+static unixctl_cb_func portd_unixctl_internal_vlan_pools;
 static int system_configured = false;
 
+/* Internal VLAN allocator, and the internal VLAN pools of the subsystems,
+ * whose interfaces are mapped again when the subsystems change. */
+static struct portd_vlan_alloc internal_vlans;
+static struct portd_vlan_pools vlan_pools;
+static bool vlan_pools_loaded;
+
+/* Internal VLANs released by their L3 ports, reserved for them for
+ * 'internal_vlan_grace' ms in case they turn L3 again. */
+static int internal_vlan_grace = PORTD_VLAN_GRACE_DEFAULT;
+static struct portd_vlan_quarantine vlan_quarantine;
+
 /* This static boolean is used to configure VLANs
  * and sync IP addresses on initialization
  * and to handle restarts. */
@@ -100,6 +140,11 @@ static bool portd_config_on_init = true;
 
 /* All vrfs, indexed by name. */
 struct hmap all_vrfs = HMAP_INITIALIZER(&all_vrfs);
+/* "struct vrf"s whose events are received on the shared socket, by nsid. */
+static struct hmap vrfs_by_nsid = HMAP_INITIALIZER(&vrfs_by_nsid);
+/* "struct port"s of all the vrfs, indexed by name, to find the vrf of a
+ * port without walking every vrf. */
+static struct hmap vrf_ports = HMAP_INITIALIZER(&vrf_ports);
 
 /**
  * A hash map of daemon's internal data for all the interfaces maintained by
@@ -112,12 +157,21 @@ static struct shash all_interfaces = SHASH_INITIALIZER(&all_interfaces);
  */
 static struct shash all_ports = SHASH_INITIALIZER(&all_ports);
 
+/**
+ * The same entries indexed by the UUID of their IDL row, so that the rows
+ * deleted from the DB, reported by the IDL change tracking, can be matched
+ * to them.
+ */
+static struct hmap interfaces_by_uuid = HMAP_INITIALIZER(&interfaces_by_uuid);
+static struct hmap ports_by_uuid = HMAP_INITIALIZER(&ports_by_uuid);
+
 /* Portd's internal data structure to store per lag data. */
 struct port_lag_data {
     char                      *name;
     struct shash              eligible_member_ifs;
     struct shash              bonding_ifs;
     const struct ovsrec_port  *cfg;
+    struct hmap_node          uuid_node;  /* In 'ports_by_uuid'. */
 };
 
 /* Portd's internal data structure to store per interface data. */
@@ -125,21 +179,21 @@ struct iface_data {
     char                            *name;
     struct port_lag_data            *port_datap;
     const struct ovsrec_interface   *cfg;
+    struct hmap_node                uuid_node; /* In 'interfaces_by_uuid'. */
 };
 
 /* Utility functions */
 static struct vrf* portd_vrf_lookup(const char *name);
 static struct port* portd_port_lookup(const struct vrf *vrf,
                                       const char *name);
-static bool portd_check_interface_type_vlan(struct rtattr *link_info,
-                                            int len);
 static inline void portd_chk_for_system_configured(void);
 
 /* Netlink related functions */
-static void portd_vlan_intf_config_on_init(int intf_index,
-                                           struct rtattr *link_info);
-static void portd_update_kernel_intf_up_down (char *intf_name);
-static void parse_nl_new_link_msg(struct nlmsghdr *h, struct shash *kernel_port_list);
+static void portd_vlan_intf_config_on_init(
+        const struct portd_nl_link_msg *msg);
+static void portd_update_kernel_intf_up_down(const char *intf_name);
+static void parse_nl_new_link_msg(const struct portd_nl_link_msg *msg,
+                                  struct shash *kernel_port_list);
 static void portd_netlink_socket_open(char* vrf_ns_name, int *sock, bool is_init_sock);
 
 static void portd_init(const char *remote);
@@ -160,24 +214,58 @@ static void portd_port_admin_state_reconfigure(
         struct port *port, const struct ovsrec_port *port_row);
 static void portd_handle_interface_config_mods(void);
 
+/* The L3 ports created during a pass that need an internal VLAN, given
+ * out together at the end of the pass. */
+struct internal_vlan_request {
+    struct port *port;
+    struct ovsrec_port *port_row;
+};
+
+struct internal_vlan_requests {
+    struct internal_vlan_request *reqs;
+    size_t n, allocated;
+};
+
 /* Internal VLAN related functions */
-static void portd_bridge_del_vlan(struct ovsrec_bridge *br,
-                                  struct ovsrec_vlan *vlan);
+static void portd_bridge_del_vlan(const struct ovsrec_bridge *br,
+                                  const struct ovsrec_vlan *vlan);
 static void portd_del_internal_vlan(int internal_vid);
-static int portd_alloc_internal_vlan(void);
-static void portd_bridge_insert_vlan(struct ovsrec_bridge *br,
-                                     struct ovsrec_vlan *vlan);
-static void portd_create_vlan_row(int vid, struct ovsrec_port *port_row);
-static void portd_add_internal_vlan(struct port *port,
-                                    struct ovsrec_port *port_row);
+static void portd_internal_vlan_sync(void);
+static bool portd_internal_vlan_policy_check(
+    const struct portd_vlan_pool *pool);
+static int portd_alloc_internal_vlan(const struct portd_vlan_pool *pool,
+                                     int after);
+static void portd_bridge_insert_vlan(const struct ovsrec_bridge *br,
+                                     const struct ovsrec_vlan *vlan);
+static const struct ovsrec_bridge *portd_default_bridge(void);
+static void portd_create_vlan_row(const struct ovsrec_bridge *br_row,
+                                  int vid, struct ovsrec_port *port_row);
+static void portd_internal_vlan_replay(int vid, const char *port_name,
+                                       bool add);
+static void portd_add_internal_vlans(struct internal_vlan_requests *);
+static void portd_release_internal_vlan(struct port *port);
+static bool portd_vlan_row_is_internal(const struct ovsrec_vlan *vlan_row,
+                                       const char *port_name);
+static void portd_drop_held_vlan(const char *port_name, int vid);
+static int portd_reclaim_internal_vlan(const struct portd_vlan_pool *pool,
+                                       const struct ovsrec_bridge *br_row,
+                                       struct ovsrec_port *port_row);
+static int portd_evict_internal_vlan(const struct portd_vlan_pool *pool,
+                                     struct ovsrec_port *port_row);
+static void portd_expire_internal_vlans(void);
 
 /* Port related functions */
 static void portd_port_create(struct vrf *vrf,
                               struct ovsrec_port *port_row);
 static void portd_reconfig_ports(struct vrf *vrf,
-                                 const struct shash *wanted_ports);
+                                 const struct shash *wanted_ports,
+                                 struct internal_vlan_requests *);
 static void portd_collect_wanted_ports(struct vrf *vrf,
                                        struct shash *wanted_ports);
+static bool portd_collect_changed_ports(struct shash *changed_ports);
+static void portd_collect_changed_vrf_ports(struct vrf *vrf,
+                                            const struct shash *changed_ports,
+                                            struct shash *wanted_ports);
 static void portd_port_destroy(struct port *port);
 static void portd_del_ports(struct vrf *vrf,
                             const struct shash *wanted_ports);
@@ -199,6 +287,10 @@ static void portd_add_del_vrf(void);
 
 static void portd_reconfigure(void);
 static void portd_service_netlink_messages(void);
+static void portd_netlink_resync(struct vrf *vrf);
+static void portd_netlink_resync_all(void);
+static void portd_netlink_process_pending(struct vrf *vrf);
+static struct vrf *portd_vrf_lookup_by_nsid(int nsid);
 static void portd_run(void);
 static void portd_netlink_recv_wait__(void);
 static void portd_wait(void);
@@ -216,11 +308,13 @@ void
 portd_del_interface_netlink(const char *sub_interface_name, struct vrf *vrf);
 
 /* Lag bonding related functions */
-static void portd_del_old_interface(struct shash_node *sh_node);
-static void portd_add_new_interface(const struct ovsrec_interface *ifrow);
+static void portd_del_old_interface(struct iface_data *idp);
+static struct iface_data *
+portd_add_new_interface(const struct ovsrec_interface *ifrow);
 static void update_interface_cache(void);
-static void portd_del_old_port(struct shash_node *sh_node);
-static void portd_add_new_port(const struct ovsrec_port *port_row);
+static void portd_del_old_port(struct port_lag_data *portp);
+static struct port_lag_data *
+portd_add_new_port(const struct ovsrec_port *port_row);
 static void portd_update_bond_slaves(struct port_lag_data *portp);
 static void portd_handle_port_config(const struct ovsrec_port *row,
                                      struct port_lag_data *portp);
@@ -237,128 +331,60 @@ portd_register_event_log(struct ovsrec_port *port_row,
                                      struct port *port);
 static void portd_dump(char* buf, int buflen, const char* feature);
 static void portd_diag_dump_basic_subif_lpbk(const char *feature , char **buf);
-static bool portd_check_vlan_interface(char *port_name);
 
 int subintf_count;
 int lpbk_count;
-/*
- * Lookup port entry from DB
- */
-struct ovsrec_port*
-portd_port_db_lookup(const char *name)
-{
-    const struct ovsrec_port *port_row;
-
-    OVSREC_PORT_FOR_EACH(port_row, idl) {
-        if (!strcmp(port_row->name, name)) {
-            struct ovsrec_port *temp_port_row =
-                    CONST_CAST(struct ovsrec_port *, port_row);
-            return temp_port_row;
-        }
-    }
-    return NULL;
-}
 
-/**
- * Function: portd_interface_type_internal_check
- * Param:
- *      port: port record whose interfaces are examined for "internal" type.
- *      interface_name: Name of interface to check "internal" type.
- * Return:
- *      true  : Provided interface exists and is of type "internal"
- *      false : Provide interface either doesn't exist or not "internal" type.
+/*
+ * Returns true if 'column' of the IDL 'row' was updated since the last
+ * reconfiguration, which includes the row being inserted with a value in
+ * that column.  Unlike OVSREC_IDL_IS_COLUMN_MODIFIED, which tells whether
+ * the column changed in any row of the table, only 'row' is considered.
+ * The column must be tracked, see portd_init().
+ *
+ * The portd_col_unchanged coverage counter reports the checks that found
+ * the column unchanged, i.e. the handler runs a table wide check would
+ * have made for nothing while another row changed.
  */
 bool
-portd_interface_type_internal_check(const struct ovsrec_port *port,
-                                    const char *interface_name)
+portd_idl_col_changed(const struct ovsdb_idl_row *row,
+                      const struct ovsdb_idl_column *column)
 {
-    struct ovsrec_interface *intf;
-    size_t i = 0;
-
-    for (i = 0; i < port->n_interfaces; ++i) {
-        intf = port->interfaces[i];
-        if (strcmp(port->name, intf->name) == 0 &&
-            strcmp(intf->type, OVSREC_INTERFACE_TYPE_INTERNAL) == 0) {
-
-            VLOG_DBG("[%s:%d]: Interface %s is of type \"internal\" found. ",
-                        __FUNCTION__, __LINE__, interface_name);
-            return true;
-        }
+    if (ovsdb_idl_track_is_updated(row, column)) {
+        COVERAGE_INC(portd_col_changed);
+        return true;
     }
-
-    VLOG_DBG("[%s:%d]: Interface %s is NOT of type \"internal\". ",
-                __FUNCTION__, __LINE__, interface_name);
+    COVERAGE_INC(portd_col_unchanged);
     return false;
 }
 
-/**
- * Function: portd_interface_type_loopback_check
- * Param:
- *      port: port record whose interfaces are examined for "loopback" type.
- *      interface_name: Name of interface to check "loopback" type.
- * Return:
- *      true  : Provided interface exists and is of type "loopback"
- *      false : Provide interface either doesn't exist or not "loopback" type.
+/*
+ * Lookup port entry from DB, using the name index kept up to date by
+ * portd_index_run().
  */
-bool
-portd_interface_type_loopback_check(const struct ovsrec_port *port,
-        const char *interface_name)
+struct ovsrec_port*
+portd_port_db_lookup(const char *name)
 {
-    struct ovsrec_interface *intf;
-    size_t i=0;
-
-    for (i=0; i<port->n_interfaces; ++i) {
-        intf = port->interfaces[i];
-        if (strcmp(port->name, intf->name)==0 &&
-                strcmp(intf->type, OVSREC_INTERFACE_TYPE_LOOPBACK)==0) {
-
-            VLOG_DBG("[%s:%d]: Interface %s is of type \"loopback\" found. ",
-                    __FUNCTION__, __LINE__, interface_name);
-            return true;
-        }
-    }
-
-    VLOG_DBG("[%s:%d]: Interface %s is NOT of type \"loopback\". ",
-            __FUNCTION__, __LINE__, interface_name);
-    return false;
+    return CONST_CAST(struct ovsrec_port *, portd_index_port_find(name));
 }
 
-
 /**
- * Function: portd_interface_type_subinterface_check
+ * Function: portd_port_is_intervlan
  * Param:
- *      port: port record whose interfaces are examined for "subinterface" type
- *      interface_name: Name of interface to check "subinterface" type
+ *      port: port record to check.
  * Return:
- *      true  : Provided interface exists and is of type "subinterface"
- *      false : Provide interface either doesn't exist or not "subinterface".
+ *      true  : The port's interface is of type "internal" and the port is
+ *              in "bridge_normal" and in the default VRF.
+ *      false : Otherwise.
  */
 bool
-portd_interface_type_subinterface_check(const struct ovsrec_port *port,
-        const char *interface_name)
+portd_port_is_intervlan(const struct ovsrec_port *port)
 {
-    struct ovsrec_interface *intf;
-    size_t i=0;
-
-    for (i=0; i<port->n_interfaces; ++i) {
-        intf = port->interfaces[i];
-        if (strcmp(port->name, intf->name)==0 &&
-                strcmp(intf->type, OVSREC_INTERFACE_TYPE_VLANSUBINT)==0) {
-
-            VLOG_DBG("[%s:%d]: Interface %s is of type \"vlansubintf\" found.",
-                    __FUNCTION__, __LINE__, interface_name);
-            return true;
-        }
-    }
-
-    VLOG_DBG("[%s:%d]: Interface %s is NOT of type \"vlansubintf\". ",
-            __FUNCTION__, __LINE__, interface_name);
-    return false;
+    return (portd_index_port_class(port) == PORTD_PORT_CLASS_INTERNAL &&
+            portd_port_in_bridge_check(port->name, DEFAULT_BRIDGE_NAME) &&
+            portd_port_in_vrf_check(port->name, DEFAULT_VRF_NAME));
 }
 
-
-
-
 /**
  * Function: portd_port_in_bridge_check
  * Param:
@@ -372,32 +398,11 @@ portd_interface_type_subinterface_check(const struct ovsrec_port *port,
 bool
 portd_port_in_bridge_check(const char *port_name, const char *bridge_name)
 {
-    const struct ovsrec_bridge *row, *next;
-    struct ovsrec_port  *port;
-    size_t i;
-
-    OVSREC_BRIDGE_FOR_EACH_SAFE (row, next, idl) {
-        if (bridge_name &&
-            (strcmp(bridge_name, PORTD_EMPTY_STRING) != 0) &&
-            (strcmp(row->name, bridge_name) != 0)) {
-            continue;
-        }
-
-        for (i = 0; i < row->n_ports; i++) {
-            port = row->ports[i];
-            /* input port is part of one of bridge */
-            if (strcmp(port->name, port_name) == 0) {
-                VLOG_DBG("[%s:%d]: Port %s is part of bridge %s", __FUNCTION__,
-                                __LINE__, port_name, bridge_name);
-                return true;
-            }
-        }
-    }
-
-    VLOG_DBG("[%s:%d]: Port %s is NOT found in bridge %s", __FUNCTION__,
-            __LINE__, port_name, bridge_name);
+    bool found = portd_index_port_in_bridge(port_name, bridge_name);
 
-    return false;
+    VLOG_DBG("[%s:%d]: Port %s is %s bridge %s", __FUNCTION__, __LINE__,
+             port_name, found ? "part of" : "NOT found in", bridge_name);
+    return found;
 }
 
 /**
@@ -413,32 +418,11 @@ portd_port_in_bridge_check(const char *port_name, const char *bridge_name)
 bool
 portd_port_in_vrf_check(const char *port_name, const char *vrf_name)
 {
-    const struct ovsrec_vrf *row, *next;
-    struct ovsrec_port  *port;
-    size_t  i;
+    bool found = portd_index_port_in_vrf(port_name, vrf_name);
 
-    OVSREC_VRF_FOR_EACH_SAFE (row, next, idl) {
-        if (vrf_name &&
-            (strcmp(vrf_name, PORTD_EMPTY_STRING) != 0) &&
-            (strcmp(row->name, vrf_name) != 0)) {
-            continue;
-        }
-
-        for (i = 0; i < row->n_ports; i++) {
-            port = row->ports[i];
-            /* input port is part of one of bridge */
-            if (strcmp(port->name, port_name) == 0) {
-                VLOG_DBG("[%s:%d]: Port %s is part of VRF %s", __FUNCTION__,
-                                __LINE__, port_name, vrf_name);
-                return true;
-            }
-        }
-    }
-
-    VLOG_DBG("[%s:%d]: Port %s is NOT found in VRF %s", __FUNCTION__,
-            __LINE__, port_name, vrf_name);
-
-    return false;
+    VLOG_DBG("[%s:%d]: Port %s is %s VRF %s", __FUNCTION__, __LINE__,
+             port_name, found ? "part of" : "NOT found in", vrf_name);
+    return found;
 }
 
 /*
@@ -447,81 +431,131 @@ portd_port_in_vrf_check(const char *port_name, const char *vrf_name)
  * function to act on Netlink messages.
  * The on_init flag is used to ensure that the recvmsg
  * blocks when init socket is reading the dump responses.
+ * 'vrf' is the namespace the messages belong to, NULL for the default one.
+ * Messages received from another namespace on the socket shared by all
+ * namespaces are handled in the namespace of the VRF they come from.
+ * Otherwise, pending notifications are processed up to
+ * PORTD_NL_RECV_BUDGET datagrams, the rest being left for the next
+ * iteration of the main loop.
  */
 void
-nl_msg_process(void *user_data, int sock, bool on_init)
+nl_msg_process(void *user_data, struct vrf *vrf, int sock, bool on_init)
 {
+    struct nlmsghdr *msgs[PORTD_NL_RECV_BATCH];
+    int lens[PORTD_NL_RECV_BATCH];
+    int nsids[PORTD_NL_RECV_BATCH];
+    unsigned int budget = PORTD_NL_RECV_BUDGET;
     bool multipart_msg_end = false;
 
     while (!multipart_msg_end) {
-        struct sockaddr_nl nladdr;
-        struct msghdr msg;
-        struct iovec iov;
-        struct nlmsghdr *nlh;
-        char buffer[RECV_BUFFER_SIZE];
-        int ret;
-
-        iov.iov_base = (void *)buffer;
-        iov.iov_len = sizeof(buffer);
-        msg.msg_name = (void *)&(nladdr);
-        msg.msg_namelen = sizeof(nladdr);
-        msg.msg_iov = &iov;
-        msg.msg_iovlen = 1;
+        int i, n;
+
+        if (!on_init && !budget) {
+            VLOG_DBG("Netlink receive budget exhausted on socket %d", sock);
+            COVERAGE_INC(portd_nl_recv_budget);
+            poll_immediate_wake();
+            return;
+        }
 
         /* In order not to block on the recvmsg, MSG_DONTWAIT
-         * is passed as a flag. the return value is EAGAIN if
-         * no data is available
-         * MSG_DONTWAIT is used during normal flow.
+         * is passed as a flag during normal flow.
          * On init, we will block till we get updates from
          * the kernel and perform reconfiguration of
          * IP addresses and interfaces
          */
-        ret = recvmsg(sock, &msg, on_init ? 0 : MSG_DONTWAIT);
-
-        if (ret < 0) {
+        n = portd_nl_recv(sock, on_init, msgs, lens, nsids);
+        if (n == -ENOBUFS) {
+            /* The kernel dropped notifications, the namespace state
+             * portd knows about can no longer be trusted. */
+            portd_nl_overrun(NL_SOCK(vrf));
+            if (!on_init && nl_listen_all_nsid && sock == nl_sock) {
+                /* The lost notifications may be of any namespace. */
+                portd_netlink_resync_all();
+            } else if (!on_init) {
+                portd_netlink_resync(vrf);
+            }
+            continue;
+        }
+        if (n <= 0) {
             return;
         }
+        budget -= MIN(budget, n);
+
+        for (i = 0; i < n && !multipart_msg_end; i++) {
+            struct vrf *msg_vrf = vrf;
+            struct portd_nl_link_msg link_msg;
+            struct portd_nl_addr_msg addr_msg;
+            struct nlmsghdr *nlh;
+            int ret = lens[i];
+
+            if (nsids[i] >= 0) {
+                msg_vrf = portd_vrf_lookup_by_nsid(nsids[i]);
+                if (!msg_vrf) {
+                    VLOG_DBG("Ignoring netlink message from unknown "
+                             "namespace %d", nsids[i]);
+                    continue;
+                }
+            }
 
-        nlh = (struct nlmsghdr*) buffer;
+            for (nlh = msgs[i]; NLMSG_OK(nlh, ret);
+                 nlh = NLMSG_NEXT(nlh, ret)) {
+                switch(nlh->nlmsg_type) {
 
-        for (nlh = (struct nlmsghdr *) buffer;
-             NLMSG_OK(nlh, ret);
-             nlh = NLMSG_NEXT(nlh, ret)) {
-            switch(nlh->nlmsg_type) {
+                case RTM_NEWADDR:
+                    if (!portd_nl_parse_addr(nlh, &addr_msg)) {
+                        break;
+                    }
+                    portd_nl_addr_update(NL_SOCK(msg_vrf), &addr_msg);
+                    /*
+                     * The network address dump request is only made
+                     * during init and resync, which pass the list of
+                     * kernel ports to fill. Address notifications only
+                     * update the kernel shadow state.
+                     */
+                    if (user_data) {
+                        parse_nl_ip_address_msg_on_init(msg_vrf, &addr_msg,
+                                                        user_data);
+                    }
+                    break;
+                case RTM_NEWLINK:
+                    if (portd_nl_parse_link(nlh, &link_msg)) {
+                        portd_nl_ifindex_update(NL_SOCK(msg_vrf), &link_msg);
+                        parse_nl_new_link_msg(&link_msg, user_data);
+                    }
+                    break;
 
-            case RTM_NEWADDR:
-                /*
-                 * The network address dump request is only made
-                 * during init. The assumption is that all the
-                 * address messages from the kernel comes back
-                 * immediately. So, check on the portd_config_on_init
-                 * flag before we process address messages from kernel
-                 */
-                if (portd_config_on_init) {
-                    parse_nl_ip_address_msg_on_init(nlh, ret, user_data);
+                case RTM_DELLINK:
+                    if (portd_nl_parse_link(nlh, &link_msg)) {
+                        portd_nl_ifindex_update(NL_SOCK(msg_vrf), &link_msg);
+                    }
+                    break;
+
+                case RTM_DELADDR:
+                    if (portd_nl_parse_addr(nlh, &addr_msg)) {
+                        portd_nl_addr_update(NL_SOCK(msg_vrf), &addr_msg);
+                    }
+                    break;
+
+                case NLMSG_ERROR:
+                    portd_nl_ack(NL_SOCK(msg_vrf), nlh);
+                    break;
+
+                case NLMSG_DONE:
+                    VLOG_DBG("End of multi part message");
+                    multipart_msg_end = true;
+                    break;
+
+                default:
+                    break;
+                } /* end of switch */
+
+                if (on_init && !(nlh->nlmsg_flags & NLM_F_MULTI)) {
+                    VLOG_DBG("End of message. Not a multipart message");
+                    return;
                 }
-                break;
-            case RTM_NEWLINK:
-                parse_nl_new_link_msg(nlh, user_data);
-                break;
-
-            case NLMSG_DONE:
-                VLOG_DBG("End of multi part message");
-                multipart_msg_end = true;
-                break;
-
-            default:
-                break;
-            } /* end of switch */
-
-            if (!(nlh->nlmsg_flags & NLM_F_MULTI)) {
-                VLOG_DBG("End of message. Not a multipart message");
-                goto end;
             }
         }
     }
-end:
-    return;
 }
 
 /**
@@ -541,6 +575,22 @@ portd_vrf_lookup(const char *name)
     return NULL;
 }
 
+/* Returns the vrf whose events are tagged with namespace id 'nsid' on the
+ * shared notification socket, or NULL. */
+static struct vrf *
+portd_vrf_lookup_by_nsid(int nsid)
+{
+    struct vrf *vrf;
+
+    HMAP_FOR_EACH_WITH_HASH (vrf, nsid_node, hash_int(nsid, 0),
+                             &vrfs_by_nsid) {
+        if (vrf->nsid == nsid) {
+            return vrf;
+        }
+    }
+    return NULL;
+}
+
 /**
  * This function returns the 'port' structure corresponding to a
  * port 'name' in a given 'vrf'. If the port does not not exist
@@ -568,22 +618,42 @@ portd_port_lookup(const struct vrf *vrf, const char *name)
 }
 
 /*
- * Parse the nested rtattr in IFLA_LINKFO and check if the interface
- * is of type 'vlan'
+ * Adds 'port' to the ports of its vrf and to the index of every vrf's
+ * ports.
  */
-static bool
-portd_check_interface_type_vlan(struct rtattr *link_info, int len)
+void
+portd_port_insert(struct port *port)
+{
+    uint32_t hash = hash_string(port->name, 0);
+
+    hmap_insert(&port->vrf->ports, &port->port_node, hash);
+    hmap_insert(&vrf_ports, &port->name_node, hash);
+}
+
+/* Removes 'port' from the ports of its vrf and from the index. */
+void
+portd_port_remove(struct port *port)
 {
-    while ((RTA_OK(link_info, len)) &&
-           (link_info->rta_type <= IFLA_INFO_MAX)) {
-            /* Check for Interface type 'vlan' */
-            if ((link_info->rta_type == IFLA_INFO_KIND) &&
-                (strcmp(RTA_DATA(link_info), INTERFACE_TYPE_VLAN) == 0)) {
-            return true;
+    hmap_remove(&port->vrf->ports, &port->port_node);
+    hmap_remove(&vrf_ports, &port->name_node);
+}
+
+/*
+ * Returns the 'port' structure named 'name', whatever its vrf, or NULL if
+ * no vrf has such a port.
+ */
+struct port *
+portd_port_find(const char *name)
+{
+    struct port *port;
+
+    HMAP_FOR_EACH_WITH_HASH (port, name_node, hash_string(name, 0),
+                             &vrf_ports) {
+        if (!strcmp(port->name, name)) {
+            return port;
         }
-        link_info = RTA_NEXT(link_info, len);
     }
-    return false;
+    return NULL;
 }
 
 static inline void
@@ -611,62 +681,55 @@ portd_chk_for_system_configured(void)
  * and delete from kernel if not present in DB
  */
 static void
-portd_vlan_intf_config_on_init(int intf_index, struct rtattr *link_info)
+portd_vlan_intf_config_on_init(const struct portd_nl_link_msg *msg)
 {
     struct ovsrec_port *port_row;
     char ifname[IF_NAMESIZE];
 
-    if (!portd_check_interface_type_vlan(RTA_DATA(link_info),
-                                         RTA_PAYLOAD(link_info))) {
-        /* Interface is not of type 'vlan' */
-        return;
-    }
-
     memset(ifname, 0, sizeof(ifname));
-    if_indextoname(intf_index, ifname);
+    if (msg->tb[IFLA_IFNAME]) {
+        ovs_strlcpy(ifname, RTA_DATA(msg->tb[IFLA_IFNAME]), sizeof(ifname));
+    } else {
+        if_indextoname(msg->ifi->ifi_index, ifname);
+    }
 
     port_row = portd_port_db_lookup(ifname);
     /*
      * Check if vlan interface entry was present in DB.
      * If not, remove the vlan interface from the kernel.
      */
-    if (!port_row ||
-        !(portd_interface_type_internal_check(port_row, port_row->name) &&
-          portd_port_in_bridge_check(port_row->name, DEFAULT_BRIDGE_NAME) &&
-          portd_port_in_vrf_check(port_row->name, DEFAULT_VRF_NAME))) {
+    if (!port_row || !portd_port_is_intervlan(port_row)) {
         VLOG_DBG("Deleting VLAN Interface %s", ifname);
         portd_del_vlan_interface(ifname);
     }
 }
 
 /*
- * Fetch the OVSDB interface row and update the kernel with
- * admin up/down messages
+ * Fetch the OVSDB interface row from the interface cache and update the
+ * kernel with admin up/down messages
  */
 static void
-portd_update_kernel_intf_up_down(char *intf_name)
+portd_update_kernel_intf_up_down(const char *intf_name)
 {
-    const struct ovsrec_interface *interface_row = NULL;
-    struct smap user_config;
+    const struct iface_data *idp = shash_find_data(&all_interfaces,
+                                                   intf_name);
     const char *admin_status;
 
-    OVSREC_INTERFACE_FOR_EACH (interface_row, idl) {
-        if (!strcmp(intf_name, interface_row->name)) {
-            smap_clone(&user_config, &interface_row->user_config);
-            admin_status = smap_get(&user_config,
-                                    INTERFACE_USER_CONFIG_MAP_ADMIN);
-
-            if (admin_status != NULL &&
-                !strcmp(admin_status,
-                        OVSREC_INTERFACE_USER_CONFIG_ADMIN_UP)) {
-                portd_interface_up_down(interface_row->name,
-                                        OVSREC_INTERFACE_USER_CONFIG_ADMIN_UP);
-            } else {
-                portd_interface_up_down(interface_row->name,
-                                        OVSREC_INTERFACE_USER_CONFIG_ADMIN_DOWN);
-            }
-            smap_destroy(&user_config);
-        }
+    /* The cache is brought up to date by each reconfiguration, an
+     * interface added or deleted since is handled by the next one. */
+    if (!idp || ovsrec_interface_is_deleted(idp->cfg)) {
+        return;
+    }
+
+    admin_status = smap_get(&idp->cfg->user_config,
+                            INTERFACE_USER_CONFIG_MAP_ADMIN);
+    if (admin_status != NULL &&
+        !strcmp(admin_status, OVSREC_INTERFACE_USER_CONFIG_ADMIN_UP)) {
+        portd_interface_up_down(idp->name,
+                                OVSREC_INTERFACE_USER_CONFIG_ADMIN_UP);
+    } else {
+        portd_interface_up_down(idp->name,
+                                OVSREC_INTERFACE_USER_CONFIG_ADMIN_DOWN);
     }
 }
 
@@ -676,43 +739,30 @@ portd_update_kernel_intf_up_down(char *intf_name)
  * state from the DB and update the kernel accordingly.
  */
 static void
-parse_nl_new_link_msg(struct nlmsghdr *h, struct shash *kernel_port_list)
+parse_nl_new_link_msg(const struct portd_nl_link_msg *msg,
+                      struct shash *kernel_port_list)
 {
-    struct ifinfomsg *iface;
-    struct rtattr *attribute;
-    int len;
+    const char *name = PORTD_NL_ATTR_STR(msg->tb[IFLA_IFNAME]);
 
-    iface = NLMSG_DATA(h);
-    len = h->nlmsg_len - NLMSG_LENGTH(sizeof(*iface));
+    if (name) {
+        VLOG_DBG("New interface %d : %s\n", msg->ifi->ifi_index, name);
 
-    for (attribute = IFLA_RTA(iface); RTA_OK(attribute, len);
-         attribute = RTA_NEXT(attribute, len)) {
-        switch(attribute->rta_type) {
-        case IFLA_IFNAME:
-            VLOG_DBG("New interface %d : %s\n",
-                     iface->ifi_index, (char *) RTA_DATA(attribute));
+        if (portd_config_on_init && kernel_port_list) {
+            struct kernel_port *port;
 
-            if (portd_config_on_init && kernel_port_list) {
-                struct kernel_port *port;
+            port = find_or_create_kernel_port (kernel_port_list, name);
+            shash_add_once(kernel_port_list, name, port);
+        }
 
-                port = find_or_create_kernel_port (kernel_port_list, (char *)RTA_DATA(attribute));
-                shash_add_once(kernel_port_list, (char *)RTA_DATA(attribute), port);
-            }
+        portd_update_kernel_intf_up_down(name);
+    }
 
-            portd_update_kernel_intf_up_down((char *)RTA_DATA(attribute));
-            break;
-        case IFLA_LINKINFO:
-            /*
-             * This case is especially used for processing
-             * intervlan interfaces. They are processed only during init.
-             */
-            if (portd_config_on_init) {
-                portd_vlan_intf_config_on_init(iface->ifi_index, attribute);
-            }
-            break;
-        default:
-            break;
-        }
+    /*
+     * This case is especially used for processing
+     * intervlan interfaces. They are processed only during init.
+     */
+    if (portd_config_on_init && msg->kind == PORTD_NL_KIND_VLAN) {
+        portd_vlan_intf_config_on_init(msg);
     }
 }
 
@@ -745,6 +795,22 @@ portd_netlink_socket_open(char *vrf_ns_name, int *sock, bool is_init_sock)
         goto label;
     }
 
+    if (is_init_sock) {
+        /* Command socket, lets dumps be filtered. */
+        portd_nl_strict_enable(*sock);
+    }
+
+    if (!is_init_sock && nl_rcvbuf > 0) {
+        /* SO_RCVBUFFORCE is not bound by net.core.rmem_max. */
+        if (setsockopt(*sock, SOL_SOCKET, SO_RCVBUFFORCE, &nl_rcvbuf,
+                       sizeof(nl_rcvbuf)) < 0 &&
+            setsockopt(*sock, SOL_SOCKET, SO_RCVBUF, &nl_rcvbuf,
+                       sizeof(nl_rcvbuf)) < 0) {
+            VLOG_WARN("Netlink socket receive buffer size %d not set (%s) "
+                      "for ns (%s)", nl_rcvbuf, strerror(errno), vrf_ns_name);
+        }
+    }
+
     memset((void *) &s_addr, 0, sizeof(s_addr));
     s_addr.nl_family = AF_NETLINK;
     if (!is_init_sock) {
@@ -787,7 +853,9 @@ portd_init(const char *remote)
     ovsdb_idl_verify_write_only(idl);
 
     ovsdb_idl_add_table(idl, &ovsrec_table_subsystem);
+    ovsdb_idl_add_column(idl, &ovsrec_subsystem_col_name);
     ovsdb_idl_add_column(idl, &ovsrec_subsystem_col_other_info);
+    ovsdb_idl_add_column(idl, &ovsrec_subsystem_col_interfaces);
 
     ovsdb_idl_add_table(idl, &ovsrec_table_system);
     ovsdb_idl_add_column(idl, &ovsrec_system_col_cur_cfg);
@@ -802,7 +870,6 @@ portd_init(const char *remote)
     ovsdb_idl_add_table(idl, &ovsrec_table_bridge);
     ovsdb_idl_add_column(idl, &ovsrec_bridge_col_name);
     ovsdb_idl_add_column(idl, &ovsrec_bridge_col_vlans);
-    ovsdb_idl_omit_alert(idl, &ovsrec_bridge_col_vlans);
     ovsdb_idl_add_column(idl, &ovsrec_bridge_col_ports);
 
     ovsdb_idl_add_table(idl, &ovsrec_table_port);
@@ -846,7 +913,6 @@ portd_init(const char *remote)
     ovsdb_idl_add_column(idl, &ovsrec_vlan_col_name);
     ovsdb_idl_omit_alert(idl, &ovsrec_vlan_col_name);
     ovsdb_idl_add_column(idl, &ovsrec_vlan_col_id);
-    ovsdb_idl_omit_alert(idl, &ovsrec_vlan_col_id);
     ovsdb_idl_add_column(idl, &ovsrec_vlan_col_admin);
     ovsdb_idl_omit_alert(idl, &ovsrec_vlan_col_admin);
     ovsdb_idl_add_column(idl, &ovsrec_vlan_col_oper_state);
@@ -856,19 +922,98 @@ portd_init(const char *remote)
     ovsdb_idl_add_column(idl, &ovsrec_vlan_col_internal_usage);
     ovsdb_idl_omit_alert(idl, &ovsrec_vlan_col_internal_usage);
 
+    /*
+     * Track the changes of the port and interface rows, so that each
+     * reconfiguration only visits the rows inserted, modified or deleted
+     * since the previous one instead of walking the whole tables.  The
+     * columns that do not alert portd are not tracked.
+     */
+    ovsdb_idl_track_add_column(idl, &ovsrec_port_col_name);
+    ovsdb_idl_track_add_column(idl, &ovsrec_port_col_ip4_address);
+    ovsdb_idl_track_add_column(idl, &ovsrec_port_col_ip4_address_secondary);
+    ovsdb_idl_track_add_column(idl, &ovsrec_port_col_ip6_address);
+    ovsdb_idl_track_add_column(idl, &ovsrec_port_col_ip6_address_secondary);
+    ovsdb_idl_track_add_column(idl, &ovsrec_port_col_interfaces);
+    ovsdb_idl_track_add_column(idl, &ovsrec_port_col_vlan_tag);
+    ovsdb_idl_track_add_column(idl, &ovsrec_port_col_admin);
+    ovsdb_idl_track_add_column(idl, &ovsrec_port_col_other_config);
+
+    ovsdb_idl_track_add_column(idl, &ovsrec_interface_col_name);
+    ovsdb_idl_track_add_column(idl, &ovsrec_interface_col_admin_state);
+    ovsdb_idl_track_add_column(idl, &ovsrec_interface_col_user_config);
+    ovsdb_idl_track_add_column(idl, &ovsrec_interface_col_hw_intf_config);
+    ovsdb_idl_track_add_column(idl, &ovsrec_interface_col_type);
+    ovsdb_idl_track_add_column(idl, &ovsrec_interface_col_subintf_parent);
+    ovsdb_idl_track_add_column(idl, &ovsrec_interface_col_hw_bond_config);
+    ovsdb_idl_track_add_column(idl, &ovsrec_interface_col_forwarding_state);
+
+    /* The port memberships of the bridges and VRFs are indexed, and the
+     * VLANs of the default bridge loaded in the internal VLAN allocator. */
+    ovsdb_idl_track_add_column(idl, &ovsrec_bridge_col_name);
+    ovsdb_idl_track_add_column(idl, &ovsrec_bridge_col_ports);
+    ovsdb_idl_track_add_column(idl, &ovsrec_bridge_col_vlans);
+    ovsdb_idl_track_add_column(idl, &ovsrec_vrf_col_name);
+    ovsdb_idl_track_add_column(idl, &ovsrec_vrf_col_ports);
+
+    /* The VLAN rows are indexed by id.  The 'vlans' column of the default
+     * bridge is only updated through mutations, which the bridge row does
+     * not reflect before ovsdb-server replies, so the internal VLANs are
+     * looked up in the index, where those inserted by the pass already
+     * are. */
+    ovsdb_idl_track_add_column(idl, &ovsrec_vlan_col_id);
+
+    /* The interfaces are mapped to the internal VLAN pool of their
+     * subsystem when the subsystems change. */
+    ovsdb_idl_track_add_column(idl, &ovsrec_subsystem_col_name);
+    ovsdb_idl_track_add_column(idl, &ovsrec_subsystem_col_interfaces);
+
     INIT_DIAG_DUMP_BASIC(portd_diag_dump_basic_subif_lpbk);
     unixctl_command_register("portd/dump", "", 0, 0,
                              portd_unixctl_dump, NULL);
     unixctl_command_register("portd/getbondingconfiguration", "", 0, 1,
                              portd_unixctl_getbondingconfiguration, NULL);
+    unixctl_command_register("portd/netlink", "", 0, 0,
+                             portd_unixctl_netlink, NULL);
+    unixctl_command_register("portd/netlink-parse-bench", "[ITERATIONS]", 0, 1,
+                             portd_unixctl_netlink_parse_bench, NULL);
+    unixctl_command_register("portd/txn", "", 0, 0,
+                             portd_unixctl_txn, NULL);
+    unixctl_command_register("portd/reconcile", "[WINDOW [MAX-DELAY]]", 0, 2,
+                             portd_unixctl_reconcile, NULL);
+    unixctl_command_register("portd/vlan-alloc-bench", "[FREE [ITERATIONS]]",
+                             0, 2, portd_unixctl_vlan_alloc_bench, NULL);
+    unixctl_command_register("portd/internal-vlan-quarantine", "[GRACE]",
+                             0, 1, portd_unixctl_internal_vlan_quarantine,
+                             NULL);
+    unixctl_command_register("portd/internal-vlan-pools", "", 0, 0,
+                             portd_unixctl_internal_vlan_pools, NULL);
+    portd_txn_init(db_commit_async, portd_internal_vlan_replay);
+    portd_vlan_alloc_init(&internal_vlans);
+    portd_vlan_pools_init(&vlan_pools);
+    portd_vlan_quarantine_init(&vlan_quarantine);
+    portd_reconcile_set(reconcile_window, reconcile_max_delay);
+    portd_reconcile_init(idl_seqno);
     /*
      * Open a netlink socket for communication with the kernel
      */
     portd_netlink_socket_open(DEFAULT_VRF_NAME, &nl_sock, false);
+    portd_netlink_socket_open(DEFAULT_VRF_NAME, &nl_cmd_sock, true);
+    portd_nl_ns_init(nl_sock, nl_cmd_sock);
+    if (nl_listen_all_nsid) {
+        int one = 1;
+
+        if (setsockopt(nl_sock, SOL_NETLINK, NETLINK_LISTEN_ALL_NSID,
+                       &one, sizeof(one)) < 0) {
+            VLOG_WARN("Netlink socket cannot listen to all namespaces (%s), "
+                      "using a socket per vrf", strerror(errno));
+            nl_listen_all_nsid = false;
+        }
+    }
+    portd_sysctl_open(NULL, sysctl_fd);
 
     /* By default, we disable routing at the start.
      * Enabling will be done as part of reconfigure. */
-    portd_config_iprouting(DEFAULT_VRF_NAME, PORTD_DISABLE_ROUTING);
+    portd_config_iprouting(NULL, PORTD_DISABLE_ROUTING);
 
     retval = event_log_init("PORT");
     if(retval < 0) {
@@ -882,8 +1027,16 @@ portd_init(const char *remote)
 static void
 portd_exit(void)
 {
+    portd_nl_ns_destroy(nl_sock);
     close(nl_sock);
     nl_sock = -1;
+    close(nl_cmd_sock);
+    nl_cmd_sock = -1;
+    portd_sysctl_close(sysctl_fd);
+    portd_txn_destroy();
+    portd_vlan_pools_destroy(&vlan_pools);
+    vlan_pools_loaded = false;
+    portd_vlan_quarantine_destroy(&vlan_quarantine);
     ovsdb_idl_destroy(idl);
 }
 
@@ -891,25 +1044,70 @@ portd_exit(void)
 static void
 portd_set_status_error(const struct ovsrec_port *port_row, char *error)
 {
-    struct smap set_status_smap;
     if(!port_row){
         VLOG_ERR("Invalid call with port entry null");
         return;
     }
-    smap_init(&set_status_smap);
-    smap_clone(&set_status_smap, &port_row->status);
-    smap_replace(&set_status_smap, PORT_STATUS_MAP_ERROR, error);
-    ovsrec_port_set_status(port_row, &set_status_smap);
-    smap_destroy(&set_status_smap);
-    commit_txn = true;
+    portd_txn_port_setkey(port_row, PORTD_TXN_PORT_STATUS,
+                          PORT_STATUS_MAP_ERROR, error);
 }
 
-/* Function to set hw_cfg in port row */
+/*
+ * Reports the outcome of the kernel requests acknowledged since the last
+ * call in the status column of their ports: a failure is written under
+ * PORT_STATUS_MAP_KERNEL_ERROR, which is removed once all the requests made
+ * for the port succeed.
+ */
+static void
+portd_update_kernel_status(void)
+{
+    struct shash results;
+    struct shash_node *node;
+
+    shash_init(&results);
+    portd_nl_results_take(&results);
+
+    SHASH_FOR_EACH (node, &results) {
+        const struct portd_nl_result *result = node->data;
+        const struct ovsrec_port *port_row = portd_port_db_lookup(node->name);
+        const char *old_error;
+        char *error;
+
+        if (!port_row) {
+            continue;
+        }
+
+        old_error = portd_txn_port_get(port_row, PORTD_TXN_PORT_STATUS,
+                                       PORT_STATUS_MAP_KERNEL_ERROR);
+        if (!result->error && !old_error) {
+            continue;
+        }
+
+        error = result->error
+                ? xasprintf("%s: %s",
+                            portd_nl_msg_type_to_string(result->type),
+                            strerror(result->error))
+                : NULL;
+        if (!error || !old_error || strcmp(error, old_error)) {
+            if (error) {
+                portd_txn_port_setkey(port_row, PORTD_TXN_PORT_STATUS,
+                                      PORT_STATUS_MAP_KERNEL_ERROR, error);
+            } else {
+                portd_txn_port_delkey(port_row, PORTD_TXN_PORT_STATUS,
+                                      PORT_STATUS_MAP_KERNEL_ERROR);
+            }
+        }
+        free(error);
+    }
+    shash_destroy_free_data(&results);
+}
+
+/* Function to set hw_cfg in port row.  The keys are only written at the
+ * end of the pass, once, whatever the number of calls for the port. */
 static void
 portd_set_hw_cfg(struct port *port, const struct ovsrec_port *port_row)
 {
     char vlan_id[PORTD_VLAN_ID_STRING_MAX_LEN];
-    struct smap hw_cfg_smap;
 
     if(!port || !port_row) {
         VLOG_ERR("Invalid call with port entry null");
@@ -920,86 +1118,36 @@ portd_set_hw_cfg(struct port *port, const struct ovsrec_port *port_row)
              "hw_config:enable = %d", port->name,
              port->internal_vid, port->hw_cfg_enable);
 
-    smap_init(&hw_cfg_smap);
-    smap_clone(&hw_cfg_smap, &port_row->hw_config);
-
     if (port->internal_vid > 0) {
         /* update port table "hw_config" with the generated vlan id */
         snprintf(vlan_id, PORTD_VLAN_ID_STRING_MAX_LEN,
                  "%d", port->internal_vid);
-        smap_replace(&hw_cfg_smap, PORT_HW_CONFIG_MAP_INTERNAL_VLAN_ID,
-                     vlan_id);
+        portd_txn_port_setkey(port_row, PORTD_TXN_PORT_HW_CONFIG,
+                              PORT_HW_CONFIG_MAP_INTERNAL_VLAN_ID, vlan_id);
     } else {
         /*
          * Uninitialized VLAN ID, so we will clear this attribute
          * Internal vlan id are not generated only for L3 interfaces
          * For other ports such as Vlan interfaces we dont need this.
          */
-        smap_remove(&hw_cfg_smap, PORT_HW_CONFIG_MAP_INTERNAL_VLAN_ID);
+        portd_txn_port_delkey(port_row, PORTD_TXN_PORT_HW_CONFIG,
+                              PORT_HW_CONFIG_MAP_INTERNAL_VLAN_ID);
     }
 
     /* update enable/disable in hw_cfg */
-    smap_replace(&hw_cfg_smap, PORT_HW_CONFIG_MAP_ENABLE,
-                 port->hw_cfg_enable ?"true":"false");
-
-    ovsrec_port_set_hw_config(port_row, &hw_cfg_smap);
-
-    smap_destroy(&hw_cfg_smap);
-    commit_txn = true;
+    portd_txn_port_setkey(port_row, PORTD_TXN_PORT_HW_CONFIG,
+                          PORT_HW_CONFIG_MAP_ENABLE,
+                          port->hw_cfg_enable ?"true":"false");
 }
 
+/*
+ * Returns the ifindex of interface 'name' in the namespace of 'vrf', or 0 if
+ * the interface does not exist.  Served from the cache kept up to date by
+ * link notifications; the kernel is only queried on a miss.
+ */
 unsigned int portd_if_nametoindex(struct vrf *vrf, const char *name)
 {
-    int status;
-    unsigned int ifindex = 0;
-    int pipe_fd[2];
-
-    pipe(pipe_fd);
-    int pid = fork();
-
-    if (pid) { /*Parent Process waits child to exit*/
-           close(pipe_fd[1]); /*read only. close write*/
-           wait(&status);
-           read(pipe_fd[0], &ifindex, sizeof(ifindex));
-           VLOG_DBG("ifindex is :%d line number-%d ", ifindex, __LINE__);
-           close(pipe_fd[0]);
-           return ifindex;
-    } else {
-           int fd_to_ns = -1;
-           char set_ns[MAX_BUFFER_LENGTH] = {0};
-            close(pipe_fd[0]); /*write only. close read*/
-
-           if (vrf && strcmp(vrf->name, DEFAULT_VRF_NAME) != 0)
-           {
-                    char buff[UUID_LEN+1] = {0};
-                   /* non default vrf. We need to open socket by entering corresponding
-                      namespace Open FD to set the thread to a namespace */
-                   strcat(set_ns, "/var/run/netns/");
-                   get_vrf_ns_from_table_id(idl, vrf->table_id, buff);
-                   strncat(set_ns, buff, strlen(buff));
-                   fd_to_ns = open(set_ns, O_RDONLY);
-                   if (fd_to_ns == -1) {
-                           VLOG_ERR("Unable to open fd for namepsace %s line %d ",
-                                   vrf->name, __LINE__);
-                            _exit(EXIT_SUCCESS);
-                           return 0;
-                   }
-                   if (setns(fd_to_ns, 0) == -1) {
-                           VLOG_ERR("Unable to set %s namespace to the thread %d %s",
-                                    vrf->name, __LINE__, strerror(errno));
-                           close(fd_to_ns);
-                            _exit(EXIT_SUCCESS);
-                           return 0;
-                   }
-           }
-           ifindex = if_nametoindex(name);
-           write(pipe_fd[1], &ifindex, sizeof(ifindex));
-           if (fd_to_ns != -1)
-               close(fd_to_ns);
-           close(pipe_fd[1]);
-           _exit(EXIT_SUCCESS);
-    }
-    return EXIT_SUCCESS;
+    return portd_nl_ifindex_get(NL_SOCK(vrf), name);
 }
 
 /*
@@ -1037,14 +1185,15 @@ portd_set_interface_mtu(const char *interface_name, unsigned int mtu)
         return;
     }
 
-    req.i.ifi_change = 0xffffffff;
+    /* Leave the interface flags alone. */
+    req.i.ifi_change = 0;
     rta = (struct rtattr *)(((char *) &req) + NLMSG_ALIGN(req.n.nlmsg_len));
     rta->rta_type = IFLA_MTU;
     rta->rta_len = RTA_LENGTH(sizeof(unsigned int));
     req.n.nlmsg_len = NLMSG_ALIGN(req.n.nlmsg_len) + RTA_LENGTH(sizeof(mtu));
     memcpy(RTA_DATA(rta), &mtu, sizeof(mtu));
 
-    if (send(NL_SOCK(vrf), &req, req.n.nlmsg_len, 0) == -1) {
+    if (portd_nl_batch_add(NL_SOCK(vrf), &req.n, interface_name) == -1) {
         VLOG_ERR("Netlink failed to set mtu %d for interface %s", mtu,
                  interface_name);
         log_event("PORT_MTU_FAIL", EV_KV("mtu", "%d", mtu),
@@ -1106,7 +1255,7 @@ portd_interface_up_down(const char *interface_name, const char *status)
         req.i.ifi_flags  &= ~IFF_UP;
     }
 
-    if (send(NL_SOCK(vrf), &req, req.n.nlmsg_len, 0) == -1) {
+    if (portd_nl_batch_add(NL_SOCK(vrf), &req.n, interface_name) == -1) {
         VLOG_ERR("Netlink failed to bring %s the interface %s", status,
                  interface_name);
         log_event("PORT_INTERFACE_FAIL", EV_KV("status", "%s", status),
@@ -1139,7 +1288,8 @@ add_link_attr(struct nlmsghdr *n, int nlmsg_maxlen,
 
 
 bool
-portd_reconfigure_subinterface(const struct ovsrec_port *port_row)
+portd_reconfigure_subinterface(const struct port *port,
+                               const struct ovsrec_port *port_row)
 {
     int ifindex;
 
@@ -1152,7 +1302,7 @@ portd_reconfigure_subinterface(const struct ovsrec_port *port_row)
     unsigned short vlan_tag = 0;
     const struct ovsrec_interface *intf_row = NULL,  *parent_intf_row = NULL;
     memset(&req, 0, sizeof(req));
-    struct vrf *vrf = get_vrf_for_port(port_row->name);
+    struct vrf *vrf = port->vrf;
 
     intf_row = portd_get_matching_interface_row(port_row);
     if (NULL == intf_row) {
@@ -1166,8 +1316,7 @@ portd_reconfigure_subinterface(const struct ovsrec_port *port_row)
         parent_intf_row = intf_row->value_subintf_parent[0];
         vlan_tag = (unsigned short)intf_row->key_subintf_parent[0];
         if ((OVSREC_IDL_IS_ROW_MODIFIED(intf_row, idl_seqno)) &&
-           (OVSREC_IDL_IS_COLUMN_MODIFIED(ovsrec_interface_col_subintf_parent,
-                                          idl_seqno))) {
+           (PORTD_IDL_COL_CHANGED(intf_row, interface, subintf_parent))) {
             if (old_tag != vlan_tag){
                log_event("SUBINTERFACE_ENC_UPDATE", EV_KV("interface",
                       "%s", port_row->name),
@@ -1235,9 +1384,10 @@ portd_reconfigure_subinterface(const struct ovsrec_port *port_row)
         add_link_attr(&req.n, sizeof(req), IFLA_IFNAME, port_row->name,
                 strlen(port_row->name)+1);
 
-        if (send(NL_SOCK(vrf), &req, req.n.nlmsg_len, 0) == -1) {
-            VLOG_ERR("Netlink failed to create sub interface: %s (%s)",
-                    port_row->name, strerror(errno));
+        if (portd_nl_batch_add(NL_SOCK(vrf), &req.n,
+                               port_row->name) == -1) {
+            VLOG_ERR("Netlink failed to create sub interface: %s",
+                    port_row->name);
             return false;
         }
     }
@@ -1304,9 +1454,9 @@ portd_del_interface_netlink(const char *interface_name, struct vrf *vrf)
         return;
     }
 
-    if (send(NL_SOCK(vrf), &req, req.n.nlmsg_len, 0) == -1) {
-        VLOG_ERR("Netlink failed to delete interface: %s (%s)",
-                interface_name, strerror(errno));
+    if (portd_nl_batch_add(NL_SOCK(vrf), &req.n, interface_name) == -1) {
+        VLOG_ERR("Netlink failed to delete interface: %s",
+                interface_name);
         return;
     }
 
@@ -1315,31 +1465,24 @@ portd_del_interface_netlink(const char *interface_name, struct vrf *vrf)
 }
 
 
-/* Function : fffffffet_matching_interface_row()
- * Desc     : search the ovsdb and get the matching
- *            interface row based on the port row name.
- * Param    : seach based on row name
+/* Function : portd_get_matching_interface_row()
+ * Desc     : get the interface row of the port row that has
+ *            the same name as the port, from the index
+ *            maintained by portd_index_run().
+ * Param    : port row
  * Return   : returns the matching row or NULL incase
  *            no row is found.
  */
 static struct ovsrec_interface *
 portd_get_matching_interface_row(const struct ovsrec_port *port_row)
 {
-    const struct ovsrec_interface *int_row = NULL;
-    int i;
-
-    for (i = 0; i < port_row->n_interfaces; i++) {
-        int_row = port_row->interfaces[i];
-        if (!strcmp(int_row->name, port_row->name)) {
-            return (struct ovsrec_interface *)int_row;
-        }
-    }
-    return NULL;
+    return CONST_CAST(struct ovsrec_interface *,
+                      portd_index_port_iface(port_row));
 }
 
 /* Function : portd_get_port_row()
- * Desc     : search the ovsdb and get the port
- *           row for the interface.
+ * Desc     : get the port row for the interface, from the
+ *            index maintained by portd_index_run().
  * Param    : interface row
  * Return   : returns the port row or NULL in case
  *            no row is found.
@@ -1347,21 +1490,7 @@ portd_get_matching_interface_row(const struct ovsrec_port *port_row)
 static struct ovsrec_port *
 portd_get_port_row(const struct ovsrec_interface *intf_row)
 {
-    const struct ovsrec_port *port_row = NULL;
-    int i;
-
-    /* find out which port has this interface associated with it */
-    OVSREC_PORT_FOR_EACH(port_row, idl) {
-        if (port_row->n_interfaces) {
-            for (i = 0; i < port_row->n_interfaces; i++) {
-                if (port_row->interfaces[i] == intf_row) {
-                    return (struct ovsrec_port *)port_row;
-                }
-            }
-        }
-    }
-
-    return NULL;
+    return CONST_CAST(struct ovsrec_port *, portd_index_iface_port(intf_row));
 }
 
 /* Function : portd_port_admin_state_reconfigure()
@@ -1383,10 +1512,8 @@ portd_port_admin_state_reconfigure(struct port *port,
     /*
      * Check if the admin state column changed.
      */
-    if ((OVSREC_IDL_IS_COLUMN_MODIFIED(
-                ovsrec_port_col_admin, idl_seqno)) ||
-        (OVSREC_IDL_IS_COLUMN_MODIFIED(
-                ovsrec_port_col_interfaces, idl_seqno))) {
+    if ((PORTD_IDL_COL_CHANGED(port_row, port, admin)) ||
+        (PORTD_IDL_COL_CHANGED(port_row, port, interfaces))) {
 
         VLOG_DBG("port column modified\n");
 
@@ -1432,17 +1559,32 @@ portd_port_admin_state_reconfigure(struct port *port,
     }
 }
 
+/* Returns the interface data of the IDL row with 'uuid', NULL if none. */
+static struct iface_data *
+portd_iface_lookup_by_uuid(const struct uuid *uuid)
+{
+    struct iface_data *idp;
+
+    HMAP_FOR_EACH_WITH_HASH (idp, uuid_node, uuid_hash(uuid),
+                             &interfaces_by_uuid) {
+        if (uuid_equals(&idp->cfg->header_.uuid, uuid)) {
+            return idp;
+        }
+    }
+    return NULL;
+}
+
 /**
  * Deletes an old interface from the daemon's internal data structures
  */
 static void
-portd_del_old_interface(struct shash_node *sh_node)
+portd_del_old_interface(struct iface_data *idp)
 {
-    if (sh_node) {
-        struct iface_data *idp = sh_node->data;
+    if (idp) {
+        hmap_remove(&interfaces_by_uuid, &idp->uuid_node);
+        shash_find_and_delete(&all_interfaces, idp->name);
         SAFE_FREE(idp->name);
         SAFE_FREE(idp);
-        shash_delete(&all_interfaces, sh_node);
     }
 } /* portd_del_old_interface */
 
@@ -1453,8 +1595,10 @@ portd_del_old_interface(struct shash_node *sh_node)
  * copies data into new iface_data entry.
  * Adds the new iface_data entry into all_interfaces shash map.
  * @param ifrow pointer to interface configuration row in IDL cache.
+ *
+ * @return the new entry, NULL if an interface has the same name.
  */
-static void
+static struct iface_data *
 portd_add_new_interface(const struct ovsrec_interface *ifrow)
 {
     struct iface_data *idp = NULL;
@@ -1473,69 +1617,64 @@ portd_add_new_interface(const struct ovsrec_interface *ifrow)
 
        /* Save the reference to IDL row. */
        idp->cfg = ifrow;
+       hmap_insert(&interfaces_by_uuid, &idp->uuid_node,
+                   uuid_hash(&ifrow->header_.uuid));
 
        VLOG_DBG("Created local data for interface %s", ifrow->name);
     }
+    return idp;
 } /* portd_add_new_interface */
 
 /**
  * Update daemon's internal interface data structures based on the latest
  * data from OVSDB.
+ *
+ * Only the Interface rows inserted, modified or deleted since the last
+ * reconfiguration are visited, as reported by the IDL change tracking.
  */
 static void
 update_interface_cache(void)
 {
-    struct shash sh_idl_interfaces;
     const struct ovsrec_interface *ifrow;
-    struct shash_node *sh_node, *sh_next;
+    struct iface_data *idp;
 
-    /* Collect all the interfaces in the DB. */
-    shash_init(&sh_idl_interfaces);
-    OVSREC_INTERFACE_FOR_EACH(ifrow, idl) {
-        if (!shash_add_once(&sh_idl_interfaces, ifrow->name, ifrow)) {
-            VLOG_WARN("interface %s specified twice", ifrow->name);
+    /* Delete old interfaces first, so that a row replacing a deleted one of
+     * the same name can be added. */
+    OVSREC_INTERFACE_FOR_EACH_TRACKED (ifrow, idl) {
+        if (ovsrec_interface_is_deleted(ifrow)) {
+            portd_del_old_interface(
+                portd_iface_lookup_by_uuid(&ifrow->header_.uuid));
         }
     }
 
-    /* Delete old interfaces. */
-    SHASH_FOR_EACH_SAFE(sh_node, sh_next, &all_interfaces) {
-        struct iface_data *idp =
-            shash_find_data(&sh_idl_interfaces, sh_node->name);
-        if (!idp) {
-            portd_del_old_interface(sh_node);
+    OVSREC_INTERFACE_FOR_EACH_TRACKED (ifrow, idl) {
+        if (ovsrec_interface_is_deleted(ifrow)) {
+            continue;
         }
-    }
 
-    /* Add new interfaces. */
-    SHASH_FOR_EACH(sh_node, &sh_idl_interfaces) {
-        struct iface_data *idp =
-            shash_find_data(&all_interfaces, sh_node->name);
-        if (!idp) {
-            portd_add_new_interface(sh_node->data);
+        idp = portd_iface_lookup_by_uuid(&ifrow->header_.uuid);
+        if (idp && strcmp(idp->name, ifrow->name)) {
+            /* Renamed interface. */
+            portd_del_old_interface(idp);
+            idp = NULL;
         }
-    }
 
-    /* Check for changes in the interface row entries. */
-    SHASH_FOR_EACH(sh_node, &all_interfaces) {
-        struct iface_data *idp = sh_node->data;
-        const struct ovsrec_interface *ifrow =
-            shash_find_data(&sh_idl_interfaces, sh_node->name);
-
-        /* Check for changes to row. */
-        if (OVSREC_IDL_IS_ROW_INSERTED(ifrow, idl_seqno) ||
-            OVSREC_IDL_IS_ROW_MODIFIED(ifrow, idl_seqno)) {
-
-            /* Update eligibility in interfaces that are already in a LAG */
-            if(idp->port_datap && !strncmp(idp->port_datap->name,
-                                           LAG_NAME_SUFFIX,
-                                           LAG_NAME_SUFFIX_LENGTH)) {
-                portd_update_interface_lag_eligibility(idp);
-                portd_update_bond_slaves(idp->port_datap);
+        /* Add new interfaces. */
+        if (!idp) {
+            idp = portd_add_new_interface(ifrow);
+            if (!idp) {
+                continue;
             }
         }
+
+        /* Update eligibility in interfaces that are already in a LAG */
+        if(idp->port_datap && !strncmp(idp->port_datap->name,
+                                       LAG_NAME_SUFFIX,
+                                       LAG_NAME_SUFFIX_LENGTH)) {
+            portd_update_interface_lag_eligibility(idp);
+            portd_update_bond_slaves(idp->port_datap);
+        }
     }
-    /* Destroy the shash of the IDL interfaces. */
-    shash_destroy(&sh_idl_interfaces);
 }
 /**
  * This function processes the interface "up"/"down" notifications
@@ -1570,14 +1709,18 @@ portd_handle_interface_config_mods(void)
     bool intf_admin = false;
     bool port_admin = true;
     struct port *port = NULL;
-    struct vrf *vrf;
 
     VLOG_DBG("portd_intf_admin_state_up_down_events\n");
 
-    OVSREC_INTERFACE_FOR_EACH (intf_row, idl) {
+    /* Only the interfaces changed since the last pass are tracked. */
+    OVSREC_INTERFACE_FOR_EACH_TRACKED (intf_row, idl) {
         port = NULL;
         port_row = NULL;
 
+        if (ovsrec_interface_is_deleted(intf_row)) {
+            continue;
+        }
+
         /* If the interface row is modified then update the hw_intf_config
                for the corresponding port row */
         if (OVSREC_IDL_IS_ROW_MODIFIED(intf_row, idl_seqno)) {
@@ -1586,15 +1729,8 @@ portd_handle_interface_config_mods(void)
             if ((port_row = portd_get_port_row(intf_row)) != NULL) {
                 VLOG_DBG("Port found for interface %s", intf_row->name);
 
-                /* For each vrf in all_vrfs, update the port list */
-                HMAP_FOR_EACH (vrf, node, &all_vrfs) {
-                    VLOG_DBG("vrf %s to search port %s\n", vrf->name,
-                             port_row->name);
-                    port = portd_port_lookup(vrf, port_row->name);
-                    if (port) {
-                        break;
-                    }
-                }
+                /* The cached port, whatever its vrf. */
+                port = portd_port_find(port_row->name);
 
                 if(!port) {
                     /* No port for this interface */
@@ -1608,8 +1744,7 @@ portd_handle_interface_config_mods(void)
             /*
              * Check if the user_config column changed.
              */
-            if (OVSREC_IDL_IS_COLUMN_MODIFIED(ovsrec_interface_col_user_config,
-                                              idl_seqno)) {
+            if (PORTD_IDL_COL_CHANGED(intf_row, interface, user_config)) {
                 /* Bring up kernel interface */
                 cur_state = (char *)smap_get(&intf_row->user_config,
                                              INTERFACE_USER_CONFIG_MAP_ADMIN);
@@ -1646,8 +1781,7 @@ portd_handle_interface_config_mods(void)
             /*
              * Check if the hw_intf_config column changed.
              */
-            if (OVSREC_IDL_IS_COLUMN_MODIFIED(ovsrec_interface_col_hw_intf_config,
-                                              idl_seqno))
+            if (PORTD_IDL_COL_CHANGED(intf_row, interface, hw_intf_config))
             {
                 hw_intf_config_mtu = (char *)smap_get(&intf_row->hw_intf_config,
                                              INTERFACE_HW_INTF_CONFIG_MAP_MTU);
@@ -1664,8 +1798,8 @@ portd_handle_interface_config_mods(void)
              *       state using netlink instead of admin_state which
              *       is actually the physical hardware interface state
              */
-            if (port && OVSREC_IDL_IS_COLUMN_MODIFIED(
-                    ovsrec_interface_col_admin_state, idl_seqno)) {
+            if (port && PORTD_IDL_COL_CHANGED(intf_row, interface,
+                                              admin_state)) {
 
                 if ((intf_row->admin_state != NULL) &&
                     (strcmp(intf_row->admin_state,
@@ -1684,14 +1818,19 @@ portd_handle_interface_config_mods(void)
                     VLOG_DBG("Reprogramming the IPv6 address again since "
                             "the interface is forced up again");
 
+                    /* Addresses already present in the kernel are not
+                     * added again, make sure the removals the kernel made
+                     * when the interface went down are known. */
+                    portd_netlink_process_pending(port->vrf);
+
                     if (port->ip6_address) {
-                        nl_add_ip_address(RTM_NEWADDR, port->name,
+                        nl_add_ip_address(RTM_NEWADDR, port,
                                           port->ip6_address, AF_INET6, false);
                     }
 
                     HMAP_FOR_EACH_SAFE (addr, next_addr, addr_node,
                                         &port->secondary_ip6addr) {
-                        nl_add_ip_address(RTM_NEWADDR, port->name,
+                        nl_add_ip_address(RTM_NEWADDR, port,
                                           addr->address, AF_INET6, true);
                     }
                 }
@@ -1702,21 +1841,12 @@ portd_handle_interface_config_mods(void)
 
 /* delete vlan from VLAN table in DB */
 static void
-portd_bridge_del_vlan(struct ovsrec_bridge *br, struct ovsrec_vlan *vlan)
+portd_bridge_del_vlan(const struct ovsrec_bridge *br,
+                      const struct ovsrec_vlan *vlan)
 {
-    struct ovsrec_vlan **vlans;
-    size_t i, n;
-
     VLOG_DBG("Deleting VLAN %d", (int)vlan->id);
-    vlans = xmalloc(sizeof *br->vlans * br->n_vlans);
-    for (i = n = 0; i < br->n_vlans; i++) {
-        if (br->vlans[i] != vlan) {
-            vlans[n++] = br->vlans[i];
-        }
-    }
-    ovsrec_bridge_set_vlans(br, vlans, n);
-    commit_txn = true;
-    SAFE_FREE(vlans);
+    portd_txn_vlan_written(vlan->id, NULL, false);
+    ovsrec_bridge_update_vlans_delvalue(br, vlan);
 }
 
 /**
@@ -1730,166 +1860,218 @@ portd_bridge_del_vlan(struct ovsrec_bridge *br, struct ovsrec_vlan *vlan)
 static void
 portd_del_internal_vlan(int internal_vid)
 {
-    int i;
-    struct ovsrec_vlan *vlan = NULL;
+    const struct ovsrec_vlan *vlan = NULL;
     const struct ovsrec_bridge *br_row = NULL;
     if (internal_vid == -1) {
         return;
     }
 
+    vlan = portd_index_vlan_find(internal_vid);
+    if (!vlan) {
+        return;
+    }
     OVSREC_BRIDGE_FOR_EACH (br_row, idl) {
         if (!strcmp(br_row->name, DEFAULT_BRIDGE_NAME)) {
-            for (i = 0; i < br_row->n_vlans; i++) {
-                if (internal_vid == br_row->vlans[i]->id) {
-                    vlan = br_row->vlans[i];
-                    portd_bridge_del_vlan((struct ovsrec_bridge *)br_row, vlan);
-                }
-            }
+            portd_bridge_del_vlan(br_row, vlan);
         }
     }
 }
 
-static bool
-portd_check_vlan_interface(char *port_name)
+/*
+ * Reads the range, policy and requirement of the internal VLANs of 'pool'
+ * from the other_info of its subsystem 'subsys'.  The range and policy the
+ * subsystem does not set are those of the System row 'sys'.
+ */
+static void
+portd_internal_vlan_pool_load(struct portd_vlan_pool *pool,
+                              const struct ovsrec_subsystem *subsys,
+                              const struct ovsrec_system *sys)
 {
-    const struct ovsrec_port *port_row;
-    bool interface_vlan_found;
+    const struct smap *info = &subsys->other_info;
+    const char *policy;
+    int min_internal_vlan, max_internal_vlan;
 
-    /*
-     * Check if vlan is configured as by interface VLAN.
-     */
+    pool->require_vlan = smap_get_int(info, "l3_port_requires_internal_vlan",
+                                      0) != 0;
+    free(pool->policy);
+    pool->policy = NULL;
+    if (!sys) {
+        return;
+    }
 
-    interface_vlan_found = false;
-    OVSREC_PORT_FOR_EACH (port_row, idl) {
-        if (!strncmp(port_row->name, port_name, strlen(port_name))) {
-            interface_vlan_found = true;
-        }
+    min_internal_vlan =
+            smap_get_int(&sys->other_config,
+                         SYSTEM_OTHER_CONFIG_MAP_MIN_INTERNAL_VLAN,
+                         DFLT_SYSTEM_OTHER_CONFIG_MAP_MIN_INTERNAL_VLAN_ID);
+    min_internal_vlan = smap_get_int(info,
+                                     SYSTEM_OTHER_CONFIG_MAP_MIN_INTERNAL_VLAN,
+                                     min_internal_vlan);
+    max_internal_vlan =
+            smap_get_int(&sys->other_config,
+                         SYSTEM_OTHER_CONFIG_MAP_MAX_INTERNAL_VLAN,
+                         DFLT_SYSTEM_OTHER_CONFIG_MAP_MAX_INTERNAL_VLAN_ID);
+    max_internal_vlan = smap_get_int(info,
+                                     SYSTEM_OTHER_CONFIG_MAP_MAX_INTERNAL_VLAN,
+                                     max_internal_vlan);
+    policy = smap_get(info, SYSTEM_OTHER_CONFIG_MAP_INTERNAL_VLAN_POLICY);
+    if (!policy) {
+        policy = smap_get(&sys->other_config,
+                          SYSTEM_OTHER_CONFIG_MAP_INTERNAL_VLAN_POLICY);
     }
-    return interface_vlan_found;
+    if (!policy) {
+        policy = SYSTEM_OTHER_CONFIG_MAP_INTERNAL_VLAN_POLICY_ASCENDING_DEFAULT;
+    }
+    VLOG_DBG("subsystem %s min_internal : %d, %d, %s", pool->subsystem,
+             min_internal_vlan, max_internal_vlan, policy);
+
+    pool->policy = xstrdup(policy);
+    portd_vlan_pool_set_range(
+        pool, min_internal_vlan, max_internal_vlan,
+        !strcmp(policy,
+                SYSTEM_OTHER_CONFIG_MAP_INTERNAL_VLAN_POLICY_ASCENDING_DEFAULT));
 }
 
-/* FIXME - update port table status column with error if no VLAN allocated. */
-static int
-portd_alloc_internal_vlan(void)
+/*
+ * Loads the internal VLAN allocator from the default bridge when it
+ * changed, and the internal VLAN pool of each subsystem.  The ids taken by
+ * the VLANs added in a pass stay marked until the bridge shows them, and
+ * those of the VLANs deleted stay marked until the bridge no longer does.
+ * The range and policy of the pools are read once per reconfiguration;
+ * the interfaces are mapped to the pool of the subsystem that lists them
+ * when the subsystems change, and the ports of no subsystem use the pool of
+ * the first one.
+ */
+static void
+portd_internal_vlan_sync(void)
 {
-    int i, j;
+    const struct ovsrec_subsystem *subsys = NULL;
     const struct ovsrec_bridge *br_row = NULL;
     const struct ovsrec_system *sys = NULL;
-    unsigned long *vlans_bmp;
-    bool ascending;
-    int vlan_allocated = -1;
+    bool remap;
 
-    int min_internal_vlan, max_internal_vlan;
-    const char *internal_vlan_policy;
+    OVSREC_BRIDGE_FOR_EACH_TRACKED (br_row, idl) {
+        if (!ovsrec_bridge_is_deleted(br_row)
+            && !strcmp(br_row->name, DEFAULT_BRIDGE_NAME)) {
+            portd_vlan_alloc_sync(&internal_vlans, br_row);
+        }
+    }
 
+    remap = !vlan_pools_loaded || ovsrec_subsystem_track_get_first(idl);
+    if (remap) {
+        portd_vlan_pools_start(&vlan_pools);
+    }
     sys = ovsrec_system_first(idl);
+    OVSREC_SUBSYSTEM_FOR_EACH (subsys, idl) {
+        struct portd_vlan_pool *pool;
+
+        pool = portd_vlan_pools_get(&vlan_pools, subsys->name);
+        if (remap) {
+            size_t i;
 
-    if (sys) {
-        min_internal_vlan =
-                smap_get_int(&sys->other_config,
-                             SYSTEM_OTHER_CONFIG_MAP_MIN_INTERNAL_VLAN,
-                             DFLT_SYSTEM_OTHER_CONFIG_MAP_MIN_INTERNAL_VLAN_ID);
-        max_internal_vlan =
-                smap_get_int(&sys->other_config,
-                             SYSTEM_OTHER_CONFIG_MAP_MAX_INTERNAL_VLAN,
-                             DFLT_SYSTEM_OTHER_CONFIG_MAP_MAX_INTERNAL_VLAN_ID);
-        internal_vlan_policy =
-                smap_get(&sys->other_config,
-                         SYSTEM_OTHER_CONFIG_MAP_INTERNAL_VLAN_POLICY);
-        if (!internal_vlan_policy) {
-            internal_vlan_policy =
-                SYSTEM_OTHER_CONFIG_MAP_INTERNAL_VLAN_POLICY_ASCENDING_DEFAULT;
-        }
-        VLOG_DBG("min_internal : %d, %d, %s",
-                  min_internal_vlan, max_internal_vlan,
-                  internal_vlan_policy);
-
-        /* Check if internal VLAN policy is valid */
-        if ((strcmp(
-                internal_vlan_policy,
-                SYSTEM_OTHER_CONFIG_MAP_INTERNAL_VLAN_POLICY_ASCENDING_DEFAULT) != 0) &&
-            (strcmp(
-                internal_vlan_policy,
-                SYSTEM_OTHER_CONFIG_MAP_INTERNAL_VLAN_POLICY_DESCENDING) != 0)) {
-            VLOG_ERR("Unknown internal vlan policy '%s'",
-                      internal_vlan_policy);
-            log_event("PORT_UNKNOWN_VLAN_POLICY",
-                EV_KV("policy", "%s", internal_vlan_policy));
-            return -1;
+            for (i = 0; i < subsys->n_interfaces; i++) {
+                shash_add_once(&vlan_pools.by_interface,
+                               subsys->interfaces[i]->name, pool);
+            }
+            if (!vlan_pools.dflt) {
+                vlan_pools.dflt = pool;
+            }
         }
-    } else {
+        portd_internal_vlan_pool_load(pool, subsys, sys);
+    }
+    if (remap) {
+        portd_vlan_pools_finish(&vlan_pools);
+        vlan_pools_loaded = true;
+    }
+}
+
+/* Returns true if the internal VLAN policy of 'pool' is valid, logs an
+ * error otherwise. */
+static bool
+portd_internal_vlan_policy_check(const struct portd_vlan_pool *pool)
+{
+    if (!pool->policy) {
         VLOG_ERR("Unable to access system table in db.");
-        return -1;
+        return false;
     }
 
-    ascending = (strcmp(
-                    internal_vlan_policy,
-                    SYSTEM_OTHER_CONFIG_MAP_INTERNAL_VLAN_POLICY_ASCENDING_DEFAULT) == 0);
+    /* Check if internal VLAN policy is valid */
+    if ((strcmp(
+            pool->policy,
+            SYSTEM_OTHER_CONFIG_MAP_INTERNAL_VLAN_POLICY_ASCENDING_DEFAULT) != 0) &&
+        (strcmp(
+            pool->policy,
+            SYSTEM_OTHER_CONFIG_MAP_INTERNAL_VLAN_POLICY_DESCENDING) != 0)) {
+        VLOG_ERR("Unknown internal vlan policy '%s' for subsystem '%s'",
+                  pool->policy, pool->subsystem);
+        log_event("PORT_UNKNOWN_VLAN_POLICY",
+            EV_KV("policy", "%s", pool->policy));
+        return false;
+    }
+    return true;
+}
 
-    OVSREC_BRIDGE_FOR_EACH (br_row, idl) {
-        if (!strcmp(br_row->name, DEFAULT_BRIDGE_NAME)) {
-            /* Set bitmap to identify available VLANs */
-            vlans_bmp = bitmap_allocate(VLAN_BITMAP_SIZE);
-            for (i = 0; i < br_row->n_vlans; i++) {
-                struct ovsrec_vlan *vlan_row = br_row->vlans[i];
-                bitmap_set1(vlans_bmp, vlan_row->id);
-            }
-            /* Loop through vlan bitmap and identify an available VLAN */
-            for (j = ascending ? min_internal_vlan : max_internal_vlan;
-                 ascending ? j <= max_internal_vlan : j >= min_internal_vlan;
-                 ascending ? j++ : j--) {
-
-                char port_name[8] = {0};
-                char vlan_id[8] = {0};
-
-                strncat(port_name, INTERFACE_TYPE_VLAN, strlen(INTERFACE_TYPE_VLAN));
-                snprintf(vlan_id,5, "%d", j);
-                strncat(port_name, vlan_id, strlen(vlan_id));
-                if (portd_check_vlan_interface(port_name)) {
-                    continue;
-                }
-                if (!bitmap_is_set(vlans_bmp,j)) {
-                    VLOG_DBG("Allocated internal vlan (%d)", j);
-                    vlan_allocated = j;
-                    break;
-                }
-            }
-            SAFE_FREE(vlans_bmp);
+/*
+ * Returns the free internal VLAN of 'pool' that follows 'after' in the
+ * order of its policy, the first one if 'after' is -1, or -1 if there is
+ * none.  The VLANs used by a VLAN interface are skipped.
+ */
+/* FIXME - update port table status column with error if no VLAN allocated. */
+static int
+portd_alloc_internal_vlan(const struct portd_vlan_pool *pool, int after)
+{
+    int vid;
+
+    for (vid = (after == -1
+                ? portd_vlan_alloc_first(&internal_vlans, pool)
+                : portd_vlan_alloc_next(&internal_vlans, pool, after));
+         vid != -1; vid = portd_vlan_alloc_next(&internal_vlans, pool, vid)) {
+        if (!portd_index_vlan_name_used(vid)) {
+            VLOG_DBG("Allocated internal vlan (%d)", vid);
+            return vid;
         }
     }
-    return vlan_allocated;
+    return -1;
 }
 
 /* add new vlan row into db */
 static void
-portd_bridge_insert_vlan(struct ovsrec_bridge *br, struct ovsrec_vlan *vlan)
+portd_bridge_insert_vlan(const struct ovsrec_bridge *br,
+                         const struct ovsrec_vlan *vlan)
 {
-    struct ovsrec_vlan **vlans;
-    size_t i;
+    ovsrec_bridge_update_vlans_addvalue(br, vlan);
+}
 
-    vlans = xmalloc(sizeof *br->vlans * (br->n_vlans + 1));
-    for (i = 0; i < br->n_vlans; i++) {
-        vlans[i] = br->vlans[i];
+/* Returns the default bridge row, or NULL. */
+static const struct ovsrec_bridge *
+portd_default_bridge(void)
+{
+    const struct ovsrec_bridge *br_row;
+
+    OVSREC_BRIDGE_FOR_EACH (br_row, idl) {
+        if (!strcmp(br_row->name, DEFAULT_BRIDGE_NAME)) {
+            return br_row;
+        }
     }
-    vlans[br->n_vlans] = vlan;
-    ovsrec_bridge_set_vlans(br, vlans, br->n_vlans + 1);
-    commit_txn = true;
-    SAFE_FREE(vlans);
+    return NULL;
 }
 
-/* create a new internal vlan row to be inserted into db */
+/* create a new internal vlan row to be inserted into db, and add it to
+ * the default bridge 'br_row' */
 static void
-portd_create_vlan_row(int vid, struct ovsrec_port *port_row)
+portd_create_vlan_row(const struct ovsrec_bridge *br_row, int vid,
+                      struct ovsrec_port *port_row)
 {
     char vlan_name[16];
     struct smap vlan_internal_smap;
-    const struct ovsrec_bridge *br_row = NULL;
     struct ovsrec_vlan *vlan = NULL;
 
-    vlan = ovsrec_vlan_insert(txn);
+    vlan = ovsrec_vlan_insert(portd_txn_get());
+    portd_txn_vlan_written(vid, port_row->name, true);
+    portd_vlan_alloc_mark(&internal_vlans, vid, true);
     snprintf(vlan_name, 16, "VLAN%d", vid);
     ovsrec_vlan_set_name(vlan, vlan_name);
     ovsrec_vlan_set_id(vlan, vid);
+    portd_index_vlan_inserted(vlan);
     ovsrec_vlan_set_admin(vlan, OVSREC_VLAN_ADMIN_UP);
     ovsrec_vlan_set_oper_state(vlan, OVSREC_VLAN_OPER_STATE_UP);
     ovsrec_vlan_set_oper_state_reason(vlan, OVSREC_VLAN_OPER_STATE_REASON_OK);
@@ -1898,60 +2080,338 @@ portd_create_vlan_row(int vid, struct ovsrec_port *port_row)
     smap_init(&vlan_internal_smap);
     smap_add(&vlan_internal_smap, VLAN_INTERNAL_USAGE_L3PORT, port_row->name);
     ovsrec_vlan_set_internal_usage(vlan, &vlan_internal_smap);
-    commit_txn = true;
     smap_destroy(&vlan_internal_smap);
 
-    OVSREC_BRIDGE_FOR_EACH (br_row, idl) {
-        if (!strcmp(br_row->name, DEFAULT_BRIDGE_NAME)) {
-            VLOG_DBG("Creating VLAN row '%s'", vlan_name);
-            portd_bridge_insert_vlan((struct ovsrec_bridge *)br_row, vlan);
-        }
+    if (br_row) {
+        VLOG_DBG("Creating VLAN row '%s'", vlan_name);
+        portd_bridge_insert_vlan(br_row, vlan);
     }
 }
 
-/* FIXME - move internal_vlan functions to a separate file */
+/* Makes the existing internal VLAN row 'vlan_row' the internal VLAN of
+ * 'port_name'. */
 static void
-portd_add_internal_vlan(struct port *port, struct ovsrec_port *port_row)
+portd_hand_over_vlan_row(const struct ovsrec_vlan *vlan_row,
+                         const char *port_name)
 {
-    int vid;
-    int require_vlan;
-    const struct ovsrec_subsystem *ovs_subsys;
-
-    /* FIXME: handle multiple subsystems. */
-    ovs_subsys = ovsrec_subsystem_first(idl);
-
-    if (ovs_subsys) {
-        require_vlan = smap_get_int(&ovs_subsys->other_info,
-                                    "l3_port_requires_internal_vlan",
-                                    0);
-        VLOG_DBG("l3_port requires vlan : %d", require_vlan);
-        if (require_vlan == 0) {
+    struct smap vlan_internal_smap;
+
+    portd_txn_vlan_written(vlan_row->id, port_name, true);
+    smap_init(&vlan_internal_smap);
+    smap_add(&vlan_internal_smap, VLAN_INTERNAL_USAGE_L3PORT, port_name);
+    ovsrec_vlan_set_internal_usage(vlan_row, &vlan_internal_smap);
+    smap_destroy(&vlan_internal_smap);
+}
+
+/*
+ * Adds or deletes again the internal VLAN 'vid' of 'port_name', after the
+ * transaction that did it failed, if the port still uses it or no longer
+ * does, respectively.  A row that still names the port it was evicted from
+ * is handed over again.
+ */
+static void
+portd_internal_vlan_replay(int vid, const char *port_name, bool add)
+{
+    const struct ovsrec_vlan *vlan_row = portd_index_vlan_find(vid);
+    struct port *port;
+
+    if (add) {
+        struct ovsrec_port *port_row = portd_port_db_lookup(port_name);
+
+        port = port_name ? portd_port_find(port_name) : NULL;
+        if (!port || !port_row || port->internal_vid != vid) {
             return;
         }
-    } else {
-        VLOG_ERR("Unable to acces subsystem table in db.");
+        if (!vlan_row) {
+            portd_create_vlan_row(portd_default_bridge(), vid, port_row);
+        } else if (!portd_vlan_row_is_internal(vlan_row, port_name)) {
+            const char *l3port = smap_get(&vlan_row->internal_usage,
+                                          VLAN_INTERNAL_USAGE_L3PORT);
+            struct port *holder = l3port ? portd_port_find(l3port) : NULL;
+
+            /* Leave alone a VLAN the user created with the same id, or
+             * one another port uses. */
+            if (l3port && (!holder || holder->internal_vid != vid)) {
+                portd_hand_over_vlan_row(vlan_row, port_name);
+            }
+        }
+    } else if (vlan_row) {
+        const char *l3port = smap_get(&vlan_row->internal_usage,
+                                      VLAN_INTERNAL_USAGE_L3PORT);
+
+        /* Leave alone a VLAN the user created with the same id since. */
+        port = l3port ? portd_port_find(l3port) : NULL;
+        if (l3port && (!port || port->internal_vid != vid)) {
+            portd_del_internal_vlan(vid);
+        }
+    }
+}
+
+/* Queues 'port', an L3 port created in the pass, for an internal VLAN. */
+static void
+portd_want_internal_vlan(struct internal_vlan_requests *requests,
+                         struct port *port, struct ovsrec_port *port_row)
+{
+    struct internal_vlan_request *req;
+
+    if (requests->n >= requests->allocated) {
+        requests->reqs = x2nrealloc(requests->reqs, &requests->allocated,
+                                    sizeof *requests->reqs);
+    }
+    req = &requests->reqs[requests->n++];
+    req->port = port;
+    req->port_row = port_row;
+}
+
+/*
+ * Gives an internal VLAN to each of the L3 ports in 'requests', in the
+ * order they were queued, from the pool of the port's subsystem.  The free
+ * VLANs of each pool are taken in a single sweep of the allocator, and the
+ * VLAN rows, their references from the default bridge and the hw_config
+ * of the ports are written to the transaction of the pass.  Empties
+ * 'requests'.
+ */
+/* FIXME - move internal_vlan functions to a separate file */
+static void
+portd_add_internal_vlans(struct internal_vlan_requests *requests)
+{
+    const struct ovsrec_bridge *br_row = NULL;
+    struct portd_vlan_pool *pool;
+    bool no_subsystem = false;
+    size_t i;
+
+    if (!requests->n) {
         return;
     }
 
-    vid = portd_alloc_internal_vlan();
-    if (vid == -1) {
-        VLOG_ERR("Error allocating internal vlan for port '%s'", port_row->name);
-        log_event("PORT_VLAN_ALLOCATION_ERROR",
-            EV_KV("vlan", "%s", port_row->name));
-        portd_set_status_error(port_row, PORT_STATUS_MAP_ERROR_NO_INTERNAL_VLAN);
-        log_event("INTERNAL_VLAN_ALLOCATION_ERR",
+    VLOG_DBG("Allocating internal vlans for %"PRIuSIZE" ports", requests->n);
+    HMAP_FOR_EACH (pool, node, &vlan_pools.by_subsystem) {
+        pool->usable = (pool->require_vlan
+                        && portd_internal_vlan_policy_check(pool));
+        pool->exhausted = false;
+        pool->last = -1;
+    }
+    br_row = portd_default_bridge();
+    for (i = 0; i < requests->n; i++) {
+        struct ovsrec_port *port_row = requests->reqs[i].port_row;
+        struct port *port = requests->reqs[i].port;
+        int port_vid = -1;
+
+        pool = portd_vlan_pools_lookup_port(&vlan_pools, port_row);
+        if (!pool) {
+            if (!no_subsystem) {
+                VLOG_ERR("Unable to acces subsystem table in db.");
+                no_subsystem = true;
+            }
+            continue;
+        }
+        if (!pool->require_vlan) {
+            continue;
+        }
+
+        if (pool->usable) {
+            /* A port that turns L3 again gets back the VLAN held for it. */
+            port_vid = portd_reclaim_internal_vlan(pool, br_row, port_row);
+        }
+        if (pool->usable && port_vid == -1 && !pool->exhausted) {
+            /* Each search starts after the VLAN the pool gave to the
+             * previous port. */
+            int vid = portd_alloc_internal_vlan(pool, pool->last);
+
+            if (vid == -1) {
+                pool->exhausted = true;
+            } else {
+                portd_create_vlan_row(br_row, vid, port_row);
+                pool->last = vid;
+                pool->n_allocated++;
+                port_vid = vid;
+            }
+        }
+        if (pool->usable && port_vid == -1) {
+            port_vid = portd_evict_internal_vlan(pool, port_row);
+        }
+        if (port_vid == -1) {
+            VLOG_ERR("Error allocating internal vlan for port '%s' "
+                     "in subsystem '%s'", port_row->name, pool->subsystem);
+            pool->n_failed++;
+            log_event("PORT_VLAN_ALLOCATION_ERROR",
+                EV_KV("vlan", "%s", port_row->name));
+            portd_set_status_error(port_row,
+                                   PORT_STATUS_MAP_ERROR_NO_INTERNAL_VLAN);
+            log_event("INTERNAL_VLAN_ALLOCATION_ERR",
+                      EV_KV("port", "%s", port_row->name));
+            continue;
+        }
+        log_event("INTERNAL_VLAN_ALLOCATION", EV_KV("vid", "%d", port_vid),
                   EV_KV("port", "%s", port_row->name));
+
+        port->internal_vid = port_vid;
+
+        portd_set_hw_cfg(port, port_row);
+    }
+
+    requests->n = 0;
+}
+
+/* Holds the internal VLAN 'vid' for 'port_name' for the grace period. */
+static void
+portd_hold_internal_vlan(const char *port_name, int vid)
+{
+    int displaced;
+
+    VLOG_DBG("Holding internal vlan (%d) for port '%s'", vid, port_name);
+    displaced = portd_vlan_quarantine_add(&vlan_quarantine, port_name, vid,
+                                          time_msec());
+    if (displaced != -1 && displaced != vid) {
+        portd_drop_held_vlan(port_name, displaced);
+    }
+}
+
+/*
+ * Releases the internal VLAN of 'port', which no longer is an L3 port.
+ * With a grace period, the VLAN is held for the port instead of deleted.
+ */
+static void
+portd_release_internal_vlan(struct port *port)
+{
+    if (port->internal_vid <= 0) {
         return;
     }
-    log_event("INTERNAL_VLAN_ALLOCATION", EV_KV("vid", "%d", vid),
-              EV_KV("port", "%s", port_row->name));
+    if (!internal_vlan_grace) {
+        portd_del_internal_vlan(port->internal_vid);
+        return;
+    }
+    portd_hold_internal_vlan(port->name, port->internal_vid);
+}
+
+/* Returns true if the VLAN row 'vlan_row' is the internal VLAN of
+ * 'port_name'. */
+static bool
+portd_vlan_row_is_internal(const struct ovsrec_vlan *vlan_row,
+                           const char *port_name)
+{
+    const char *l3port = smap_get(&vlan_row->internal_usage,
+                                  VLAN_INTERNAL_USAGE_L3PORT);
+
+    return l3port && !strcmp(l3port, port_name);
+}
+
+/*
+ * Removes the internal VLAN 'vid' from the hw_config of 'port_name', a
+ * port that released it and is not an L3 port since, if the port row
+ * still refers to it.
+ */
+static void
+portd_forget_internal_vlan(const char *port_name, int vid)
+{
+    const struct ovsrec_port *port_row = portd_port_db_lookup(port_name);
+    const char *vlan_str;
+
+    if (!port_row || portd_port_find(port_name)) {
+        return;
+    }
+    vlan_str = portd_txn_port_get(port_row, PORTD_TXN_PORT_HW_CONFIG,
+                                  PORT_HW_CONFIG_MAP_INTERNAL_VLAN_ID);
+    if (vlan_str && atoi(vlan_str) == vid) {
+        portd_txn_port_delkey(port_row, PORTD_TXN_PORT_HW_CONFIG,
+                              PORT_HW_CONFIG_MAP_INTERNAL_VLAN_ID);
+    }
+}
+
+/* Deletes the internal VLAN 'vid' that was held for 'port_name'.  A VLAN
+ * the user created with the same id since is left alone. */
+static void
+portd_drop_held_vlan(const char *port_name, int vid)
+{
+    const struct ovsrec_vlan *vlan_row = portd_index_vlan_find(vid);
+
+    VLOG_DBG("Releasing internal vlan (%d) held for port '%s'",
+             vid, port_name);
+    portd_forget_internal_vlan(port_name, vid);
+    if (vlan_row && portd_vlan_row_is_internal(vlan_row, port_name)) {
+        portd_del_internal_vlan(vid);
+    }
+}
+
+/*
+ * Returns the internal VLAN held for 'port_row', which turns L3 again, or
+ * -1 if none is or it is no longer in the range of 'pool', the pool of the
+ * port.  Its row is created again if it was deleted meanwhile.
+ */
+static int
+portd_reclaim_internal_vlan(const struct portd_vlan_pool *pool,
+                            const struct ovsrec_bridge *br_row,
+                            struct ovsrec_port *port_row)
+{
+    const struct ovsrec_vlan *vlan_row;
+    int vid;
 
-    portd_create_vlan_row(vid, port_row);
-    port->internal_vid = vid;
+    vid = portd_vlan_quarantine_take(&vlan_quarantine, port_row->name);
+    if (vid == -1) {
+        return -1;
+    }
+    if (!portd_vlan_pool_in_range(pool, vid)) {
+        portd_drop_held_vlan(port_row->name, vid);
+        return -1;
+    }
 
-    portd_set_hw_cfg(port, port_row);
+    vlan_row = portd_index_vlan_find(vid);
+    if (!vlan_row) {
+        portd_create_vlan_row(br_row, vid, port_row);
+    } else if (!portd_vlan_row_is_internal(vlan_row, port_row->name)) {
+        return -1;
+    }
+    VLOG_DBG("Reused internal vlan (%d) for port '%s'", vid, port_row->name);
+    COVERAGE_INC(portd_vlan_reused);
+    return vid;
+}
+
+/*
+ * Gives 'port_row' the VLAN of 'pool' held for the port that released one
+ * the longest ago, when the pool has no free VLAN left.  The VLAN row is
+ * handed over to 'port_row'.  Returns the VLAN, or -1 if none is held.
+ */
+static int
+portd_evict_internal_vlan(const struct portd_vlan_pool *pool,
+                          struct ovsrec_port *port_row)
+{
+    char *held_port;
+    int vid;
+
+    while ((vid = portd_vlan_quarantine_evict(&vlan_quarantine, pool,
+                                              &held_port)) != -1) {
+        const struct ovsrec_vlan *vlan_row = portd_index_vlan_find(vid);
+
+        if (vlan_row && portd_vlan_row_is_internal(vlan_row, held_port)) {
+            VLOG_DBG("Evicted internal vlan (%d) of port '%s' for port '%s'",
+                     vid, held_port, port_row->name);
+            portd_forget_internal_vlan(held_port, vid);
+            portd_hand_over_vlan_row(vlan_row, port_row->name);
+            COVERAGE_INC(portd_vlan_evicted);
+            free(held_port);
+            return vid;
+        }
+        portd_drop_held_vlan(held_port, vid);
+        free(held_port);
+    }
+    return -1;
+}
+
+/* Deletes the internal VLANs held for longer than the grace period. */
+static void
+portd_expire_internal_vlans(void)
+{
+    long long int released_before = time_msec() - internal_vlan_grace + 1;
+    char *held_port;
+    int vid;
 
-    return;
+    while ((vid = portd_vlan_quarantine_pop(&vlan_quarantine,
+                                            released_before,
+                                            &held_port)) != -1) {
+        portd_drop_held_vlan(held_port, vid);
+        COVERAGE_INC(portd_vlan_expired);
+        free(held_port);
+    }
 }
 
 /* create port in cache */
@@ -1969,7 +2429,7 @@ portd_port_create(struct vrf *vrf, struct ovsrec_port *port_row)
     port->hw_cfg_enable = false;
     hmap_init(&port->secondary_ip4addr);
     hmap_init(&port->secondary_ip6addr);
-    hmap_insert(&vrf->ports, &port->port_node, hash_string(port->name, 0));
+    portd_port_insert(port);
 
     VLOG_DBG("port '%s' created", port->name);
     return;
@@ -1980,13 +2440,14 @@ portd_port_create(struct vrf *vrf, struct ovsrec_port *port_row)
  * if anything changed
  */
 static void
-portd_reconfig_ports(struct vrf *vrf, const struct shash *wanted_ports)
+portd_reconfig_ports(struct vrf *vrf, const struct shash *wanted_ports,
+                     struct internal_vlan_requests *vlan_requests)
 {
     struct shash_node *port_node;
     int vlan_id;
     bool port_admin = true;
     bool intf_admin = false;
-    struct smap hw_cfg_smap;
+    const char *vlan_str;
     char *cur_state = NULL;
     char *proxy_arp_state = NULL;
     char *local_proxy_arp_state = NULL;
@@ -2006,30 +2467,30 @@ portd_reconfig_ports(struct vrf *vrf, const struct shash *wanted_ports)
                 memcpy(&setns_local_info.from_ns[0], SWITCH_NAMESPACE,  strlen(SWITCH_NAMESPACE) + 1);
                 get_vrf_ns_from_table_id(idl, vrf->table_id, &setns_local_info.to_ns[0]);
                 memcpy(&setns_local_info.intf_name[0], port_row->name, strlen(port_row->name) + 1);
+                portd_nl_link_move_prepare(nl_sock, vrf->nl_sock,
+                                           port_row->name);
                 if (!nl_move_intf_to_vrf(&setns_local_info)) {
                     VLOG_ERR("Failed to move interface from %s to %s",
                               SWITCH_NAMESPACE, vrf->name);
                 }
             }
             portd_config_src_routing(vrf, port_row->name, true);
-            if (portd_interface_type_internal_check(port_row, port_row->name) &&
-                portd_port_in_bridge_check(port_row->name, DEFAULT_BRIDGE_NAME) &&
-                portd_port_in_vrf_check(port_row->name, DEFAULT_VRF_NAME)) {
+            if (portd_port_is_intervlan(port_row)) {
 
-                portd_add_vlan_interface(DEFAULT_BRIDGE_NAME, port_row->name,
+                portd_add_vlan_interface(DEFAULT_BRIDGE_NAME, port,
                                          ops_port_get_tag(port->cfg));
                 portd_interface_up_down(port_row->name,
                                         port_row->admin ? port_row->admin: "down");
 
                 port->type = xstrdup(OVSREC_INTERFACE_TYPE_INTERNAL);
-            } else if (portd_interface_type_subinterface_check(port_row,
-                    port_row->name)) {
-                portd_reconfigure_subinterface(port_row);
+            } else if (portd_index_port_class(port_row)
+                       == PORTD_PORT_CLASS_VLANSUBINT) {
+                portd_reconfigure_subinterface(port, port_row);
                 port->type = xstrdup(OVSREC_INTERFACE_TYPE_VLANSUBINT);
                 subintf_count++;
                 log_event("SUBINTERFACE_CREATE", EV_KV("interface", "%s", port_row->name));
-            } else if (portd_interface_type_loopback_check(port_row,
-                       port_row->name)) {
+            } else if (portd_index_port_class(port_row)
+                       == PORTD_PORT_CLASS_LOOPBACK) {
                 portd_reconfig_ns_loopback(port, port_row,
                                            (!strncmp(vrf->name, DEFAULT_VRF_NAME,
                                            strlen(DEFAULT_VRF_NAME))));
@@ -2038,15 +2499,21 @@ portd_reconfig_ports(struct vrf *vrf, const struct shash *wanted_ports)
                 log_event("LOOPBACK_CREATE", EV_KV("interface", "%s", port_row->name));
             } else {
                 /* Only assign internal VLAN if not already present. */
-                smap_clone(&hw_cfg_smap, &port_row->hw_config);
-                vlan_id = smap_get_int(&hw_cfg_smap,
-                                       PORT_HW_CONFIG_MAP_INTERNAL_VLAN_ID, 0);
+                vlan_str = portd_txn_port_get(port_row,
+                                              PORTD_TXN_PORT_HW_CONFIG,
+                                              PORT_HW_CONFIG_MAP_INTERNAL_VLAN_ID);
+                vlan_id = vlan_str ? atoi(vlan_str) : 0;
                 if(vlan_id == 0) {
-                    portd_add_internal_vlan(port, port_row);
+                    portd_want_internal_vlan(vlan_requests, port, port_row);
                 } else {
+                    int held = portd_vlan_quarantine_take(&vlan_quarantine,
+                                                          port_row->name);
+
+                    if (held != -1 && held != vlan_id) {
+                        portd_drop_held_vlan(port_row->name, held);
+                    }
                     port->internal_vid = vlan_id;
                 }
-                smap_destroy(&hw_cfg_smap);
                 if ((intf_row = portd_get_matching_interface_row(port_row)) != NULL) {
                     /* Its a VLAN or L3 interface */
                     VLOG_DBG("set up state for L3 and vlan interface\n");
@@ -2095,8 +2562,7 @@ portd_reconfig_ports(struct vrf *vrf, const struct shash *wanted_ports)
                 VLOG_DBG("Port modified IP: %s vrf %s\n", port_row->ip4_address,
                         vrf->name);
 
-                if (OVSREC_IDL_IS_COLUMN_MODIFIED(ovsrec_port_col_other_config,
-                                                  idl_seqno)) {
+                if (PORTD_IDL_COL_CHANGED(port_row, port, other_config)) {
                     /* Check if proxy arp state has changed */
                     proxy_arp_state = (char *)smap_get(
                                       &port_row->other_config,
@@ -2143,41 +2609,48 @@ portd_reconfig_ports(struct vrf *vrf, const struct shash *wanted_ports)
         struct ovsrec_port *port_row = port_node->data;
         struct port *port = portd_port_lookup(vrf, port_row->name);
         struct ovsrec_interface *intf_row = NULL;
+
+        if (!port || (NULL == port->type) ||
+            (strcmp(port->type, OVSREC_INTERFACE_TYPE_VLANSUBINT) != 0)) {
+            continue;
+        }
         intf_row = portd_get_matching_interface_row(port_row);
 
-        if ((port) &&
-            (intf_row) &&
-            ((OVSREC_IDL_IS_ROW_MODIFIED(port_row, idl_seqno)) ||
-            (OVSREC_IDL_IS_ROW_MODIFIED(intf_row, idl_seqno))))
+        /* The subinterface is re-created, and its primary addresses added
+         * again, only when a column it is built from was modified. */
+        if ((intf_row) &&
+            ((OVSREC_IDL_IS_ROW_MODIFIED(port_row, idl_seqno) &&
+              (PORTD_IDL_COL_CHANGED(port_row, port, interfaces) ||
+               PORTD_IDL_COL_CHANGED(port_row, port, ip4_address) ||
+               PORTD_IDL_COL_CHANGED(port_row, port, ip6_address))) ||
+             (OVSREC_IDL_IS_ROW_MODIFIED(intf_row, idl_seqno) &&
+              (PORTD_IDL_COL_CHANGED(intf_row, interface, subintf_parent) ||
+               PORTD_IDL_COL_CHANGED(intf_row, interface, user_config)))))
         {
-            if((NULL != port->type) &&
-                    (strcmp(port->type,
-                            OVSREC_INTERFACE_TYPE_VLANSUBINT) == 0)) {
-                char str[512] = {0};
-                portd_reconfigure_subinterface(port_row);
+            char str[512] = {0};
+            portd_reconfigure_subinterface(port, port_row);
 
-                if (portd_if_nametoindex(vrf, port_row->name))
-                {
-                   if (port_row->ip4_address != NULL)
-                   {
-                       nl_add_ip_address(RTM_NEWADDR, port_row->name,
-                                 port_row->ip4_address, AF_INET, false);
-                        log_event("SUBINTERFACE_IP_UPDATE", EV_KV("interface",
-                                  "%s", port_row->name),
-                                  EV_KV("value", "%s", port_row->ip4_address));
-                   }
-                   if (port_row->ip6_address != NULL)
-                   {
-                        snprintf(str, 512, "/sbin/ip netns exec swns "
-                               "/sbin/ip -6 address add %s dev %s",
-                               port_row->ip6_address, port_row->name);
-                        if (system(str) != 0)
-                        {
-                            VLOG_ERR("Failed to add subinterface. cmd=%s, rc=%s",
-                                        str, strerror(errno));
-                        }
-                   }
-                }
+            if (portd_if_nametoindex(vrf, port_row->name))
+            {
+               if (port_row->ip4_address != NULL)
+               {
+                   nl_add_ip_address(RTM_NEWADDR, port,
+                             port_row->ip4_address, AF_INET, false);
+                    log_event("SUBINTERFACE_IP_UPDATE", EV_KV("interface",
+                              "%s", port_row->name),
+                              EV_KV("value", "%s", port_row->ip4_address));
+               }
+               if (port_row->ip6_address != NULL)
+               {
+                    snprintf(str, 512, "/sbin/ip netns exec swns "
+                           "/sbin/ip -6 address add %s dev %s",
+                           port_row->ip6_address, port_row->name);
+                    if (system(str) != 0)
+                    {
+                        VLOG_ERR("Failed to add subinterface. cmd=%s, rc=%s",
+                                    str, strerror(errno));
+                    }
+               }
             }
         }
     }
@@ -2200,12 +2673,66 @@ portd_collect_wanted_ports(struct vrf *vrf,
     }
 }
 
+/*
+ * Collects in 'changed_ports', by name, the Port rows inserted or modified
+ * since the last reconfiguration, and those whose interfaces were.  Returns
+ * true if one of them was renamed.
+ */
+static bool
+portd_collect_changed_ports(struct shash *changed_ports)
+{
+    const struct ovsrec_interface *iface_row;
+    const struct ovsrec_port *row;
+    bool renamed = false;
+
+    shash_init(changed_ports);
+    OVSREC_PORT_FOR_EACH_TRACKED (row, idl) {
+        if (ovsrec_port_is_deleted(row)) {
+            continue;
+        }
+        if (!ovsrec_port_is_new(row)
+            && ovsdb_idl_track_is_updated(&row->header_,
+                                          &ovsrec_port_col_name)) {
+            renamed = true;
+        }
+        shash_add_once(changed_ports, row->name, row);
+    }
+    OVSREC_INTERFACE_FOR_EACH_TRACKED (iface_row, idl) {
+        if (!ovsrec_interface_is_deleted(iface_row)) {
+            row = portd_index_iface_port(iface_row);
+            if (row) {
+                shash_add_once(changed_ports, row->name, row);
+            }
+        }
+    }
+    return renamed;
+}
+
+/*
+ * Collects in 'wanted_ports' the ports of 'changed_ports' that are in
+ * 'vrf', whose list of ports did not change.  The ports of 'vrf' that did
+ * not change need nothing.
+ */
+static void
+portd_collect_changed_vrf_ports(struct vrf *vrf,
+                                const struct shash *changed_ports,
+                                struct shash *wanted_ports)
+{
+    struct shash_node *node;
+
+    shash_init(wanted_ports);
+    SHASH_FOR_EACH (node, changed_ports) {
+        if (portd_index_port_in_vrf(node->name, vrf->name)) {
+            shash_add_once(wanted_ports, node->name, node->data);
+        }
+    }
+}
+
 /* delete internal port cache */
 static void
 portd_port_destroy(struct port *port)
 {
     if (port) {
-        struct vrf *vrf = port->vrf;
         struct net_address *addr, *next_addr;
 
         VLOG_DBG("port '%s' destroy", port->name);
@@ -2229,7 +2756,7 @@ portd_port_destroy(struct port *port)
             SAFE_FREE(addr);
         }
         hmap_destroy(&port->secondary_ip6addr);
-        hmap_remove(&vrf->ports, &port->port_node);
+        portd_port_remove(port);
         SAFE_FREE(port->name);
         SAFE_FREE(port);
     }
@@ -2256,6 +2783,8 @@ portd_del_ports(struct vrf *vrf, const struct shash *wanted_ports)
                 get_vrf_ns_from_table_id(idl, vrf->table_id, &setns_local_info.from_ns[0]);
                 memcpy(&setns_local_info.to_ns[0], SWITCH_NAMESPACE,  strlen(SWITCH_NAMESPACE)+1);
                 memcpy(&setns_local_info.intf_name[0], port->name,  strlen(port->name) + 1);
+                portd_nl_link_move_prepare(vrf->nl_sock, nl_sock,
+                                           port->name);
                 if (!nl_move_intf_to_vrf(&setns_local_info)) {
                     VLOG_ERR("Failed to move interface from %s to %s",
                                vrf->name, SWITCH_NAMESPACE);
@@ -2301,25 +2830,34 @@ portd_del_ports(struct vrf *vrf, const struct shash *wanted_ports)
             }
 
             /* Port not present in the wanted_ports list. Destroy */
-            portd_del_internal_vlan(port->internal_vid);
+            portd_release_internal_vlan(port);
             portd_del_ipaddr(port);
             portd_port_destroy(port);
         }
     }
 }
 
+/* Returns the lag data of the IDL port row with 'uuid', NULL if none. */
+static struct port_lag_data *
+portd_lag_port_lookup_by_uuid(const struct uuid *uuid)
+{
+    struct port_lag_data *portp;
+
+    HMAP_FOR_EACH_WITH_HASH (portp, uuid_node, uuid_hash(uuid),
+                             &ports_by_uuid) {
+        if (uuid_equals(&portp->cfg->header_.uuid, uuid)) {
+            return portp;
+        }
+    }
+    return NULL;
+}
+
 /* Delete an old port found in the internal port cache */
 static void
-portd_del_old_port(struct shash_node *sh_node)
+portd_del_old_port(struct port_lag_data *portp)
 {
-    if (sh_node) {
-        struct port_lag_data *portp = sh_node->data;
+    if (portp) {
         struct shash_node *node, *next;
-        if (!portp)
-        {
-            VLOG_ERR ("No port data found for %s",sh_node->name);
-            return;
-        }
         SHASH_FOR_EACH_SAFE(node, next, &portp->eligible_member_ifs) {
             /* Since we have got the shash_node. Why do we do find again
                node->data won't have same idp? */
@@ -2348,14 +2886,16 @@ portd_del_old_port(struct shash_node *sh_node)
                 idp->port_datap = NULL;
             }
         }
+        hmap_remove(&ports_by_uuid, &portp->uuid_node);
+        shash_find_and_delete(&all_ports, portp->name);
         SAFE_FREE(portp->name);
         SAFE_FREE(portp);
-        shash_delete(&all_ports, sh_node);
     }
 } /* portd_del_old_port */
 
-/* Add a new port found in the internal port cache */
-static void
+/* Add a new port found in the internal port cache.  Returns the new entry,
+ * NULL if a port has the same name. */
+static struct port_lag_data *
 portd_add_new_port(const struct ovsrec_port *port_row)
 {
     struct port_lag_data *portp = NULL;
@@ -2374,6 +2914,8 @@ portd_add_new_port(const struct ovsrec_port *port_row)
     } else {
         portp->cfg = port_row;
         portp->name = xstrdup(port_row->name);
+        hmap_insert(&ports_by_uuid, &portp->uuid_node,
+                    uuid_hash(&port_row->header_.uuid));
         shash_init(&portp->eligible_member_ifs);
         shash_init(&portp->bonding_ifs);
 
@@ -2393,6 +2935,7 @@ portd_add_new_port(const struct ovsrec_port *port_row)
         }
         VLOG_DBG("Created local data for Port %s", port_row->name);
     }
+    return portp;
 } /* portd_add_new_port */
 
 /**
@@ -2446,6 +2989,7 @@ static void portd_update_bond_slaves(struct port_lag_data *portp)
             }
 
             shash_add(&portp->bonding_ifs, node->name, (void *)idp);
+            portd_nl_batch_flush_all();
             if(add_slave_to_bond(portp->name, node->name)) {
                 VLOG_DBG("Interface %s added to bond", node->name);
             }
@@ -2574,92 +3118,119 @@ portd_handle_port_config(const struct ovsrec_port *row,
     shash_destroy(&sh_idl_port_intfs);
 } /* portd_handle_port_config */
 
+/* Removes 'portp' from the internal port cache, deleting the Linux bond of
+ * a LAG. */
+static void
+portd_lag_port_delete(struct port_lag_data *portp)
+{
+    VLOG_DBG("bond:Found a deleted port %s", portp->name);
+
+    /* Check if port's name begins with "lag" to delete Linux bond */
+    if(!strncmp(portp->name, LAG_NAME_SUFFIX, LAG_NAME_SUFFIX_LENGTH)) {
+        if(delete_linux_bond(portp->name)) {
+            VLOG_DBG("bond:Deleted bond %s, ", portp->name);
+        }
+    }
+    portd_del_old_port(portp);
+}
+
+/* Adds 'row' to the internal port cache, creating the Linux bond of a LAG.
+ * Returns the new entry, NULL if a port has the same name. */
+static struct port_lag_data *
+portd_lag_port_add(const struct ovsrec_port *row)
+{
+    VLOG_DBG("bond:Found an added port %s", row->name);
+
+    /* Check if port's name begins with "lag" to create Linux bond */
+    if(!strncmp(row->name, LAG_NAME_SUFFIX, LAG_NAME_SUFFIX_LENGTH)) {
+        if(create_linux_bond(row->name)) {
+            portd_interface_up_down(row->name, "up");
+        }
+    }
+    return portd_add_new_port(row);
+}
+
 /**
  * Handles database reconfigurations in ports
  *
+ * Only the Port rows inserted, modified or deleted since the last
+ * reconfiguration are visited, as reported by the IDL change tracking.
+ * The ports of a VRF are only all walked when its list of ports changed,
+ * when it was just added or when a port was renamed; otherwise only its
+ * ports whose row or interface changed are reconfigured.
  */
 
 static void
 portd_add_del_ports(void)
 {
+    struct internal_vlan_requests vlan_requests = { NULL, 0, 0 };
+    struct shash changed_ports;
+    bool renamed;
     struct vrf *vrf;
-    struct shash sh_idl_ports;
     const struct ovsrec_port *row;
-    struct shash_node *sh_node, *sh_next;
+    struct port_lag_data *portp;
 
-    /* Collect all the ports in the DB. */
-    shash_init(&sh_idl_ports);
-    OVSREC_PORT_FOR_EACH(row, idl) {
-       if (!shash_add_once(&sh_idl_ports, row->name, row)) {
-           VLOG_WARN("port %s specified twice", row->name);
-       }
+    /* Delete old ports first, so that a row replacing a deleted one of the
+     * same name can be added. */
+    OVSREC_PORT_FOR_EACH_TRACKED (row, idl) {
+        if (ovsrec_port_is_deleted(row)) {
+            portp = portd_lag_port_lookup_by_uuid(&row->header_.uuid);
+            if (portp) {
+                portd_lag_port_delete(portp);
+            }
+        }
     }
 
-    /* Delete old ports. */
-    SHASH_FOR_EACH_SAFE(sh_node, sh_next, &all_ports) {
-        /* Even though it will not effect anything but the below find
-           will return ovsrec_port row not port_lag_data */
-        struct port_lag_data *portp = shash_find_data(&sh_idl_ports, sh_node->name);
-        if (!portp) {
-            VLOG_DBG("bond:Found a deleted port %s", sh_node->name);
+    OVSREC_PORT_FOR_EACH_TRACKED (row, idl) {
+        if (ovsrec_port_is_deleted(row)) {
+            continue;
+        }
 
-            /* Check if port's name begins with "lag" to delete Linux bond */
-            if(!strncmp(sh_node->name, LAG_NAME_SUFFIX,
-                        LAG_NAME_SUFFIX_LENGTH)) {
-                if(delete_linux_bond(sh_node->name)) {
-                    VLOG_DBG("bond:Deleted bond %s, ", sh_node->name);
-                }
-            }
-            portd_del_old_port(sh_node);
+        portp = portd_lag_port_lookup_by_uuid(&row->header_.uuid);
+        if (portp && strcmp(portp->name, row->name)) {
+            /* Renamed port. */
+            portd_lag_port_delete(portp);
+            portp = NULL;
         }
-    }
 
-    /* Add new ports. */
-    SHASH_FOR_EACH(sh_node, &sh_idl_ports) {
-        struct port_lag_data *portp = shash_find_data(&all_ports,
-                                                      sh_node->name);
+        /* Add new ports. */
         if (!portp) {
-            VLOG_DBG("bond:Found an added port %s", sh_node->name);
-
-            /* Check if port's name begins with "lag" to create Linux bond */
-            if(!strncmp(sh_node->name, LAG_NAME_SUFFIX,
-                        LAG_NAME_SUFFIX_LENGTH)) {
-                if(create_linux_bond(sh_node->name)) {
-                    portd_interface_up_down(sh_node->name, "up");
-                }
+            portp = portd_lag_port_add(row);
+            if (!portp) {
+                continue;
             }
-            portd_add_new_port(sh_node->data);
         }
-    }
 
-    /* Check for changes in the port row entries. */
-    SHASH_FOR_EACH(sh_node, &all_ports) {
-        const struct ovsrec_port *row = shash_find_data(&sh_idl_ports,
-                                                       sh_node->name);
-        /* Check for changes to row. */
-        if (OVSREC_IDL_IS_ROW_INSERTED(row, idl_seqno) ||
-            OVSREC_IDL_IS_ROW_MODIFIED(row, idl_seqno)) {
-            struct port_lag_data *portp = sh_node->data;
-            /* Handle Port config update. */
-            portd_handle_port_config(row, portp);
-        }
+        /* Handle Port config update. */
+        portd_handle_port_config(row, portp);
     }
 
-    /* Destroy the shash of the IDL ports. */
-    shash_destroy(&sh_idl_ports);
-
     /* For each vrf in all_vrfs, update the port list */
+    renamed = portd_collect_changed_ports(&changed_ports);
     HMAP_FOR_EACH (vrf, node, &all_vrfs) {
-        VLOG_DBG("in vrf %s to delete ports\n",vrf->name);
-        portd_collect_wanted_ports(vrf, &vrf->wanted_ports);
-        portd_del_ports(vrf, &vrf->wanted_ports);
+        if (!vrf->ports_synced || renamed
+            || PORTD_IDL_COL_CHANGED(vrf->cfg, vrf, ports)) {
+            VLOG_DBG("in vrf %s to delete ports\n",vrf->name);
+            portd_collect_wanted_ports(vrf, &vrf->wanted_ports);
+            portd_del_ports(vrf, &vrf->wanted_ports);
+            vrf->ports_synced = true;
+        } else {
+            portd_collect_changed_vrf_ports(vrf, &changed_ports,
+                                            &vrf->wanted_ports);
+        }
     }
+    shash_destroy(&changed_ports);
     /* For each vrfs' port list, configure them */
     HMAP_FOR_EACH (vrf, node, &all_vrfs) {
         VLOG_DBG("in vrf %s to reconfigure ports\n",vrf->name);
-        portd_reconfig_ports(vrf, &vrf->wanted_ports);
+        portd_reconfig_ports(vrf, &vrf->wanted_ports, &vlan_requests);
         shash_destroy(&vrf->wanted_ports);
     }
+
+    /* The L3 ports created in all the vrfs get their internal VLANs
+     * together. */
+    portd_add_internal_vlans(&vlan_requests);
+    free(vlan_requests.reqs);
 }
 
 /**
@@ -2670,31 +3241,14 @@ portd_add_del_ports(void)
 static void
 portd_intf_config_on_init (struct shash *kernel_port_list)
 {
-    struct rtattr *rta;
-    struct {
-        struct nlmsghdr hdr;
-        struct rtgenmsg gen;
-    } req;
-
-    memset (&req, 0, sizeof(req));
-
-    req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtgenmsg));
-    req.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
-    req.hdr.nlmsg_type = RTM_GETLINK;
-
-    req.gen.rtgen_family = AF_PACKET;
-
-    rta = (struct rtattr *)(((char *)&req) + NLMSG_ALIGN(req.hdr.nlmsg_len));
-    rta->rta_len = RTA_LENGTH(4);
-
-    if (send(init_sock, &req, req.hdr.nlmsg_len, 0) == -1) {
+    if (portd_nl_dump_request(init_sock, RTM_GETLINK, AF_PACKET, 0)) {
         VLOG_ERR("Netlink failed to send message for link dump");
         return;
     }
     /* Process the response from kernel */
     VLOG_DBG("Interfaces dump request sent on init");
 
-    nl_msg_process(kernel_port_list, init_sock, true);
+    nl_msg_process(kernel_port_list, NULL, init_sock, true);
 }
 
 /* This function checks if the kernel has all the interfaces already
@@ -2740,12 +3294,15 @@ portd_kernel_if_sync_check_on_init (void)
 
 /**
  * This function will delete VLANs which no longer point to L3 ports.
- * There are two cases:
+ * There are three cases:
  * 1. The daemon crashed and an L3 interface became L2. The internal VLAN which
  *    was previously pointing to the L3 interface needs to be deleted.
  * 2. The daemon crashed and an interface went from L3 to L2 and back to L3.
  *    A new internal VLAN would be assigned as it is considered
  *    a new L3 interface. The previous internal VLAN needs to be removed.
+ * 3. The daemon restarted while the internal VLAN of a port that became L2
+ *    was held for it.  The port still refers to the VLAN, which is held
+ *    again, or deleted along with the reference without a grace period.
  */
 static void
 portd_vlan_config_on_init(void)
@@ -2762,15 +3319,28 @@ portd_vlan_config_on_init(void)
             const char *port_name = smap_get(&vlan_internal_smap,
                     VLAN_INTERNAL_USAGE_L3PORT);
             port_row = portd_port_db_lookup(port_name);
+            if (!port_row) {
+                VLOG_DBG("Deleting the internal VLAN : %ld", int_vlan_row->id);
+                portd_del_internal_vlan(int_vlan_row->id);
+                smap_destroy(&vlan_internal_smap);
+                continue;
+            }
             smap_clone(&hw_cfg_smap, &port_row->hw_config);
             vlan_id = smap_get_int(&hw_cfg_smap,
                     PORT_HW_CONFIG_MAP_INTERNAL_VLAN_ID, 0);
             /* Checks for the following cases:
              * 1. Port has no internal VLAN id
-             * 2. Port has a VLAN id which is different */
+             * 2. Port has a VLAN id which is different
+             * 3. Port is no longer in a VRF */
             if (vlan_id == 0 || int_vlan_row->id != vlan_id) {
                 VLOG_DBG("Deleting the internal VLAN : %ld", int_vlan_row->id);
                 portd_del_internal_vlan(int_vlan_row->id);
+            } else if (!portd_index_port_in_vrf(port_name, NULL)) {
+                if (internal_vlan_grace) {
+                    portd_hold_internal_vlan(port_name, vlan_id);
+                } else {
+                    portd_drop_held_vlan(port_name, vlan_id);
+                }
             }
             smap_destroy(&hw_cfg_smap);
         }
@@ -2789,13 +3359,23 @@ portd_vrf_del(struct vrf *vrf)
         VLOG_DBG("Deleting vrf '%s'",vrf->name);
 
         HMAP_FOR_EACH_SAFE (port, next_port, port_node, &vrf->ports) {
-            portd_del_internal_vlan(port->internal_vid);
+            portd_release_internal_vlan(port);
             portd_del_ipaddr(port);
             portd_port_destroy(port);
         }
         hmap_remove(&all_vrfs, &vrf->node);
         hmap_destroy(&vrf->ports);
+        if (vrf->nsid >= 0) {
+            hmap_remove(&vrfs_by_nsid, &vrf->nsid_node);
+        }
+        portd_nl_ns_destroy(vrf->nl_sock);
         close(vrf->nl_sock);
+        if (vrf->nl_cmd_sock != vrf->nl_sock) {
+            close(vrf->nl_cmd_sock);
+        }
+        if (strcmp(vrf->name, DEFAULT_VRF_NAME)) {
+            portd_sysctl_close(vrf->sysctl_fd);
+        }
         SAFE_FREE(vrf->name);
         SAFE_FREE(vrf);
     }
@@ -2810,7 +3390,24 @@ portd_vrf_netlink_socket_open(struct vrf *vrf_in)
         return;
      }
      get_vrf_ns_from_table_id(idl, vrf_in->table_id, buff);
+     portd_netlink_socket_open(buff, &vrf_in->nl_cmd_sock, true);
+
+     if (nl_listen_all_nsid && vrf_in->nl_cmd_sock > 0) {
+        /* The events of the namespace are received on 'nl_sock', the
+         * command socket also names the namespace. */
+        vrf_in->nsid = portd_nl_nsid_get(nl_sock, vrf_in->nl_cmd_sock);
+        if (vrf_in->nsid >= 0) {
+            vrf_in->nl_sock = vrf_in->nl_cmd_sock;
+            portd_nl_ns_init(vrf_in->nl_sock, vrf_in->nl_cmd_sock);
+            hmap_insert(&vrfs_by_nsid, &vrf_in->nsid_node,
+                        hash_int(vrf_in->nsid, 0));
+            return;
+        }
+        VLOG_WARN("Using a notification socket for vrf %s", vrf_in->name);
+     }
+
      portd_netlink_socket_open(buff, &vrf_in->nl_sock, false);
+     portd_nl_ns_init(vrf_in->nl_sock, vrf_in->nl_cmd_sock);
 
      return;
 }
@@ -2826,16 +3423,20 @@ portd_vrf_add(const struct ovsrec_vrf *vrf_row)
     vrf->name = xstrdup(vrf_row->name);
     vrf->cfg = vrf_row;
     vrf->table_id = *vrf_row->table_id;
+    vrf->nsid = -1;
 
     if (strcmp(vrf->name, DEFAULT_VRF_NAME) == 0) {
         vrf->nl_sock = nl_sock;
+        vrf->nl_cmd_sock = nl_cmd_sock;
+        memcpy(vrf->sysctl_fd, sysctl_fd, sizeof(vrf->sysctl_fd));
     }
     else {
         /* in portd restart case the vrf would be ready to open socket */
          portd_vrf_netlink_socket_open(vrf);
+         portd_sysctl_open(vrf, vrf->sysctl_fd);
     }
 
-    portd_config_iprouting(vrf->name, PORTD_ENABLE_ROUTING);
+    portd_config_iprouting(vrf, PORTD_ENABLE_ROUTING);
     hmap_init(&vrf->ports);
     hmap_insert(&all_vrfs, &vrf->node, hash_string(vrf->name, 0));
 
@@ -2895,8 +3496,15 @@ portd_reconfigure(void)
         return;
     }
 
+    /* Bring the row indexes up to date before anything looks them up. */
+    portd_index_run();
+    portd_internal_vlan_sync();
+
     portd_add_del_vrf();
 
+    /* The interface cache is looked up by the interface dumps. */
+    update_interface_cache();
+
     /* In case the daemon restarts, ensure:
      * 1. Unused internal VLANs are deleted.
      * 2. IP addresses between DB and kernel are in sync.
@@ -2916,8 +3524,6 @@ portd_reconfigure(void)
         portd_ipaddr_config_on_init();
     }
 
-    update_interface_cache();
-
     portd_add_del_ports();
 
     /* IP addresses on kernel and DB are already in sync on init.
@@ -2938,14 +3544,72 @@ portd_reconfigure(void)
         init_sock = -1;
     }
 
+    /* Send the netlink requests queued during this pass. */
+    portd_nl_batch_flush_all();
+
     /* Determine the new 'forwarding state' for each port */
     portd_arbiter_run();
 
-    /* After all changes are done, update the seqno. */
+    /* After all changes are done, update the seqno and forget the tracked
+     * changes. */
     idl_seqno = new_idl_seqno;
+    ovsdb_idl_track_clear(idl);
     return;
 }
 
+/*
+ * Brings portd back in sync with the namespace of 'vrf' (the default one if
+ * NULL) after notifications were lost: the interfaces are dumped again,
+ * which refreshes the ifindex cache and pushes the admin state of each
+ * interface, and the addresses of the namespace's L3 ports are checked
+ * against portd's cache.
+ */
+static void
+portd_netlink_resync(struct vrf *vrf)
+{
+    int cmd_sock = portd_nl_resync_begin(NL_SOCK(vrf));
+
+    VLOG_INFO("Resyncing kernel state of vrf %s",
+              vrf ? vrf->name : DEFAULT_VRF_NAME);
+
+    if (portd_nl_dump_request(cmd_sock, RTM_GETLINK, AF_PACKET, 0) == 0) {
+        nl_msg_process(NULL, vrf, cmd_sock, true);
+        portd_nl_resync_end(NL_SOCK(vrf));
+    }
+    if (vrf) {
+        portd_ipaddr_resync(vrf, cmd_sock);
+    }
+}
+
+/* Resyncs every namespace, after notifications were lost on the socket
+ * shared by all of them. */
+static void
+portd_netlink_resync_all(void)
+{
+    struct vrf *vrf;
+
+    HMAP_FOR_EACH (vrf, node, &all_vrfs) {
+        if (vrf->nl_sock != nl_sock) {
+            portd_nl_overrun(vrf->nl_sock);
+        }
+        portd_netlink_resync(vrf);
+    }
+}
+
+/* Processes the notifications pending for the namespace of 'vrf' (the
+ * default one if NULL), on the socket they are received on. */
+static void
+portd_netlink_process_pending(struct vrf *vrf)
+{
+    if (!vrf || (nl_listen_all_nsid &&
+                 (vrf->nsid >= 0 || vrf->nl_sock == nl_sock))) {
+        nl_msg_process(NULL, portd_vrf_lookup(DEFAULT_VRF_NAME), nl_sock,
+                       false);
+    } else if (vrf->nl_sock > 0) {
+        nl_msg_process(NULL, vrf, vrf->nl_sock, false);
+    }
+}
+
 static void
 portd_service_netlink_messages (void)
 {
@@ -2956,12 +3620,20 @@ portd_service_netlink_messages (void)
          * and update the kernel interface with IFF_UP/~IFF_UP
          * as per DB configurations
          */
+        if (nl_listen_all_nsid) {
+            /* One socket for all vrfs, and the notification sockets of
+             * the vrfs that have no namespace id. */
+            portd_netlink_process_pending(NULL);
+        }
         /* For each vrfs netlink socket, process them */
         HMAP_FOR_EACH (vrf, node, &all_vrfs) {
-            if (vrf->nl_sock > 0) {
-                nl_msg_process(NULL, vrf->nl_sock, false);
+            if (nl_listen_all_nsid &&
+                (vrf->nsid >= 0 || vrf->nl_sock == nl_sock)) {
+                continue;
             }
+            portd_netlink_process_pending(vrf);
         }
+        portd_nl_batch_flush_all();
     }
 }
 
@@ -2985,17 +3657,30 @@ portd_run(void)
         return;
     }
 
-    commit_txn = false; /* if db was modified, this flag gets set */
-    txn = ovsdb_idl_txn_create(idl);
-    portd_reconfigure();
-    portd_service_netlink_messages();
-    if (commit_txn) {
-        ovsdb_idl_txn_commit_block(txn);
+    /* While ovsdb-server has not replied to the transaction of a previous
+     * pass, the database changes wait but the kernel events are still
+     * handled. */
+    portd_reconcile_note(ovsdb_idl_get_seqno(idl));
+    if (portd_txn_run()) {
+        portd_service_netlink_messages();
+        portd_nl_ack_run();
+        return;
     }
-    ovsdb_idl_txn_destroy(txn);
+    portd_index_vlan_run();
+
+    /* The database changes of a burst are applied together once it is
+     * over.  A transaction is only created if something is written. */
+    if (portd_reconcile_due()) {
+        portd_reconfigure();
+        portd_reconcile_done(idl_seqno);
+    }
+    portd_service_netlink_messages();
+    portd_nl_ack_run();
+    portd_update_kernel_status();
+    portd_expire_internal_vlans();
+    portd_txn_commit();
     VLOG_INFO_ONCE("%s (ops-portd) %s", program_name, VERSION);
 
-    /* FIXME - verify db write was successful, else retry. */
     /* FIXME - cur_cfg delete once after system init */
 }
 
@@ -3005,7 +3690,14 @@ portd_netlink_recv_wait__ (void)
     struct vrf *vrf;
     if (system_configured) {
         /* For each vrfs' port list, wait on them */
+        if (nl_listen_all_nsid) {
+            poll_fd_wait(nl_sock, POLLIN);
+        }
         HMAP_FOR_EACH (vrf, node, &all_vrfs) {
+            if (nl_listen_all_nsid &&
+                (vrf->nsid >= 0 || vrf->nl_sock == nl_sock)) {
+                continue;
+            }
             if (vrf->nl_sock > 0) {
                 poll_fd_wait(vrf->nl_sock, POLLIN);
             }
@@ -3017,7 +3709,17 @@ static void
 portd_wait(void)
 {
     ovsdb_idl_wait(idl);
+    portd_txn_wait();
+    if (!portd_txn_in_flight()) {
+        long long int oldest = portd_vlan_quarantine_oldest(&vlan_quarantine);
+
+        portd_reconcile_wait();
+        if (oldest != LLONG_MAX) {
+            poll_timer_wait_until(oldest + internal_vlan_grace);
+        }
+    }
     portd_netlink_recv_wait__();
+    portd_nl_ack_wait();
     poll_timer_wait(PORTD_POLL_INTERVAL * 1000);
 }
 
@@ -3070,6 +3772,134 @@ portd_unixctl_getbondingconfiguration(struct unixctl_conn *conn, int argc,
     ds_destroy(&ds);
 }
 
+static void
+portd_unixctl_netlink(struct unixctl_conn *conn, int argc OVS_UNUSED,
+                      const char *argv[] OVS_UNUSED, void *aux OVS_UNUSED)
+{
+    struct ds ds = DS_EMPTY_INITIALIZER;
+    struct vrf *vrf;
+
+    HMAP_FOR_EACH (vrf, node, &all_vrfs) {
+        if (vrf->nsid >= 0) {
+            ds_put_format(&ds, "vrf %s (nsid %d):\n", vrf->name, vrf->nsid);
+        } else {
+            ds_put_format(&ds, "vrf %s:\n", vrf->name);
+        }
+        portd_nl_ns_format(vrf->nl_sock, &ds);
+    }
+    unixctl_command_reply(conn, ds_cstr(&ds));
+    ds_destroy(&ds);
+}
+
+static void
+portd_unixctl_txn(struct unixctl_conn *conn, int argc OVS_UNUSED,
+                  const char *argv[] OVS_UNUSED, void *aux OVS_UNUSED)
+{
+    struct ds ds = DS_EMPTY_INITIALIZER;
+
+    portd_txn_format(&ds);
+    unixctl_command_reply(conn, ds_cstr(&ds));
+    ds_destroy(&ds);
+}
+
+static void
+portd_unixctl_reconcile(struct unixctl_conn *conn, int argc,
+                        const char *argv[], void *aux OVS_UNUSED)
+{
+    struct ds ds = DS_EMPTY_INITIALIZER;
+
+    if (argc > 1) {
+        int window, max_delay = reconcile_max_delay;
+
+        if (!str_to_int(argv[1], 10, &window) || window < 0
+            || (argc > 2 && (!str_to_int(argv[2], 10, &max_delay)
+                             || max_delay < 0))) {
+            unixctl_command_reply_error(conn, "invalid delay");
+            return;
+        }
+        reconcile_window = window;
+        reconcile_max_delay = max_delay;
+        portd_reconcile_set(reconcile_window, reconcile_max_delay);
+    }
+    portd_reconcile_format(&ds);
+    unixctl_command_reply(conn, ds_cstr(&ds));
+    ds_destroy(&ds);
+}
+
+static void
+portd_unixctl_internal_vlan_quarantine(struct unixctl_conn *conn, int argc,
+                                       const char *argv[],
+                                       void *aux OVS_UNUSED)
+{
+    struct ds ds = DS_EMPTY_INITIALIZER;
+
+    if (argc > 1) {
+        int grace;
+
+        if (!str_to_int(argv[1], 10, &grace) || grace < 0) {
+            unixctl_command_reply_error(conn, "invalid grace period");
+            return;
+        }
+        internal_vlan_grace = grace;
+    }
+    ds_put_format(&ds, "grace period: %d ms\n", internal_vlan_grace);
+    portd_vlan_quarantine_format(&vlan_quarantine, time_msec(), &ds);
+    unixctl_command_reply(conn, ds_cstr(&ds));
+    ds_destroy(&ds);
+}
+
+static void
+portd_unixctl_internal_vlan_pools(struct unixctl_conn *conn,
+                                  int argc OVS_UNUSED,
+                                  const char *argv[] OVS_UNUSED,
+                                  void *aux OVS_UNUSED)
+{
+    struct ds ds = DS_EMPTY_INITIALIZER;
+
+    portd_vlan_pools_format(&vlan_pools, &internal_vlans, &ds);
+    unixctl_command_reply(conn, ds_cstr(&ds));
+    ds_destroy(&ds);
+}
+
+static void
+portd_unixctl_vlan_alloc_bench(struct unixctl_conn *conn, int argc,
+                               const char *argv[], void *aux OVS_UNUSED)
+{
+    struct ds ds = DS_EMPTY_INITIALIZER;
+    int n_free = 1;
+    int iterations = 100000;
+
+    if (argc > 1 && (!str_to_int(argv[1], 10, &n_free) || n_free < 0)) {
+        unixctl_command_reply_error(conn, "invalid number of free VLANs");
+        return;
+    }
+    if (argc > 2 && (!str_to_int(argv[2], 10, &iterations) ||
+                     iterations <= 0)) {
+        unixctl_command_reply_error(conn, "invalid number of iterations");
+        return;
+    }
+    portd_vlan_alloc_bench(n_free, iterations, &ds);
+    unixctl_command_reply(conn, ds_cstr(&ds));
+    ds_destroy(&ds);
+}
+
+static void
+portd_unixctl_netlink_parse_bench(struct unixctl_conn *conn, int argc,
+                                  const char *argv[], void *aux OVS_UNUSED)
+{
+    struct ds ds = DS_EMPTY_INITIALIZER;
+    int iterations = 1000;
+
+    if (argc > 1 && (!str_to_int(argv[1], 10, &iterations) ||
+                     iterations <= 0)) {
+        unixctl_command_reply_error(conn, "invalid number of iterations");
+        return;
+    }
+    portd_nl_parse_bench(nl_sock, iterations, &ds);
+    unixctl_command_reply(conn, ds_cstr(&ds));
+    ds_destroy(&ds);
+}
+
 static void
 portd_unixctl_dump(struct unixctl_conn *conn, int argc OVS_UNUSED,
                    const char *argv[] OVS_UNUSED, void *aux OVS_UNUSED)
@@ -3136,8 +3966,26 @@ usage(void)
     vlog_usage();
     printf("\nOther options:\n"
             "  --unixctl=SOCKET        override default control socket name\n"
+            "  --netlink-rcvbuf=BYTES  netlink notification socket receive\n"
+            "                          buffer size (default: %d, 0: system)\n"
+            "  --netlink-listen-all-nsid\n"
+            "                          receive the netlink events of all vrfs\n"
+            "                          on a single socket\n"
+            "  --db-commit=MODE        commit the database transactions\n"
+            "                          without waiting for the reply (async,\n"
+            "                          default) or waiting for it (block)\n"
+            "  --reconcile-window=MS   apply the database changes once none\n"
+            "                          came for MS ms (default: %d)\n"
+            "  --reconcile-max-delay=MS\n"
+            "                          but at most MS ms after the first one\n"
+            "                          (default: %d)\n"
+            "  --internal-vlan-grace=MS\n"
+            "                          hold the internal VLAN released by a\n"
+            "                          port for it for MS ms (default: %d)\n"
             "  -h, --help              display this help message\n"
-            "  -V, --version           display version information\n");
+            "  -V, --version           display version information\n",
+            PORTD_NL_RCVBUF_DEFAULT, PORTD_RECONCILE_WINDOW_DEFAULT,
+            PORTD_RECONCILE_MAX_DELAY_DEFAULT, PORTD_VLAN_GRACE_DEFAULT);
     exit(EXIT_SUCCESS);
 }
 
@@ -3146,6 +3994,12 @@ parse_options(int argc, char *argv[], char **unixctl_pathp)
 {
     enum {
         OPT_UNIXCTL = UCHAR_MAX + 1,
+        OPT_NETLINK_RCVBUF,
+        OPT_NETLINK_LISTEN_ALL_NSID,
+        OPT_DB_COMMIT,
+        OPT_RECONCILE_WINDOW,
+        OPT_RECONCILE_MAX_DELAY,
+        OPT_INTERNAL_VLAN_GRACE,
         VLOG_OPTION_ENUMS,
         DAEMON_OPTION_ENUMS,
     };
@@ -3154,6 +4008,16 @@ parse_options(int argc, char *argv[], char **unixctl_pathp)
             {"help",        no_argument, NULL, 'h'},
             {"version",     no_argument, NULL, 'V'},
             {"unixctl",     required_argument, NULL, OPT_UNIXCTL},
+            {"netlink-rcvbuf", required_argument, NULL, OPT_NETLINK_RCVBUF},
+            {"netlink-listen-all-nsid", no_argument, NULL,
+             OPT_NETLINK_LISTEN_ALL_NSID},
+            {"db-commit", required_argument, NULL, OPT_DB_COMMIT},
+            {"reconcile-window", required_argument, NULL,
+             OPT_RECONCILE_WINDOW},
+            {"reconcile-max-delay", required_argument, NULL,
+             OPT_RECONCILE_MAX_DELAY},
+            {"internal-vlan-grace", required_argument, NULL,
+             OPT_INTERNAL_VLAN_GRACE},
             DAEMON_LONG_OPTIONS,
             VLOG_LONG_OPTIONS,
             {NULL, 0, NULL, 0},
@@ -3182,6 +4046,50 @@ parse_options(int argc, char *argv[], char **unixctl_pathp)
             *unixctl_pathp = optarg;
             break;
 
+        case OPT_NETLINK_RCVBUF:
+            if (!str_to_int(optarg, 10, &nl_rcvbuf) || nl_rcvbuf < 0) {
+                VLOG_FATAL("--netlink-rcvbuf: invalid size \"%s\"", optarg);
+            }
+            break;
+
+        case OPT_NETLINK_LISTEN_ALL_NSID:
+            nl_listen_all_nsid = true;
+            break;
+
+        case OPT_DB_COMMIT:
+            if (!strcmp(optarg, "async")) {
+                db_commit_async = true;
+            } else if (!strcmp(optarg, "block")) {
+                db_commit_async = false;
+            } else {
+                VLOG_FATAL("--db-commit: unknown mode \"%s\"", optarg);
+            }
+            break;
+
+        case OPT_RECONCILE_WINDOW:
+            if (!str_to_int(optarg, 10, &reconcile_window)
+                || reconcile_window < 0) {
+                VLOG_FATAL("--reconcile-window: invalid delay \"%s\"",
+                           optarg);
+            }
+            break;
+
+        case OPT_RECONCILE_MAX_DELAY:
+            if (!str_to_int(optarg, 10, &reconcile_max_delay)
+                || reconcile_max_delay < 0) {
+                VLOG_FATAL("--reconcile-max-delay: invalid delay \"%s\"",
+                           optarg);
+            }
+            break;
+
+        case OPT_INTERNAL_VLAN_GRACE:
+            if (!str_to_int(optarg, 10, &internal_vlan_grace)
+                || internal_vlan_grace < 0) {
+                VLOG_FATAL("--internal-vlan-grace: invalid delay \"%s\"",
+                           optarg);
+            }
+            break;
+
             VLOG_OPTION_HANDLERS
             DAEMON_OPTION_HANDLERS
 
@@ -3216,6 +4124,8 @@ ops_portd_exit(struct unixctl_conn *conn, int argc OVS_UNUSED,
 {
     bool *exiting = exiting_;
     *exiting = true;
+    hmap_destroy(&ports_by_uuid);
+    hmap_destroy(&interfaces_by_uuid);
     shash_destroy_free_data(&all_ports);
     shash_destroy_free_data(&all_interfaces);
     unixctl_command_reply(conn, NULL);
@@ -3254,9 +4164,9 @@ bool portd_add_interface_netlink(struct ovsrec_port *port_row,
     add_link_attr(&req.n, sizeof(req), IFLA_IFNAME, port_row->name,
                   strlen(port_row->name)+1);
 
-    if (send(nl_sock, &req, req.n.nlmsg_len, 0) == -1) {
-        VLOG_ERR("Netlink failed to create netlink for interface: %s (%s)",
-                 port_row->name, strerror(errno));
+    if (portd_nl_batch_add(nl_sock, &req.n, port_row->name) == -1) {
+        VLOG_ERR("Netlink failed to create netlink for interface: %s",
+                 port_row->name);
         return false;
     }
 
@@ -3267,14 +4177,14 @@ int
 portd_reconfig_ns_loopback(struct port *port,
                            struct ovsrec_port *port_row, bool create_flag)
 {
-    struct vrf *vrf = get_vrf_for_port(port_row->name);
+    struct vrf *vrf = port->vrf;
 
     if (create_flag)
     {
         if (!portd_add_interface_netlink(port_row, "dummy", 0))
         {
-            VLOG_ERR("Netlink failed to create dummy interface: %s (%s)",
-	             port_row->name, strerror(errno));
+            VLOG_ERR("Netlink failed to create dummy interface: %s",
+	             port_row->name);
             return false;
         }
     }
@@ -3286,6 +4196,8 @@ portd_reconfig_ns_loopback(struct port *port,
         memcpy(&setns_local_info.from_ns[0], SWITCH_NAMESPACE,  strlen(SWITCH_NAMESPACE) + 1);
         get_vrf_ns_from_table_id(idl, vrf->table_id, &setns_local_info.to_ns[0]);
         memcpy(&setns_local_info.intf_name[0], port_row->name, strlen(port_row->name) + 1);
+        portd_nl_link_move_prepare(nl_sock, vrf->nl_sock,
+                                   port_row->name);
         if (!nl_move_intf_to_vrf(&setns_local_info))
         {
             VLOG_ERR("Failed to move interface from %s to %s",
@@ -3310,8 +4222,7 @@ portd_register_event_log(struct ovsrec_port *port_row,
     bool ipv4_add = false;
     bool ipv4_delete = false;
 
-    if (OVSREC_IDL_IS_COLUMN_MODIFIED(
-             ovsrec_port_col_ip4_address, idl_seqno)) {
+    if (PORTD_IDL_COL_CHANGED(port_row, port, ip4_address)) {
        if (port->ip4_address) {
           if (port_row->ip4_address) {
              ipv4_add = true;
@@ -3322,8 +4233,7 @@ portd_register_event_log(struct ovsrec_port *port_row,
         ipv4_delete = true;
        }
     }
-    else if (OVSREC_IDL_IS_COLUMN_MODIFIED(
-             ovsrec_port_col_ip6_address, idl_seqno)) {
+    else if (PORTD_IDL_COL_CHANGED(port_row, port, ip6_address)) {
        if (port->ip6_address) {
           if (port_row->ip6_address) {
              ipv6_add = true;
@@ -3334,8 +4244,7 @@ portd_register_event_log(struct ovsrec_port *port_row,
            ipv6_delete = true;
       }
     }
-    else if (OVSREC_IDL_IS_COLUMN_MODIFIED(
-             ovsrec_port_col_admin, idl_seqno)) {
+    else if (PORTD_IDL_COL_CHANGED(port_row, port, admin)) {
        admin_modified = true;
     }
 
@@ -3391,24 +4300,48 @@ portd_register_event_log(struct ovsrec_port *port_row,
    }
 }
 
+/* Runs the arbiter for 'port' and updates its forwarding state column if
+ * the result differs. */
+static void
+portd_arbiter_port_update(const struct ovsrec_port *port)
+{
+    struct smap forwarding_state;
+
+    portd_txn_port_get_smap(port, PORTD_TXN_PORT_FORWARDING_STATE,
+                            &forwarding_state);
+    /* Run the arbiter for the port, only the keys that change are
+     * buffered */
+    portd_arbiter_port_run(port, &forwarding_state);
+    portd_txn_port_set(port, PORTD_TXN_PORT_FORWARDING_STATE,
+                       &forwarding_state);
+    smap_destroy(&forwarding_state);
+}
+
 void
 portd_arbiter_run(void)
 {
     const struct ovsrec_port *port = NULL;
-    struct smap forwarding_state;
+    const struct ovsrec_interface *ifrow = NULL;
+    struct iface_data *idp;
+
+    /* Walk through the ports and the interfaces that changed and update the
+     * forwarding states for each layer and the final forwarding state of
+     * the ports concerned.  A port may be run twice, which is harmless as
+     * the column is only written when the state differs. */
+    OVSREC_PORT_FOR_EACH_TRACKED (port, idl) {
+        if (!ovsrec_port_is_deleted(port)) {
+            portd_arbiter_port_update(port);
+        }
+    }
 
-    /* Walk through all the interfaces and update the forwarding states
-     * for each layer and the final forwarding state. */
-    OVSREC_PORT_FOR_EACH(port, idl) {
-        smap_clone(&forwarding_state, &port->forwarding_state);
-        /* Run the arbiter for the port */
-        portd_arbiter_port_run(port, &forwarding_state);
-        /* Check if the OVSDB column needs an update */
-        if (!smap_equal(&forwarding_state, &port->forwarding_state)) {
-            ovsrec_port_set_forwarding_state(port, &forwarding_state);
-            commit_txn = true;
-        }
-        smap_destroy(&forwarding_state);
+    OVSREC_INTERFACE_FOR_EACH_TRACKED (ifrow, idl) {
+        if (ovsrec_interface_is_deleted(ifrow)) {
+            continue;
+        }
+        idp = portd_iface_lookup_by_uuid(&ifrow->header_.uuid);
+        if (idp && idp->port_datap) {
+            portd_arbiter_port_update(idp->port_datap->cfg);
+        }
     }
 
     return;
@@ -328,6 +328,14 @@ portd_arbiter_port_run(const struct ovsrec_port *port,
     struct portd_arbiter_layer_class *last_layer, *layer;
     const char *layer_key, *layer_owner_key, *owner_name, *state_value;
 
+    /* The layers only hold the state of the port being run.  Start from
+     * scratch, so that the result does not depend on the port run before
+     * this one. */
+    for (layer = portd_arbiter.layers; layer != NULL; layer = layer->next) {
+        layer->blocked = false;
+        layer->owner = PORT_FORWARDING_STATE_PROTO_NONE;
+    }
+
     last_layer = layer = portd_arbiter.layers;
 
     /* Walk from the first to last applicable forwarding layers for port */
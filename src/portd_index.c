@@ -0,0 +1,668 @@
+/*
+ * (c) Copyright 2016 Hewlett Packard Enterprise Development LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+/***************************************************************************
+ *    File               : portd_index.c
+ *    Description        : Indexes of the OVSDB rows portd looks up by name
+ *                           or by owner, maintained incrementally from the
+ *                           changes tracked by the IDL instead of walking
+ *                           the tables.
+ ***************************************************************************/
+
+#include <string.h>
+
+#include "hash.h"
+#include "hmap.h"
+#include "util.h"
+#include "uuid.h"
+#include "openvswitch/vlog.h"
+
+#include "portd.h"
+#include "portd_index.h"
+
+VLOG_DEFINE_THIS_MODULE(portd_index);
+
+extern struct ovsdb_idl *idl;
+
+/* An entry of a 'struct portd_port_index'. */
+struct portd_port_ref {
+    struct hmap_node name_node;     /* In 'by_name'. */
+    struct hmap_node uuid_node;     /* In 'by_uuid'. */
+    char *name;                     /* Name the entry is indexed with. */
+    const struct ovsrec_port *row;
+
+    /* The interfaces of the row when it was last indexed, by UUID since the
+     * interface rows may be gone when the port changes. */
+    struct uuid *ifaces;
+    size_t n_ifaces;
+    const struct ovsrec_interface *iface; /* Interface named as the port. */
+    enum portd_port_class class;          /* From the type of 'iface'. */
+};
+
+/* An interface of a Port row, in 'by_iface'. */
+struct portd_iface_ref {
+    struct hmap_node node;
+    struct uuid uuid;               /* The Interface row's UUID. */
+    struct portd_port_ref *port;
+};
+
+/* The Port rows of the IDL. */
+static struct portd_port_index port_index = {
+    HMAP_INITIALIZER(&port_index.by_name),
+    HMAP_INITIALIZER(&port_index.by_uuid),
+    HMAP_INITIALIZER(&port_index.by_iface),
+};
+
+/* A Bridge or VRF row of a 'struct portd_member_index', with the ports it
+ * had when last indexed. */
+struct portd_owner_ref {
+    struct hmap_node node;          /* In 'owners'. */
+    struct uuid uuid;
+    char *name;
+    struct uuid *ports;
+    size_t n_ports;
+};
+
+/* A port in the rows named 'owner', or in any row if 'owner' is empty.  A
+ * port may be listed by several rows with the same name. */
+struct portd_member_ref {
+    struct hmap_node node;          /* In 'members'. */
+    struct uuid port;
+    char *owner;
+    unsigned int count;             /* Number of rows listing the port. */
+};
+
+/* The ports of the Bridge rows and of the VRF rows. */
+static struct portd_member_index bridge_members = {
+    HMAP_INITIALIZER(&bridge_members.owners),
+    HMAP_INITIALIZER(&bridge_members.members),
+};
+static struct portd_member_index vrf_members = {
+    HMAP_INITIALIZER(&vrf_members.owners),
+    HMAP_INITIALIZER(&vrf_members.members),
+};
+
+/* The VLAN rows by id.  The rows inserted by the transaction of a pass are
+ * indexed as well, and listed in 'vlan_inserted' since the IDL frees them
+ * along with the transaction. */
+static const struct ovsrec_vlan *vlan_rows[PORTD_VLAN_ID_MAX + 1];
+static uint16_t vlan_inserted[PORTD_VLAN_ID_MAX + 1];
+static size_t n_vlan_inserted;
+
+void
+portd_port_index_init(struct portd_port_index *index)
+{
+    hmap_init(&index->by_name);
+    hmap_init(&index->by_uuid);
+    hmap_init(&index->by_iface);
+    memset(index->vlan_names, 0, sizeof index->vlan_names);
+}
+
+/* Indexes 'ref' under its name. */
+static void
+portd_port_ref_add_name(struct portd_port_index *index,
+                        struct portd_port_ref *ref)
+{
+    int vid = portd_vlan_name_to_vid(ref->name);
+
+    hmap_insert(&index->by_name, &ref->name_node, hash_string(ref->name, 0));
+    if (vid != -1) {
+        index->vlan_names[vid]++;
+    }
+}
+
+/* Removes 'ref' from the name index and forgets its name. */
+static void
+portd_port_ref_del_name(struct portd_port_index *index,
+                        struct portd_port_ref *ref)
+{
+    int vid = portd_vlan_name_to_vid(ref->name);
+
+    hmap_remove(&index->by_name, &ref->name_node);
+    if (vid != -1) {
+        index->vlan_names[vid]--;
+    }
+    free(ref->name);
+    ref->name = NULL;
+}
+
+static struct portd_iface_ref *
+portd_iface_ref_find(const struct portd_port_index *index,
+                     const struct uuid *uuid)
+{
+    struct portd_iface_ref *iref;
+
+    HMAP_FOR_EACH_WITH_HASH (iref, node, uuid_hash(uuid), &index->by_iface) {
+        if (uuid_equals(&iref->uuid, uuid)) {
+            return iref;
+        }
+    }
+    return NULL;
+}
+
+/* Removes the interfaces of 'ref' from 'index'. */
+static void
+portd_port_ref_del_ifaces(struct portd_port_index *index,
+                          struct portd_port_ref *ref)
+{
+    size_t i;
+
+    for (i = 0; i < ref->n_ifaces; i++) {
+        struct portd_iface_ref *iref;
+
+        iref = portd_iface_ref_find(index, &ref->ifaces[i]);
+        /* The interface may have been moved to another port since. */
+        if (iref && iref->port == ref) {
+            hmap_remove(&index->by_iface, &iref->node);
+            free(iref);
+        }
+    }
+    free(ref->ifaces);
+    ref->ifaces = NULL;
+    ref->n_ifaces = 0;
+}
+
+/* Finds the interface of 'ref' named as its port, as
+ * portd_get_matching_interface_row() used to on each call, and classifies
+ * the port from the interface's type. */
+static void
+portd_port_ref_match_iface(struct portd_port_ref *ref)
+{
+    const struct ovsrec_port *row = ref->row;
+    size_t i;
+
+    ref->iface = NULL;
+    ref->class = PORTD_PORT_CLASS_OTHER;
+    for (i = 0; i < row->n_interfaces; i++) {
+        if (!strcmp(row->interfaces[i]->name, row->name)) {
+            ref->iface = row->interfaces[i];
+            break;
+        }
+    }
+
+    if (!ref->iface || !ref->iface->type) {
+        return;
+    }
+    if (!strcmp(ref->iface->type, OVSREC_INTERFACE_TYPE_INTERNAL)) {
+        ref->class = PORTD_PORT_CLASS_INTERNAL;
+    } else if (!strcmp(ref->iface->type, OVSREC_INTERFACE_TYPE_LOOPBACK)) {
+        ref->class = PORTD_PORT_CLASS_LOOPBACK;
+    } else if (!strcmp(ref->iface->type, OVSREC_INTERFACE_TYPE_VLANSUBINT)) {
+        ref->class = PORTD_PORT_CLASS_VLANSUBINT;
+    }
+}
+
+/* Indexes the current interfaces of the row of 'ref'. */
+static void
+portd_port_ref_add_ifaces(struct portd_port_index *index,
+                          struct portd_port_ref *ref)
+{
+    const struct ovsrec_port *row = ref->row;
+    size_t i;
+
+    ref->n_ifaces = row->n_interfaces;
+    ref->ifaces = xmalloc(row->n_interfaces * sizeof *ref->ifaces);
+    for (i = 0; i < row->n_interfaces; i++) {
+        const struct uuid *uuid = &row->interfaces[i]->header_.uuid;
+        struct portd_iface_ref *iref;
+
+        ref->ifaces[i] = *uuid;
+        iref = portd_iface_ref_find(index, uuid);
+        if (!iref) {
+            iref = xmalloc(sizeof *iref);
+            iref->uuid = *uuid;
+            hmap_insert(&index->by_iface, &iref->node, uuid_hash(uuid));
+        }
+        iref->port = ref;
+    }
+    portd_port_ref_match_iface(ref);
+}
+
+void
+portd_port_index_destroy(struct portd_port_index *index)
+{
+    struct portd_iface_ref *iref, *next_iref;
+    struct portd_port_ref *ref, *next;
+
+    HMAP_FOR_EACH_SAFE (iref, next_iref, node, &index->by_iface) {
+        hmap_remove(&index->by_iface, &iref->node);
+        free(iref);
+    }
+    HMAP_FOR_EACH_SAFE (ref, next, uuid_node, &index->by_uuid) {
+        hmap_remove(&index->by_uuid, &ref->uuid_node);
+        hmap_remove(&index->by_name, &ref->name_node);
+        free(ref->ifaces);
+        free(ref->name);
+        free(ref);
+    }
+    hmap_destroy(&index->by_name);
+    hmap_destroy(&index->by_uuid);
+    hmap_destroy(&index->by_iface);
+}
+
+static struct portd_port_ref *
+portd_port_index_find_uuid(const struct portd_port_index *index,
+                           const struct uuid *uuid)
+{
+    struct portd_port_ref *ref;
+
+    HMAP_FOR_EACH_WITH_HASH (ref, uuid_node, uuid_hash(uuid),
+                             &index->by_uuid) {
+        if (uuid_equals(&ref->row->header_.uuid, uuid)) {
+            return ref;
+        }
+    }
+    return NULL;
+}
+
+/* Adds 'row' to 'index', or updates its entry with the row's current name
+ * and interfaces. */
+void
+portd_port_index_set(struct portd_port_index *index,
+                     const struct ovsrec_port *row)
+{
+    struct portd_port_ref *ref;
+
+    ref = portd_port_index_find_uuid(index, &row->header_.uuid);
+    if (ref) {
+        portd_port_ref_del_ifaces(index, ref);
+        if (strcmp(ref->name, row->name)) {
+            portd_port_ref_del_name(index, ref);
+        }
+    } else {
+        ref = xzalloc(sizeof *ref);
+        ref->row = row;
+        hmap_insert(&index->by_uuid, &ref->uuid_node,
+                    uuid_hash(&row->header_.uuid));
+    }
+    if (!ref->name) {
+        ref->name = xstrdup(row->name);
+        portd_port_ref_add_name(index, ref);
+    }
+    portd_port_ref_add_ifaces(index, ref);
+}
+
+/* Removes the row with 'uuid' from 'index', if present. */
+void
+portd_port_index_remove(struct portd_port_index *index,
+                        const struct uuid *uuid)
+{
+    struct portd_port_ref *ref = portd_port_index_find_uuid(index, uuid);
+
+    if (ref) {
+        portd_port_ref_del_ifaces(index, ref);
+        hmap_remove(&index->by_uuid, &ref->uuid_node);
+        portd_port_ref_del_name(index, ref);
+        free(ref);
+    }
+}
+
+const struct ovsrec_port *
+portd_port_index_find(const struct portd_port_index *index, const char *name)
+{
+    struct portd_port_ref *ref;
+
+    HMAP_FOR_EACH_WITH_HASH (ref, name_node, hash_string(name, 0),
+                             &index->by_name) {
+        if (!strcmp(ref->name, name)) {
+            return ref->row;
+        }
+    }
+    return NULL;
+}
+
+/* Returns the Port row of 'index' that has the interface with 'uuid'. */
+const struct ovsrec_port *
+portd_port_index_find_iface(const struct portd_port_index *index,
+                            const struct uuid *uuid)
+{
+    struct portd_iface_ref *iref = portd_iface_ref_find(index, uuid);
+
+    return iref ? iref->port->row : NULL;
+}
+
+/* Returns true if a row of 'index' is named as the VLAN interface of VLAN
+ * 'vid', "vlan" followed by the id. */
+bool
+portd_port_index_has_vlan_name(const struct portd_port_index *index, int vid)
+{
+    return (vid >= PORTD_VLAN_ID_MIN && vid <= PORTD_VLAN_ID_MAX
+            && index->vlan_names[vid]);
+}
+
+/* Updates the interface named as its port, and the class, of the port that
+ * has the interface 'iface_row', after the interface was renamed or its
+ * type changed. */
+static void
+portd_port_index_iface_changed(struct portd_port_index *index,
+                               const struct ovsrec_interface *iface_row)
+{
+    struct portd_iface_ref *iref;
+
+    iref = portd_iface_ref_find(index, &iface_row->header_.uuid);
+    if (iref) {
+        portd_port_ref_match_iface(iref->port);
+    }
+}
+
+static struct portd_member_ref *
+portd_member_find(const struct portd_member_index *index,
+                  const struct uuid *port, const char *owner)
+{
+    struct portd_member_ref *member;
+
+    HMAP_FOR_EACH_WITH_HASH (member, node,
+                             hash_string(owner, uuid_hash(port)),
+                             &index->members) {
+        if (uuid_equals(&member->port, port)
+            && !strcmp(member->owner, owner)) {
+            return member;
+        }
+    }
+    return NULL;
+}
+
+static void
+portd_member_ref(struct portd_member_index *index, const struct uuid *port,
+                 const char *owner)
+{
+    struct portd_member_ref *member = portd_member_find(index, port, owner);
+
+    if (!member) {
+        member = xzalloc(sizeof *member);
+        member->port = *port;
+        member->owner = xstrdup(owner);
+        hmap_insert(&index->members, &member->node,
+                    hash_string(owner, uuid_hash(port)));
+    }
+    member->count++;
+}
+
+static void
+portd_member_unref(struct portd_member_index *index, const struct uuid *port,
+                   const char *owner)
+{
+    struct portd_member_ref *member = portd_member_find(index, port, owner);
+
+    if (member && !--member->count) {
+        hmap_remove(&index->members, &member->node);
+        free(member->owner);
+        free(member);
+    }
+}
+
+static struct portd_owner_ref *
+portd_owner_find(const struct portd_member_index *index,
+                 const struct uuid *uuid)
+{
+    struct portd_owner_ref *owner;
+
+    HMAP_FOR_EACH_WITH_HASH (owner, node, uuid_hash(uuid), &index->owners) {
+        if (uuid_equals(&owner->uuid, uuid)) {
+            return owner;
+        }
+    }
+    return NULL;
+}
+
+/* Removes the row with 'uuid' and its ports from 'index', if present. */
+static void
+portd_member_index_remove(struct portd_member_index *index,
+                          const struct uuid *uuid)
+{
+    struct portd_owner_ref *owner = portd_owner_find(index, uuid);
+    size_t i;
+
+    if (!owner) {
+        return;
+    }
+    for (i = 0; i < owner->n_ports; i++) {
+        portd_member_unref(index, &owner->ports[i], owner->name);
+        portd_member_unref(index, &owner->ports[i], "");
+    }
+    hmap_remove(&index->owners, &owner->node);
+    free(owner->ports);
+    free(owner->name);
+    free(owner);
+}
+
+/* Indexes the ports of the Bridge or VRF row with 'uuid', replacing those
+ * it had. */
+static void
+portd_member_index_set(struct portd_member_index *index,
+                       const struct uuid *uuid, const char *name,
+                       struct ovsrec_port **ports, size_t n_ports)
+{
+    struct portd_owner_ref *owner;
+    size_t i;
+
+    portd_member_index_remove(index, uuid);
+
+    owner = xmalloc(sizeof *owner);
+    owner->uuid = *uuid;
+    owner->name = xstrdup(name);
+    owner->n_ports = n_ports;
+    owner->ports = xmalloc(n_ports * sizeof *owner->ports);
+    for (i = 0; i < n_ports; i++) {
+        owner->ports[i] = ports[i]->header_.uuid;
+        portd_member_ref(index, &owner->ports[i], owner->name);
+        portd_member_ref(index, &owner->ports[i], "");
+    }
+    hmap_insert(&index->owners, &owner->node, uuid_hash(uuid));
+}
+
+/* Returns true if the port with the name 'port_name' is in a row of 'index'
+ * named 'owner', or in any row if 'owner' is NULL or empty. */
+static bool
+portd_member_index_contains(const struct portd_member_index *index,
+                            const char *port_name, const char *owner)
+{
+    const struct ovsrec_port *port_row = portd_index_port_find(port_name);
+
+    return port_row && portd_member_find(index, &port_row->header_.uuid,
+                                         owner ? owner : "");
+}
+
+/*
+ * Applies the changes of the Port, Interface, Bridge and VRF tables tracked
+ * since the last reconfiguration to the indexes.  Called at the start of
+ * each reconfiguration, before any lookup; a pass that does not complete
+ * sees the same changes again, which is harmless.
+ */
+void
+portd_index_run(void)
+{
+    const struct ovsrec_interface *iface_row;
+    const struct ovsrec_bridge *br_row;
+    const struct ovsrec_port *port_row;
+    const struct ovsrec_vrf *vrf_row;
+
+    OVSREC_PORT_FOR_EACH_TRACKED (port_row, idl) {
+        if (ovsrec_port_is_deleted(port_row)) {
+            portd_port_index_remove(&port_index, &port_row->header_.uuid);
+        }
+    }
+    OVSREC_PORT_FOR_EACH_TRACKED (port_row, idl) {
+        if (!ovsrec_port_is_deleted(port_row)) {
+            portd_port_index_set(&port_index, port_row);
+        }
+    }
+
+    /* A deleted or added interface changes the interfaces of its port,
+     * only a rename or a change of type is left to handle. */
+    OVSREC_INTERFACE_FOR_EACH_TRACKED (iface_row, idl) {
+        if (!ovsrec_interface_is_deleted(iface_row)
+            && (ovsdb_idl_track_is_updated(&iface_row->header_,
+                                           &ovsrec_interface_col_name)
+                || ovsdb_idl_track_is_updated(&iface_row->header_,
+                                              &ovsrec_interface_col_type))) {
+            portd_port_index_iface_changed(&port_index, iface_row);
+        }
+    }
+
+    /* The membership of a port is kept by UUID, a renamed port stays in
+     * its bridge and VRF. */
+    OVSREC_BRIDGE_FOR_EACH_TRACKED (br_row, idl) {
+        if (ovsrec_bridge_is_deleted(br_row)) {
+            portd_member_index_remove(&bridge_members, &br_row->header_.uuid);
+        } else {
+            portd_member_index_set(&bridge_members, &br_row->header_.uuid,
+                                   br_row->name, br_row->ports,
+                                   br_row->n_ports);
+        }
+    }
+    OVSREC_VRF_FOR_EACH_TRACKED (vrf_row, idl) {
+        if (ovsrec_vrf_is_deleted(vrf_row)) {
+            portd_member_index_remove(&vrf_members, &vrf_row->header_.uuid);
+        } else {
+            portd_member_index_set(&vrf_members, &vrf_row->header_.uuid,
+                                   vrf_row->name, vrf_row->ports,
+                                   vrf_row->n_ports);
+        }
+    }
+}
+
+/* Returns the Port row named 'name', NULL if there is none. */
+const struct ovsrec_port *
+portd_index_port_find(const char *name)
+{
+    return name ? portd_port_index_find(&port_index, name) : NULL;
+}
+
+/* Returns the Port row that has 'iface_row' among its interfaces, NULL if
+ * there is none. */
+const struct ovsrec_port *
+portd_index_iface_port(const struct ovsrec_interface *iface_row)
+{
+    return portd_port_index_find_iface(&port_index, &iface_row->header_.uuid);
+}
+
+/* Returns the interface of 'port_row' that has the same name as the port,
+ * NULL if there is none (e.g. for a LAG). */
+const struct ovsrec_interface *
+portd_index_port_iface(const struct ovsrec_port *port_row)
+{
+    struct portd_port_ref *ref;
+
+    ref = portd_port_index_find_uuid(&port_index, &port_row->header_.uuid);
+    return ref ? ref->iface : NULL;
+}
+
+/* Returns the class of 'port_row', from the type of its interface of the
+ * same name. */
+enum portd_port_class
+portd_index_port_class(const struct ovsrec_port *port_row)
+{
+    struct portd_port_ref *ref;
+
+    ref = portd_port_index_find_uuid(&port_index, &port_row->header_.uuid);
+    return ref ? ref->class : PORTD_PORT_CLASS_OTHER;
+}
+
+/* Returns true if the port named 'port_name' is in the bridge 'bridge_name',
+ * or in any bridge if 'bridge_name' is NULL or empty. */
+bool
+portd_index_port_in_bridge(const char *port_name, const char *bridge_name)
+{
+    return portd_member_index_contains(&bridge_members, port_name,
+                                       bridge_name);
+}
+
+/* Returns true if the port named 'port_name' is in the VRF 'vrf_name', or
+ * in any VRF if 'vrf_name' is NULL or empty. */
+bool
+portd_index_port_in_vrf(const char *port_name, const char *vrf_name)
+{
+    return portd_member_index_contains(&vrf_members, port_name, vrf_name);
+}
+
+/* Returns true if a port is named as the VLAN interface of VLAN 'vid'. */
+bool
+portd_index_vlan_name_used(int vid)
+{
+    return portd_port_index_has_vlan_name(&port_index, vid);
+}
+
+/*
+ * Applies the changes of the VLAN table tracked since the last
+ * reconfiguration to the VLAN index, and forgets the rows inserted by the
+ * transaction of a previous pass: ovsdb-server's copies of those that it
+ * committed are among the tracked changes.  Called at the start of each
+ * pass that may write to the database, once no transaction is in flight;
+ * the same tracked changes may be applied several times.
+ */
+void
+portd_index_vlan_run(void)
+{
+    const struct ovsrec_vlan *vlan_row;
+    size_t i;
+
+    for (i = 0; i < n_vlan_inserted; i++) {
+        vlan_rows[vlan_inserted[i]] = NULL;
+    }
+    n_vlan_inserted = 0;
+
+    OVSREC_VLAN_FOR_EACH_TRACKED (vlan_row, idl) {
+        if (ovsrec_vlan_is_deleted(vlan_row)) {
+            if (portd_index_vlan_find(vlan_row->id) == vlan_row) {
+                vlan_rows[vlan_row->id] = NULL;
+            }
+        } else if (!ovsrec_vlan_is_new(vlan_row)
+                   && ovsdb_idl_track_is_updated(&vlan_row->header_,
+                                                 &ovsrec_vlan_col_id)) {
+            /* The id of a VLAN is not expected to change, the row is
+             * looked for under the old one. */
+            int vid;
+
+            for (vid = PORTD_VLAN_ID_MIN; vid <= PORTD_VLAN_ID_MAX; vid++) {
+                if (vlan_rows[vid] == vlan_row) {
+                    vlan_rows[vid] = NULL;
+                }
+            }
+        }
+    }
+    OVSREC_VLAN_FOR_EACH_TRACKED (vlan_row, idl) {
+        if (!ovsrec_vlan_is_deleted(vlan_row)
+            && vlan_row->id >= PORTD_VLAN_ID_MIN
+            && vlan_row->id <= PORTD_VLAN_ID_MAX) {
+            vlan_rows[vlan_row->id] = vlan_row;
+        }
+    }
+}
+
+/* Indexes 'vlan_row', just inserted by the transaction of the pass, whose
+ * id is already set. */
+void
+portd_index_vlan_inserted(const struct ovsrec_vlan *vlan_row)
+{
+    int vid = vlan_row->id;
+
+    if (vid >= PORTD_VLAN_ID_MIN && vid <= PORTD_VLAN_ID_MAX
+        && n_vlan_inserted < ARRAY_SIZE(vlan_inserted)) {
+        vlan_rows[vid] = vlan_row;
+        vlan_inserted[n_vlan_inserted++] = vid;
+    }
+}
+
+/* Returns the VLAN row with id 'vid', NULL if there is none.  A row deleted
+ * by the pass, or by ovsdb-server since the last reconfiguration, may still
+ * be returned. */
+const struct ovsrec_vlan *
+portd_index_vlan_find(int vid)
+{
+    return (vid >= PORTD_VLAN_ID_MIN && vid <= PORTD_VLAN_ID_MAX
+            ? vlan_rows[vid] : NULL);
+}
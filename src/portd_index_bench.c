@@ -0,0 +1,130 @@
+/*
+ * (c) Copyright 2016 Hewlett Packard Enterprise Development LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+/***************************************************************************
+ *    File               : portd_index_bench.c
+ *    Description        : Benchmark of the Port name lookups of the init
+ *                           passes, through the index of portd_index.c
+ *                           and through the linear walk of the table it
+ *                           replaced.  Built with -DPORTD_BENCH=ON, not
+ *                           part of the daemon.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timeval.h"
+#include "util.h"
+#include "vswitch-idl.h"
+
+#include "portd_index.h"
+
+/* The linear walk is quadratic, larger tables take too long. */
+#define PORTD_INDEX_BENCH_MAX_PORTS 16384
+
+/* portd_index.c reads the IDL of the daemon, which the benchmark does not
+ * connect. */
+struct ovsdb_idl *idl;
+
+/*
+ * Builds 'n' synthetic Port rows and looks every one of them up once, as
+ * the init passes do for the kernel VLAN interfaces and the internal
+ * VLANs, first with the index, then with the linear walk.
+ */
+static void
+portd_index_bench(int n)
+{
+    struct portd_port_index index;
+    struct ovsrec_port *rows;
+    long long int start, build, indexed, linear;
+    int n_found = 0;
+    int j, k;
+
+    rows = xzalloc(n * sizeof *rows);
+    for (j = 0; j < n; j++) {
+        rows[j].name = xasprintf("bench%d", j);
+        rows[j].header_.uuid.parts[0] = j;
+    }
+
+    start = time_usec();
+    portd_port_index_init(&index);
+    for (j = 0; j < n; j++) {
+        portd_port_index_set(&index, &rows[j]);
+    }
+    build = time_usec() - start;
+
+    start = time_usec();
+    for (j = 0; j < n; j++) {
+        n_found += portd_port_index_find(&index, rows[j].name) != NULL;
+    }
+    indexed = time_usec() - start;
+
+    start = time_usec();
+    for (j = 0; j < n; j++) {
+        for (k = 0; k < n; k++) {
+            if (!strcmp(rows[k].name, rows[j].name)) {
+                n_found++;
+                break;
+            }
+        }
+    }
+    linear = time_usec() - start;
+
+    printf("%d ports: index build %lld us, %d lookups indexed %lld us, "
+           "linear %lld us (%d found)\n",
+           n, build, n, indexed, linear, n_found);
+
+    portd_port_index_destroy(&index);
+    for (j = 0; j < n; j++) {
+        free(rows[j].name);
+    }
+    free(rows);
+}
+
+/* Usage: ops-portd-index-bench [PORTS...], 1000, 4000 and 8000 ports by
+ * default. */
+int
+main(int argc, char *argv[])
+{
+    static const int default_sizes[] = { 1000, 4000, 8000 };
+    int i;
+
+    set_program_name(argv[0]);
+    if (argc <= 1) {
+        for (i = 0; i < ARRAY_SIZE(default_sizes); i++) {
+            portd_index_bench(default_sizes[i]);
+        }
+        return 0;
+    }
+
+    for (i = 1; i < argc; i++) {
+        int n;
+
+        if (!str_to_int(argv[i], 10, &n) || n <= 0
+            || n > PORTD_INDEX_BENCH_MAX_PORTS) {
+            ovs_fatal(0, "%s: number of ports must be between 1 and %d",
+                      argv[i], PORTD_INDEX_BENCH_MAX_PORTS);
+        }
+    }
+    for (i = 1; i < argc; i++) {
+        int n;
+
+        str_to_int(argv[i], 10, &n);
+        portd_index_bench(n);
+    }
+    return 0;
+}
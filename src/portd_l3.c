@@ -21,6 +21,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <linux/if_addr.h>
+#include <linux/ip.h>
 #include <net/if.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
@@ -31,6 +32,7 @@
 #include "eventlog.h"
 
 #include "portd.h"
+#include "portd_netlink.h"
 #include "vrf-utils.h"
 
 VLOG_DEFINE_THIS_MODULE(portd_l3);
@@ -38,16 +40,19 @@ VLOG_DEFINE_THIS_MODULE(portd_l3);
 extern unsigned int idl_seqno;
 extern struct ovsdb_idl *idl;
 extern struct ovsdb_idl_txn *txn;
-extern bool commit_txn;
 extern struct hmap all_vrfs;
 
 extern int nl_sock;
+extern int sysctl_fd[PORTD_SYSCTL_MAX];
 extern int init_sock;
 
 int portd_get_prefix(int family, char *ip_address, void *prefix,
                             unsigned char *prefixlen);
-static void portd_set_ipaddr(int cmd, const char *port_name, char *ip_address,
-                             int family, bool secondary);
+static void portd_set_ipaddr(int cmd, const struct port *port,
+                             char *ip_address, int family, bool secondary);
+static void nl_ip_address_request(int cmd, struct vrf *vrf,
+                                  const char *port_name, char *ip_address,
+                                  int family, bool secondary);
 static struct net_address* portd_ip6_addr_find(struct port *cfg,
                                                const char *address);
 static struct net_address* portd_ip4_addr_find(struct port *cfg,
@@ -72,7 +77,9 @@ static void portd_populate_kernel_ip_addr(int family,
                                           struct shash *kernel_port_list);
 static void portd_populate_db_ip_addr(struct shash *db_port_list,
                                       struct shash *kernel_port_list);
-static void portd_add_port_to_cache(struct port *port);
+static void portd_ipaddr_sync_port(struct vrf *vrf, struct port *db_port,
+                                   struct kernel_port *kernel_port);
+static void portd_kernel_port_free(struct kernel_port *kernel_port);
 
 
 /* write to /proc entries to enable/disable proxy ARP on the port */
@@ -81,6 +88,9 @@ portd_config_proxy_arp(struct port *port, char *str, int enable)
 {
     char proxy_arp_str[100] = {0};
 
+    /* The sysctl entry only exists once the queued link creation is sent. */
+    portd_nl_batch_flush_links(NL_SOCK(port->vrf));
+
     snprintf(proxy_arp_str, sizeof(proxy_arp_str),
             "sysctl net.ipv4.conf.%s.proxy_arp=%d", str,enable);
 
@@ -104,6 +114,8 @@ portd_config_local_proxy_arp(struct port *port, char *str, int enable)
 {
     char local_proxy_arp_str[100] = {0};
 
+    portd_nl_batch_flush_links(NL_SOCK(port->vrf));
+
     snprintf(local_proxy_arp_str, sizeof(local_proxy_arp_str),
             "sysctl net.ipv4.conf.%s.proxy_arp_pvlan=%d", str,enable);
 
@@ -120,146 +132,182 @@ portd_config_local_proxy_arp(struct port *port, char *str, int enable)
     VLOG_DBG("%s Local proxy ARP", (enable == 1 ? "Enabled" : "Disabled"));
 }
 
-/* write to /proc entries to enable/disable Linux ip forwarding(routing) */
+static const char *portd_sysctl_paths[PORTD_SYSCTL_MAX] = {
+    [PORTD_SYSCTL_IPV4_FORWARD] = "/proc/sys/net/ipv4/ip_forward",
+    [PORTD_SYSCTL_IPV6_FORWARD] = "/proc/sys/net/ipv6/conf/all/forwarding",
+    [PORTD_SYSCTL_ICMP_ECHO_IGNORE_BCAST] =
+        "/proc/sys/net/ipv4/icmp_echo_ignore_broadcasts",
+    [PORTD_SYSCTL_ACCEPT_SOURCE_ROUTE] =
+        "/proc/sys/net/ipv4/conf/all/accept_source_route",
+};
+
+/*
+ * Opens the /proc/sys/net entries of the namespace of 'vrf' (the default one
+ * if NULL) into 'fds'.  /proc/sys/net resolves to the namespace of the task
+ * opening it, so this is the only place that enters the namespace; the
+ * entries are written through 'fds' afterwards.
+ */
 void
-portd_config_iprouting(const char *vrf_name, int enable)
+portd_sysctl_open(struct vrf *vrf, int *fds)
 {
-    int fd = -1, nbytes = 0;
-    char buf[4];
-    const char *ipv4_path = "/proc/sys/net/ipv4/ip_forward";
-    const char *ipv6_path = "/proc/sys/net/ipv6/conf/all/forwarding";
-    const char *icmp_bcast = "/proc/sys/net/ipv4/icmp_echo_ignore_broadcasts";
-    const char *source_route = "/proc/sys/net/ipv4/conf/all/accept_source_route";
-
-    if (!vrf_name)
-    {
-        VLOG_ERR("Error: VRF name recieved is NULL");
+    bool switch_ns = vrf && strcmp(vrf->name, DEFAULT_VRF_NAME) != 0;
+    int i;
+
+    for (i = 0; i < PORTD_SYSCTL_MAX; i++) {
+        fds[i] = -1;
+    }
+
+    if (switch_ns && vrf_setns_with_name(idl, vrf->name)) {
+        VLOG_ERR("Unable to set %s vrf's namespace, errno %d",
+                  vrf->name, errno);
         return;
     }
 
-    if (strncmp(vrf_name, DEFAULT_VRF_NAME, strlen(DEFAULT_VRF_NAME)) != 0)
-    {
-        if(vrf_setns_with_name(idl, vrf_name))
-        {
-            VLOG_ERR("Unable to set %s vrf's namespace, errno %d",
-                      vrf_name, errno);
-            return;
+    for (i = 0; i < PORTD_SYSCTL_MAX; i++) {
+        fds[i] = open(portd_sysctl_paths[i], O_WRONLY);
+        if (fds[i] == -1) {
+            VLOG_ERR("Unable to open %s (%s)", portd_sysctl_paths[i],
+                     strerror(errno));
         }
     }
 
-    nbytes = snprintf(buf, 2, "%d", enable);
-    if ((fd = open(ipv4_path, O_WRONLY)) == -1) {
-        VLOG_ERR("Unable to open %s (%s)", ipv4_path, strerror(errno));
-        goto cleanup;
+    if (switch_ns && vrf_setns_with_name(idl, DEFAULT_VRF_NAME)) {
+        VLOG_ERR("Unable to set %s vrf's old namespace, errno %d",
+                  vrf->name, errno);
     }
-    if (write(fd, buf, nbytes) == -1) {
-        VLOG_ERR("Unable to write to %s (%s)", ipv4_path, strerror(errno));
-        close(fd);
-        goto cleanup;
+}
+
+void
+portd_sysctl_close(int *fds)
+{
+    int i;
+
+    for (i = 0; i < PORTD_SYSCTL_MAX; i++) {
+        if (fds[i] != -1) {
+            close(fds[i]);
+            fds[i] = -1;
+        }
     }
-    close(fd);
-    VLOG_DBG("%s ipv4 forwarding", (enable == 1 ? "Enabled" : "Disabled"));
+}
 
-    if ((fd = open(ipv6_path, O_WRONLY)) == -1) {
-        VLOG_ERR("Unable to open %s (%s)", ipv6_path, strerror(errno));
-        goto cleanup;
+/* Writes 'value' to the /proc/sys entry 'id' opened in 'fds'. */
+static bool
+portd_sysctl_write(const int *fds, enum portd_sysctl id, int value)
+{
+    char buf[4];
+    int nbytes = snprintf(buf, sizeof(buf), "%d", value);
+
+    if (fds[id] == -1) {
+        VLOG_ERR("Unable to write to %s (not open)", portd_sysctl_paths[id]);
+        return false;
+    }
+    if (pwrite(fds[id], buf, nbytes, 0) == -1) {
+        VLOG_ERR("Unable to write to %s (%s)", portd_sysctl_paths[id],
+                 strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/* write to /proc entries to enable/disable Linux ip forwarding(routing) */
+void
+portd_config_iprouting(struct vrf *vrf, int enable)
+{
+    const int *fds = vrf ? vrf->sysctl_fd : sysctl_fd;
+
+    if (!portd_sysctl_write(fds, PORTD_SYSCTL_IPV4_FORWARD, enable)) {
+        return;
     }
-    if (write(fd, buf, nbytes) == -1) {
-        VLOG_ERR("Unable to write to %s (%s)", ipv6_path, strerror(errno));
-        close(fd);
-        goto cleanup;
+    VLOG_DBG("%s ipv4 forwarding", (enable == 1 ? "Enabled" : "Disabled"));
+
+    if (!portd_sysctl_write(fds, PORTD_SYSCTL_IPV6_FORWARD, enable)) {
+        return;
     }
-    close(fd);
     VLOG_DBG("%s ipv6 forwarding", (enable == 1 ? "Enabled" : "Disabled"));
 
     /* By default value in this file is set to 1,
      * Changing value to zero to allow broadcast ping
      * when routing is enabled.
      */
-    nbytes = snprintf(buf, 2, "%d", !enable);
-    if ((fd = open(icmp_bcast, O_WRONLY)) == -1) {
-        VLOG_ERR("Unable to open %s (%s)", icmp_bcast, strerror(errno));
-        goto cleanup;
-    }
-    if (write(fd, buf, nbytes) == -1) {
-        VLOG_ERR("Unable to write to %s (%s)", icmp_bcast, strerror(errno));
-        close(fd);
-        goto cleanup;
+    if (!portd_sysctl_write(fds, PORTD_SYSCTL_ICMP_ECHO_IGNORE_BCAST,
+                            !enable)) {
+        return;
     }
-    close(fd);
 
     /* By default value in this file is set to 0,
      * Changing value to one to enable source routing support,
      * when routing is enabled.
      */
-    nbytes = snprintf(buf, 2, "%d", enable);
-    if ((fd = open(source_route, O_WRONLY)) == -1) {
-        VLOG_ERR("Unable to open %s (%s)", source_route, strerror(errno));
-        goto cleanup;
-    }
-    if (write(fd, buf, nbytes) == -1) {
-        VLOG_ERR("Unable to write to %s (%s)", source_route, strerror(errno));
-        close(fd);
-        goto cleanup;
+    if (!portd_sysctl_write(fds, PORTD_SYSCTL_ACCEPT_SOURCE_ROUTE, enable)) {
+        return;
     }
-    close(fd);
     VLOG_DBG("%s ipv4 source route", (enable == 1 ? "Enabled" : "Disabled"));
-
-cleanup:
-    if (strncmp(vrf_name, DEFAULT_VRF_NAME, strlen(DEFAULT_VRF_NAME)) != 0)
-    {
-        if (vrf_setns_with_name(idl, DEFAULT_VRF_NAME))
-        {
-            VLOG_ERR("Unable to set %s vrf's old namespace, errno %d",
-                      vrf_name, errno);
-            return;
-        }
-    }
-    return;
 }
 
-/* write to /proc entries to enable/disable configuration on a port */
+/*
+ * Enable/disable source routing on a port.  The per port accept_source_route
+ * entry is set with netlink (IFLA_INET_CONF), which unlike /proc does not
+ * require entering the namespace of the vrf.
+ */
 void
 portd_config_src_routing(struct vrf *vrf, const char *port_name, bool enable)
 {
-    int fd = -1, nbytes = 0;
-    char buf[4];
+    struct {
+        struct nlmsghdr  n;
+        struct ifinfomsg i;
+        char             buf[64];
+    } req;
+    struct rtattr *af_spec, *af_inet, *inet_conf, *rta;
+    uint32_t value = enable;
 
-    char filename[PROC_FILE_LENGTH];
+    memset(&req, 0, sizeof(req));
 
-    snprintf(filename, PROC_FILE_LENGTH, "%s%s%s", "/proc/sys/net/ipv4/conf/",
-             port_name, "/accept_source_route");
+    req.n.nlmsg_len     = NLMSG_SPACE(sizeof(struct ifinfomsg));
+    req.n.nlmsg_pid     = getpid();
+    req.n.nlmsg_type    = RTM_NEWLINK;
+    req.n.nlmsg_flags   = NLM_F_REQUEST;
 
-    if (vrf_setns_with_name(idl, vrf->name))
-    {
-        VLOG_ERR("Unable to set %s vrf's namespace, errno %d",
-                                      vrf->name, errno);
+    req.i.ifi_family    = AF_UNSPEC;
+    req.i.ifi_index     = portd_if_nametoindex(vrf, port_name);
+
+    if (req.i.ifi_index == 0) {
+        VLOG_ERR("Unable to get ifindex for interface: %s", port_name);
         return;
     }
 
-    /* By default value in this file is set to 0,
+    af_spec = NLMSG_TAIL(&req.n);
+    af_spec->rta_type = IFLA_AF_SPEC;
+    req.n.nlmsg_len = NLMSG_ALIGN(req.n.nlmsg_len) + RTA_LENGTH(0);
+
+    af_inet = NLMSG_TAIL(&req.n);
+    af_inet->rta_type = AF_INET;
+    req.n.nlmsg_len += RTA_LENGTH(0);
+
+    inet_conf = NLMSG_TAIL(&req.n);
+    inet_conf->rta_type = IFLA_INET_CONF;
+    req.n.nlmsg_len += RTA_LENGTH(0);
+
+    /* By default value is set to 0,
      * Changing value to one to enable source routing support on a port,
      * when routing is enabled.
      */
-    nbytes = snprintf(buf, 2, "%d", enable);
+    rta = NLMSG_TAIL(&req.n);
+    rta->rta_type = IPV4_DEVCONF_ACCEPT_SOURCE_ROUTE;
+    rta->rta_len = RTA_LENGTH(sizeof(value));
+    memcpy(RTA_DATA(rta), &value, sizeof(value));
+    req.n.nlmsg_len += RTA_ALIGN(rta->rta_len);
 
-    if ((fd = open(filename, O_WRONLY)) == -1) {
-        VLOG_ERR("Unable to open %s (%s)", filename, strerror(errno));
-        goto cleanup;
-    }
-    if (write(fd, buf, nbytes) == -1) {
-        VLOG_ERR("Unable to write to %s (%s)", filename, strerror(errno));
-    }
-    close(fd);
+    inet_conf->rta_len = (char *) NLMSG_TAIL(&req.n) - (char *) inet_conf;
+    af_inet->rta_len = (char *) NLMSG_TAIL(&req.n) - (char *) af_inet;
+    af_spec->rta_len = (char *) NLMSG_TAIL(&req.n) - (char *) af_spec;
 
-    VLOG_DBG("%s ipv4 source route", (enable == 1 ? "Enabled" : "Disabled"));
-cleanup:
-    if (vrf_setns_with_name(idl, DEFAULT_VRF_NAME))
-    {
-        VLOG_ERR("Unable to set %s vrf's old namespace, errno %d",
-                                      vrf->name, errno);
+    if (portd_nl_batch_add(NL_SOCK(vrf), &req.n, port_name) == -1) {
+        VLOG_ERR("Netlink failed to set source routing on %s", port_name);
+        return;
     }
-    return;
+
+    VLOG_DBG("%s ipv4 source route on %s",
+             (enable == 1 ? "Enabled" : "Disabled"), port_name);
 }
 
 /* Take care of add/delete/modify of v4/v6 address from db */
@@ -272,22 +320,22 @@ portd_reconfig_ipaddr(struct port *port, struct ovsrec_port *port_row)
     if (port_row->ip4_address) {
         if (port->ip4_address) {
             if (strcmp(port->ip4_address, port_row->ip4_address) != 0) {
-                portd_set_ipaddr(RTM_DELADDR, port->name, port->ip4_address,
+                portd_set_ipaddr(RTM_DELADDR, port, port->ip4_address,
                                  AF_INET, false);
                 SAFE_FREE(port->ip4_address);
 
                 port->ip4_address = xstrdup(port_row->ip4_address);
-                portd_set_ipaddr(RTM_NEWADDR, port->name, port->ip4_address,
+                portd_set_ipaddr(RTM_NEWADDR, port, port->ip4_address,
                                  AF_INET, false);
             }
         } else {
             port->ip4_address = xstrdup(port_row->ip4_address);
-            portd_set_ipaddr(RTM_NEWADDR, port->name, port->ip4_address,
+            portd_set_ipaddr(RTM_NEWADDR, port, port->ip4_address,
                              AF_INET, false);
         }
     } else {
         if (port->ip4_address != NULL) {
-            portd_set_ipaddr(RTM_DELADDR, port->name, port->ip4_address,
+            portd_set_ipaddr(RTM_DELADDR, port, port->ip4_address,
                              AF_INET, false);
             SAFE_FREE(port->ip4_address);
             port->ip4_address = NULL;
@@ -297,22 +345,22 @@ portd_reconfig_ipaddr(struct port *port, struct ovsrec_port *port_row)
     if (port_row->ip6_address) {
         if (port->ip6_address) {
             if (strcmp(port->ip6_address, port_row->ip6_address) !=0) {
-                portd_set_ipaddr(RTM_DELADDR, port->name, port->ip6_address,
+                portd_set_ipaddr(RTM_DELADDR, port, port->ip6_address,
                                  AF_INET6, false);
                 SAFE_FREE(port->ip6_address);
 
                 port->ip6_address = xstrdup(port_row->ip6_address);
-                portd_set_ipaddr(RTM_NEWADDR, port->name, port->ip6_address,
+                portd_set_ipaddr(RTM_NEWADDR, port, port->ip6_address,
                                  AF_INET6, false);
             }
         } else {
             port->ip6_address = xstrdup(port_row->ip6_address);
-            portd_set_ipaddr(RTM_NEWADDR, port->name, port->ip6_address,
+            portd_set_ipaddr(RTM_NEWADDR, port, port->ip6_address,
                              AF_INET6, false);
         }
     } else {
         if (port->ip6_address != NULL) {
-            portd_set_ipaddr(RTM_DELADDR, port->name, port->ip6_address,
+            portd_set_ipaddr(RTM_DELADDR, port, port->ip6_address,
                              AF_INET6, false);
             SAFE_FREE(port->ip6_address);
             port->ip6_address = NULL;
@@ -322,14 +370,18 @@ portd_reconfig_ipaddr(struct port *port, struct ovsrec_port *port_row)
     /*
      * Configure secondary network addresses
      */
-    if (OVSREC_IDL_IS_COLUMN_MODIFIED(ovsrec_port_col_ip4_address_secondary,
-                                      idl_seqno) ) {
+    /* A port created for a row that did not change, e.g. when it moves to
+     * another VRF, has its secondary addresses to configure as well. */
+    if (PORTD_IDL_COL_CHANGED(port_row, port, ip4_address_secondary) ||
+        (hmap_is_empty(&port->secondary_ip4addr) &&
+         port_row->n_ip4_address_secondary)) {
         VLOG_DBG("ip4_address_secondary modified");
         portd_config_secondary_ipv4_addr(port, port_row);
     }
 
-    if (OVSREC_IDL_IS_COLUMN_MODIFIED(ovsrec_port_col_ip6_address_secondary,
-                                      idl_seqno) ) {
+    if (PORTD_IDL_COL_CHANGED(port_row, port, ip6_address_secondary) ||
+        (hmap_is_empty(&port->secondary_ip6addr) &&
+         port_row->n_ip6_address_secondary)) {
         VLOG_DBG("ip6_address_secondary modified");
         portd_config_secondary_ipv6_addr(port, port_row);
     }
@@ -348,80 +400,60 @@ portd_del_ipaddr(struct port *port)
 
 /*
  * Parse the Netlink response for ip address dump request.
+ * Interface names are resolved in the namespace of 'vrf'.
  */
 void
-parse_nl_ip_address_msg_on_init(struct nlmsghdr *nlh, int msglen,
+parse_nl_ip_address_msg_on_init(struct vrf *vrf,
+                                const struct portd_nl_addr_msg *msg,
                                 struct shash *kernel_port_list)
 {
-    struct rtattr *rta;
-    struct ifaddrmsg *ifa;
-    int rtalen;
+    const struct ifaddrmsg *ifa = msg->ifa;
+    const struct rtattr *rta = msg->tb[IFA_ADDRESS];
     char ifname[IF_NAMESIZE];
+    const char *cached_name;
     char recvip[INET6_ADDRSTRLEN];
     char ip_address[INET6_PREFIX_SIZE];
     struct kernel_port *port;
     struct net_address *addr;
-    bool add_to_list = false;
+    bool ipv6;
 
-    while (NLMSG_OK(nlh, msglen)) {
-        port = NULL;
-        ifa = (struct ifaddrmsg *)NLMSG_DATA(nlh);
-        rta = (struct rtattr *)IFA_RTA(ifa);
-        rtalen = IFA_PAYLOAD(nlh);
+    if (!rta ||
+        (ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6)) {
+        return;
+    }
+    ipv6 = ifa->ifa_family == AF_INET6;
 
-        memset(ifname, 0, sizeof(ifname));
+    memset(ifname, 0, sizeof(ifname));
+    cached_name = portd_nl_ifindex_to_name(NL_SOCK(vrf), ifa->ifa_index);
+    if (cached_name) {
+        ovs_strlcpy(ifname, cached_name, sizeof(ifname));
+    } else if (!vrf) {
         if_indextoname(ifa->ifa_index, ifname);
-        VLOG_DBG("Interface = %s\n",ifname);
+    }
+    VLOG_DBG("Interface = %s\n",ifname);
 
-        if (!strcmp(ifname, LOOPBACK_INTERFACE_NAME)) {
-            nlh = NLMSG_NEXT(nlh, msglen);
-            continue;
-        }
+    if (!strcmp(ifname, LOOPBACK_INTERFACE_NAME)) {
+        return;
+    }
+    if (ipv6 && ifa->ifa_scope == IPV6_ADDR_SCOPE_LINK) {
+        VLOG_DBG("Link Local IPv6 address. Do nothing.");
+        return;
+    }
 
-        for (; RTA_OK(rta, rtalen); rta = RTA_NEXT(rta, rtalen)) {
-            memset(ip_address, 0, sizeof(ip_address));
-            if (rta->rta_type == IFA_ADDRESS){
-                memset(recvip, 0, sizeof(recvip));
-                if (ifa->ifa_family == AF_INET) {
-                    inet_ntop(AF_INET, RTA_DATA(rta), recvip,
-                            INET_ADDRSTRLEN);
-                    snprintf(ip_address, INET6_PREFIX_SIZE,
-                            "%s/%d",recvip,ifa->ifa_prefixlen);
-                    VLOG_DBG("Netlink message has IPv4 addr : %s",ip_address);
-                    port = find_or_create_kernel_port(kernel_port_list, ifname);
-                    if (!portd_kernel_ip_addr_lookup(port, ip_address, false)) {
-                        addr = xzalloc(sizeof *addr);
-                        addr->address = xstrdup(ip_address);
-                        hmap_insert(&port->ip4addr, &addr->addr_node,
-                                    hash_string(addr->address, 0));
-                        add_to_list = true;
-                    }
-                } else if (ifa->ifa_family == AF_INET6) {
-                    inet_ntop(AF_INET6, RTA_DATA(rta), recvip,
-                            INET6_ADDRSTRLEN);
-                    snprintf(ip_address, INET6_PREFIX_SIZE,
-                            "%s/%d",recvip,ifa->ifa_prefixlen);
-                    if (ifa->ifa_scope == IPV6_ADDR_SCOPE_LINK) {
-                        VLOG_DBG("Link Local IPv6 address. Do nothing.");
-                        break;
-                    }
-                    VLOG_DBG("Netlink message has IPv6 addr : %s",ip_address);
-                    port = find_or_create_kernel_port(kernel_port_list, ifname);
-                    if (!portd_kernel_ip_addr_lookup(port, ip_address, true)) {
-                        addr = xzalloc(sizeof *addr);
-                        addr->address = xstrdup(ip_address);
-                        hmap_insert(&port->ip6addr, &addr->addr_node,
-                                hash_string(addr->address, 0));
-                        add_to_list = true;
-                    }
-                }
-            }
-        }
-        if (add_to_list) {
-            shash_add_once(kernel_port_list, ifname, port);
-            add_to_list = false;
-        }
-        nlh = NLMSG_NEXT(nlh, msglen);
+    memset(recvip, 0, sizeof(recvip));
+    inet_ntop(ifa->ifa_family, RTA_DATA(rta), recvip, sizeof(recvip));
+    snprintf(ip_address, INET6_PREFIX_SIZE,
+             "%s/%d",recvip,ifa->ifa_prefixlen);
+    VLOG_DBG("Netlink message has IPv%c addr : %s", ipv6 ? '6' : '4',
+             ip_address);
+
+    port = find_or_create_kernel_port(kernel_port_list, ifname);
+    if (!portd_kernel_ip_addr_lookup(port, ip_address, ipv6)) {
+        addr = xzalloc(sizeof *addr);
+        addr->address = xstrdup(ip_address);
+        hmap_insert(ipv6 ? &port->ip6addr : &port->ip4addr,
+                    &addr->addr_node, hash_string(addr->address, 0));
+        shash_add_once(kernel_port_list, ifname, port);
     }
 }
 
@@ -496,91 +528,189 @@ portd_ipaddr_config_on_init(void)
                      " from kernel", kernel_port->name);
             HMAP_FOR_EACH_SAFE(addr, next_addr, addr_node,
                                &kernel_port->ip4addr) {
-                portd_set_ipaddr(RTM_DELADDR, kernel_port->name,
+                nl_ip_address_request(RTM_DELADDR, NULL, kernel_port->name,
                         addr->address, AF_INET, false);
             }
 
             HMAP_FOR_EACH_SAFE(addr, next_addr, addr_node,
                                &kernel_port->ip6addr) {
-                portd_set_ipaddr(RTM_DELADDR, kernel_port->name,
+                nl_ip_address_request(RTM_DELADDR, NULL, kernel_port->name,
                         addr->address, AF_INET6, false);
             }
         }
         else {
-            /* Remove all the IP addresses from the kernel that are not
-             * present in the DB */
-            HMAP_FOR_EACH_SAFE(addr, next_addr, addr_node,
-                               &kernel_port->ip4addr) {
-                if (!portd_find_ip_addr_db(db_port,
-                        addr->address, false)) {
-                    portd_set_ipaddr(RTM_DELADDR, db_port->name,
-                            addr->address, AF_INET, false);
-                }
-            }
-
-            HMAP_FOR_EACH_SAFE(addr, next_addr, addr_node,
-                               &kernel_port->ip6addr) {
-                if (!portd_find_ip_addr_db(db_port,
-                        addr->address, true)) {
-                    portd_set_ipaddr(RTM_DELADDR, db_port->name,
-                            addr->address, AF_INET6, false);
-                }
-            }
-
-            /* Check for IP addresses which are not present and add them */
-            if (db_port->ip4_address) {
-                if (!portd_find_ip_addr_kernel(kernel_port,
-                        db_port->ip4_address, false)) {
-                    portd_set_ipaddr(RTM_NEWADDR, db_port->name,
-                            db_port->ip4_address, AF_INET, false);
-                }
-            }
-            if (db_port->ip6_address) {
-                if (!portd_find_ip_addr_kernel(kernel_port,
-                        db_port->ip6_address, true)) {
-                    portd_set_ipaddr(RTM_NEWADDR, db_port->name,
-                            db_port->ip6_address, AF_INET6, false);
-                }
-            }
-            HMAP_FOR_EACH_SAFE(addr, next_addr, addr_node,
-                               &db_port->secondary_ip4addr) {
-                if (!portd_find_ip_addr_kernel(kernel_port,
-                        addr->address, false)) {
-                    portd_set_ipaddr(RTM_NEWADDR, db_port->name,
-                            addr->address, AF_INET, true);
-                }
-            }
-            HMAP_FOR_EACH_SAFE(addr, next_addr, addr_node,
-                               &db_port->secondary_ip6addr) {
-                if (!portd_find_ip_addr_kernel(kernel_port,
-                        addr->address, true)) {
-                    portd_set_ipaddr(RTM_NEWADDR, db_port->name,
-                            addr->address, AF_INET6, true);
-                }
-            }
+            /* The addresses were dumped from the default namespace. */
+            portd_ipaddr_sync_port(NULL, db_port, kernel_port);
             /* Add DB port to local cache to avoid
              * reconfiguration in kernel */
-            portd_add_port_to_cache(db_port);
+            portd_port_insert(db_port);
         }
 
          /* Free kernel port */
-        hmap_destroy(&kernel_port->ip4addr);
-        hmap_destroy(&kernel_port->ip6addr);
-        SAFE_FREE(kernel_port->name);
-        SAFE_FREE(kernel_port);
+        portd_kernel_port_free(kernel_port);
         kernel_port = NULL;
     }
     shash_destroy(&kernel_port_list);
     shash_destroy(&db_port_list);
 }
 
+/*
+ * Deletes the IP addresses of 'kernel_port' that are not configured on
+ * 'db_port' from the kernel, and adds the missing ones, through the netlink
+ * socket of 'vrf' (the default one if NULL).
+ */
+static void
+portd_ipaddr_sync_port(struct vrf *vrf, struct port *db_port,
+                       struct kernel_port *kernel_port)
+{
+    struct net_address *addr, *next_addr;
+
+    /* Remove all the IP addresses from the kernel that are not
+     * present in the DB */
+    HMAP_FOR_EACH_SAFE(addr, next_addr, addr_node,
+                       &kernel_port->ip4addr) {
+        if (!portd_find_ip_addr_db(db_port,
+                addr->address, false)) {
+            nl_ip_address_request(RTM_DELADDR, vrf, db_port->name,
+                    addr->address, AF_INET, false);
+        }
+    }
+
+    HMAP_FOR_EACH_SAFE(addr, next_addr, addr_node,
+                       &kernel_port->ip6addr) {
+        if (!portd_find_ip_addr_db(db_port,
+                addr->address, true)) {
+            nl_ip_address_request(RTM_DELADDR, vrf, db_port->name,
+                    addr->address, AF_INET6, false);
+        }
+    }
+
+    /* Check for IP addresses which are not present and add them */
+    if (db_port->ip4_address) {
+        if (!portd_find_ip_addr_kernel(kernel_port,
+                db_port->ip4_address, false)) {
+            nl_ip_address_request(RTM_NEWADDR, vrf, db_port->name,
+                    db_port->ip4_address, AF_INET, false);
+        }
+    }
+    if (db_port->ip6_address) {
+        if (!portd_find_ip_addr_kernel(kernel_port,
+                db_port->ip6_address, true)) {
+            nl_ip_address_request(RTM_NEWADDR, vrf, db_port->name,
+                    db_port->ip6_address, AF_INET6, false);
+        }
+    }
+    HMAP_FOR_EACH_SAFE(addr, next_addr, addr_node,
+                       &db_port->secondary_ip4addr) {
+        if (!portd_find_ip_addr_kernel(kernel_port,
+                addr->address, false)) {
+            nl_ip_address_request(RTM_NEWADDR, vrf, db_port->name,
+                    addr->address, AF_INET, true);
+        }
+    }
+    HMAP_FOR_EACH_SAFE(addr, next_addr, addr_node,
+                       &db_port->secondary_ip6addr) {
+        if (!portd_find_ip_addr_kernel(kernel_port,
+                addr->address, true)) {
+            nl_ip_address_request(RTM_NEWADDR, vrf, db_port->name,
+                    addr->address, AF_INET6, true);
+        }
+    }
+}
+
+static void
+portd_kernel_port_free(struct kernel_port *kernel_port)
+{
+    struct net_address *addr, *next_addr;
+
+    HMAP_FOR_EACH_SAFE (addr, next_addr, addr_node, &kernel_port->ip4addr) {
+        SAFE_FREE(addr->address);
+        SAFE_FREE(addr);
+    }
+    HMAP_FOR_EACH_SAFE (addr, next_addr, addr_node, &kernel_port->ip6addr) {
+        SAFE_FREE(addr->address);
+        SAFE_FREE(addr);
+    }
+    hmap_destroy(&kernel_port->ip4addr);
+    hmap_destroy(&kernel_port->ip6addr);
+    SAFE_FREE(kernel_port->name);
+    SAFE_FREE(kernel_port);
+}
+
+/*
+ * Checks the IP addresses of the L3 ports of 'vrf' against the kernel after
+ * notifications from its namespace were lost.  The addresses are dumped on
+ * 'cmd_sock', a netlink socket of the namespace with no request pending.
+ * Unlike on init, interfaces portd does not manage are left alone.
+ */
+void
+portd_ipaddr_resync(struct vrf *vrf, int cmd_sock)
+{
+    static const int families[] = { AF_INET, AF_INET6 };
+    struct shash kernel_port_list;
+    struct shash_node *node, *next;
+    struct port *port;
+    size_t i;
+
+    shash_init(&kernel_port_list);
+    if (portd_nl_dump_filtered()) {
+        /* Only dump the addresses of the interfaces of the vrf's ports. */
+        HMAP_FOR_EACH (port, port_node, &vrf->ports) {
+            unsigned int ifindex = portd_if_nametoindex(vrf, port->name);
+
+            if (ifindex &&
+                !portd_nl_dump_request(cmd_sock, RTM_GETADDR, AF_UNSPEC,
+                                       ifindex)) {
+                nl_msg_process(&kernel_port_list, vrf, cmd_sock, true);
+            }
+        }
+    } else {
+        for (i = 0; i < ARRAY_SIZE(families); i++) {
+            if (portd_nl_dump_request(cmd_sock, RTM_GETADDR, families[i],
+                                      0)) {
+                goto out;
+            }
+            nl_msg_process(&kernel_port_list, vrf, cmd_sock, true);
+        }
+    }
+
+    HMAP_FOR_EACH (port, port_node, &vrf->ports) {
+        struct kernel_port *kernel_port;
+
+        kernel_port = find_or_create_kernel_port(&kernel_port_list,
+                                                 port->name);
+        portd_ipaddr_sync_port(vrf, port, kernel_port);
+        if (!shash_find(&kernel_port_list, port->name)) {
+            portd_kernel_port_free(kernel_port);
+        }
+    }
+
+out:
+    SHASH_FOR_EACH_SAFE (node, next, &kernel_port_list) {
+        portd_kernel_port_free(node->data);
+    }
+    shash_destroy(&kernel_port_list);
+}
+
 /* FIXME - ipv6 secondary address also shows up as primary
  *         in 'ip -6 addr show' - fix */
 
 /* Function to send netlink message to add ip address to kernel */
 void
-nl_add_ip_address(int cmd, const char *port_name, char *ip_address,
+nl_add_ip_address(int cmd, const struct port *port, char *ip_address,
                   int family, bool secondary)
+{
+    nl_ip_address_request(cmd, port->vrf, port->name, ip_address, family,
+                          secondary);
+}
+
+/*
+ * Adds or deletes, as per 'cmd', 'ip_address' on the interface 'port_name'
+ * of the namespace of 'vrf', the default one if 'vrf' is NULL.
+ */
+static void
+nl_ip_address_request(int cmd, struct vrf *vrf, const char *port_name,
+                      char *ip_address, int family, bool secondary)
 {
     int buflen;
     struct rtattr *rta;
@@ -593,7 +723,6 @@ nl_add_ip_address(int cmd, const char *port_name, char *ip_address,
     struct in_addr ipv4;
     struct in6_addr ipv6;
     unsigned char prefixlen, *ipaddr = NULL;
-    struct vrf *vrf = get_vrf_for_port(port_name);
 
     memset (&req, 0, sizeof(req));
 
@@ -643,9 +772,9 @@ nl_add_ip_address(int cmd, const char *port_name, char *ip_address,
     memcpy(RTA_DATA(rta), ipaddr, bytelen);
     req.n.nlmsg_len = NLMSG_ALIGN(req.n.nlmsg_len) + RTA_ALIGN(buflen);
 
-    if (send(NL_SOCK(vrf), &req, req.n.nlmsg_len, 0) == -1) {
-        VLOG_ERR("Netlink failed to set IP address for '%s' (%s)",
-                 ip_address, strerror(errno));
+    if (portd_nl_batch_add(NL_SOCK(vrf), &req.n, port_name) == -1) {
+        VLOG_ERR("Netlink failed to set IP address for '%s'",
+                 ip_address);
         return;
     }
 
@@ -660,21 +789,22 @@ nl_add_ip_address(int cmd, const char *port_name, char *ip_address,
  * Function: portd_add_vlan_interface
  * Param:
  *      interface_name: "Parent" interface on which vlan interface is created.
- *      vlan_interface_name: Name of VLAN interface to be created.
+ *      port: Port of the VLAN interface to be created.
  *      vlan_tag: VLAN id.
  * Return:
  * Desc:
- *      Insert VLAN interface <vlan_interface_name> on top of <interface_name>
- *      with VLAN tag <vlan_tag>
+ *      Insert VLAN interface <port->name> on top of <interface_name>
+ *      with VLAN tag <vlan_tag>, in the namespace of the port's vrf.
  */
 void
 portd_add_vlan_interface(const char *interface_name,
-                         const char *vlan_interface_name,
+                         const struct port *port,
                          const unsigned short vlan_tag)
 {
     int ifindex;
     int i;
-    struct vrf *vrf = get_vrf_for_port(vlan_interface_name);
+    struct vrf *vrf = port->vrf;
+    const char *vlan_interface_name = port->name;
 
     struct {
         struct nlmsghdr  n;
@@ -725,9 +855,10 @@ portd_add_vlan_interface(const char *interface_name,
     add_link_attr(&req.n, sizeof(req), IFLA_IFNAME, vlan_interface_name,
                   strlen(vlan_interface_name)+1);
 
-    if (send(NL_SOCK(vrf), &req, req.n.nlmsg_len, 0) == -1) {
-        VLOG_ERR("Netlink failed to create vlan interface: %s (%s)",
-                 vlan_interface_name, strerror(errno));
+    if (portd_nl_batch_add(NL_SOCK(vrf), &req.n,
+                           vlan_interface_name) == -1) {
+        VLOG_ERR("Netlink failed to create vlan interface: %s",
+                 vlan_interface_name);
         return;
     }
 }
@@ -771,27 +902,20 @@ portd_del_vlan_interface(const char *vlan_interface_name)
         return;
     }
 
-    if (send(NL_SOCK(vrf), &req, req.n.nlmsg_len, 0) == -1) {
-        VLOG_ERR("Netlink failed to delete vlan interface: %s (%s)",
-                 vlan_interface_name, strerror(errno));
+    if (portd_nl_batch_add(NL_SOCK(vrf), &req.n,
+                           vlan_interface_name) == -1) {
+        VLOG_ERR("Netlink failed to delete vlan interface: %s",
+                 vlan_interface_name);
         return;
     }
 }
 
+/* Returns the vrf of the port named 'port_name', NULL if no vrf has it. */
 struct vrf* get_vrf_for_port(const char *port_name)
 {
-  struct vrf *vrf = NULL;
-  struct port *port = NULL;
-
-  HMAP_FOR_EACH (vrf, node, &all_vrfs) {
-     HMAP_FOR_EACH (port, port_node,
-                             &vrf->ports) {
-        if (!strcmp(port->name, port_name)) {
-            return vrf;
-        }
-     }
-  }
-  return NULL;
+    struct port *port = portd_port_find(port_name);
+
+    return port ? port->vrf : NULL;
 }
 
 /* return ipv4/ipv6 prefix and prefix length */
@@ -850,10 +974,10 @@ portd_get_prefix(int family, char *ip_address, void *prefix,
 
 /* Set IP address on Linux interface using netlink sockets */
 static void
-portd_set_ipaddr(int cmd, const char *port_name, char *ip_address,
+portd_set_ipaddr(int cmd, const struct port *port, char *ip_address,
                  int family, bool secondary)
 {
-    nl_add_ip_address(cmd, port_name, ip_address, family, secondary);
+    nl_add_ip_address(cmd, port, ip_address, family, secondary);
 }
 
 static struct net_address*
@@ -977,7 +1101,7 @@ portd_config_secondary_ipv6_addr(struct port *port,
     HMAP_FOR_EACH_SAFE (addr, next, addr_node, &port->secondary_ip6addr) {
         if (!shash_find_data(&new_ip6_list, addr->address)) {
             hmap_remove(&port->secondary_ip6addr, &addr->addr_node);
-            portd_set_ipaddr(RTM_DELADDR, port->name, addr->address,
+            portd_set_ipaddr(RTM_DELADDR, port, addr->address,
                              AF_INET6, true);
             SAFE_FREE(addr->address);
             SAFE_FREE(addr);
@@ -998,7 +1122,7 @@ portd_config_secondary_ipv6_addr(struct port *port,
             addr->address = xstrdup(address);
             hmap_insert(&port->secondary_ip6addr, &addr->addr_node,
                         hash_string(addr->address, 0));
-            portd_set_ipaddr(RTM_NEWADDR, port->name, addr->address,
+            portd_set_ipaddr(RTM_NEWADDR, port, addr->address,
                              AF_INET6, true);
         }
     }
@@ -1036,7 +1160,7 @@ portd_config_secondary_ipv4_addr(struct port *port,
     HMAP_FOR_EACH_SAFE (addr, next, addr_node, &port->secondary_ip4addr) {
         if (!shash_find_data(&new_ip_list, addr->address)) {
             hmap_remove(&port->secondary_ip4addr, &addr->addr_node);
-            portd_set_ipaddr(RTM_DELADDR, port->name, addr->address,
+            portd_set_ipaddr(RTM_DELADDR, port, addr->address,
                              AF_INET, true);
             SAFE_FREE(addr->address);
             SAFE_FREE(addr);
@@ -1057,7 +1181,7 @@ portd_config_secondary_ipv4_addr(struct port *port,
             addr->address = xstrdup(address);
             hmap_insert(&port->secondary_ip4addr, &addr->addr_node,
                         hash_string(addr->address, 0));
-            portd_set_ipaddr(RTM_NEWADDR, port->name, addr->address,
+            portd_set_ipaddr(RTM_NEWADDR, port, addr->address,
                              AF_INET, true);
         }
     }
@@ -1078,12 +1202,12 @@ portd_del_ipv4_addr(struct port *port)
     }
 
     if (port->ip4_address) {
-        portd_set_ipaddr(RTM_DELADDR, port->name, port->ip4_address,
+        portd_set_ipaddr(RTM_DELADDR, port, port->ip4_address,
                          AF_INET, false);
     }
 
     HMAP_FOR_EACH_SAFE (addr, next_addr, addr_node, &port->secondary_ip4addr) {
-        portd_set_ipaddr(RTM_DELADDR, port->name, addr->address,
+        portd_set_ipaddr(RTM_DELADDR, port, addr->address,
                          AF_INET, true);
     }
 }
@@ -1103,12 +1227,12 @@ portd_del_ipv6_addr(struct port *port)
     }
 
     if (port->ip6_address) {
-        portd_set_ipaddr(RTM_DELADDR, port->name, port->ip6_address,
+        portd_set_ipaddr(RTM_DELADDR, port, port->ip6_address,
                          AF_INET6, false);
     }
 
     HMAP_FOR_EACH_SAFE (addr, next_addr, addr_node, &port->secondary_ip6addr) {
-        portd_set_ipaddr(RTM_DELADDR, port->name, addr->address,
+        portd_set_ipaddr(RTM_DELADDR, port, addr->address,
                          AF_INET6, true);
     }
 }
@@ -1205,36 +1329,14 @@ portd_kernel_ip_addr_lookup(struct kernel_port *kernel_port,
 static void
 portd_populate_kernel_ip_addr(int family, struct shash *kernel_port_list)
 {
-    struct rtattr *rta;
-    int bytelen;
-    struct {
-        struct nlmsghdr n;
-        struct ifaddrmsg ifa;
-    } req;
-
-    memset (&req, 0, sizeof(req));
-
-    bytelen = (family == AF_INET ? 4 : 16);
-
-    req.n.nlmsg_len = NLMSG_LENGTH (sizeof (struct ifaddrmsg));
-    req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
-
-    req.n.nlmsg_type = RTM_GETADDR;
-
-    req.ifa.ifa_family = family;
-    rta = (struct rtattr *)(((char *)&req) + NLMSG_ALIGN(req.n.nlmsg_len));
-    rta->rta_len = RTA_LENGTH(bytelen);
-
-    if (send(init_sock, &req, req.n.nlmsg_len, 0) == -1) {
-        VLOG_ERR("Netlink failed to send message for IP addr dump (%s)",
-                 strerror(errno));
+    if (portd_nl_dump_request(init_sock, RTM_GETADDR, family, 0)) {
         return;
     }
     VLOG_DBG("Netlink %s addr dump command sent",
             family == AF_INET? "IPv4" : "IPv6");
 
     /* Process the response from kernel */
-    nl_msg_process(kernel_port_list, init_sock, true);
+    nl_msg_process(kernel_port_list, NULL, init_sock, true);
 }
 
 /*
@@ -1295,9 +1397,7 @@ portd_populate_db_ip_addr(struct shash *db_port_list,
                 hmap_insert(&db_port->secondary_ip6addr, &addr->addr_node,
                         hash_string(addr->address, 0));
             }
-            if (portd_interface_type_internal_check(port_row, port_row->name) &&
-                portd_port_in_bridge_check(port_row->name, DEFAULT_BRIDGE_NAME) &&
-                portd_port_in_vrf_check(port_row->name, DEFAULT_VRF_NAME)) {
+            if (portd_port_is_intervlan(port_row)) {
                 db_port->type = xstrdup(OVSREC_INTERFACE_TYPE_INTERNAL);;
             } else {
                 db_port->type = NULL;
@@ -1308,23 +1408,3 @@ portd_populate_db_ip_addr(struct shash *db_port_list,
         }
     }
 }
-
-/*
- * This function is used to add a port to the local cache
- * after processing it for IP addresses cleanup. This will ensure
- * that the interface does not get reconfigured.
- */
-static void
-portd_add_port_to_cache(struct port *port)
-{
-    struct vrf *vrf, *next_vrf;
-    size_t i;
-    HMAP_FOR_EACH_SAFE (vrf, next_vrf, node, &all_vrfs) {
-        for (i = 0; i < vrf->cfg->n_ports; i++) {
-            if (!strcmp(vrf->cfg->ports[i]->name, port->name)) {
-                hmap_insert(&vrf->ports, &port->port_node,
-                        hash_string(port->name, 0));
-            }
-        }
-    }
-}
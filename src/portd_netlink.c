@@ -0,0 +1,1714 @@
+/*
+ * (c) Copyright 2016 Hewlett Packard Enterprise Development LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+/***************************************************************************
+ *    File               : portd_netlink.c
+ *    Description        : Per namespace rtnetlink state. Queues the requests
+ *                           generated during a reconfigure pass and sends
+ *                           them in a few large writes, and caches interface
+ *                           indexes learnt from link notifications.
+ ***************************************************************************/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <net/if.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <linux/net_namespace.h>
+#include <linux/rtnetlink.h>
+#include <linux/sockios.h>
+
+#include "coverage.h"
+#include "dynamic-string.h"
+#include "hash.h"
+#include "hmap.h"
+#include "shash.h"
+#include "util.h"
+#include "openvswitch/vlog.h"
+#include "poll-loop.h"
+#include "timeval.h"
+
+#include "portd.h"
+#include "portd_netlink.h"
+
+VLOG_DEFINE_THIS_MODULE(portd_netlink);
+
+COVERAGE_DEFINE(portd_nl_batch_flush);
+COVERAGE_DEFINE(portd_nl_batch_msgs);
+COVERAGE_DEFINE(portd_nl_batch_bytes);
+COVERAGE_DEFINE(portd_nl_ifindex_hit);
+COVERAGE_DEFINE(portd_nl_ifindex_miss);
+COVERAGE_DEFINE(portd_nl_recv);
+COVERAGE_DEFINE(portd_nl_recv_msgs);
+COVERAGE_DEFINE(portd_nl_recv_trunc);
+COVERAGE_DEFINE(portd_nl_overrun);
+COVERAGE_DEFINE(portd_nl_resync);
+COVERAGE_DEFINE(portd_nl_ack);
+COVERAGE_DEFINE(portd_nl_nack);
+COVERAGE_DEFINE(portd_nl_op_sent);
+COVERAGE_DEFINE(portd_nl_op_skipped);
+
+/* An address the kernel has on an interface. */
+struct portd_nl_addr {
+    struct hmap_node node;       /* In "struct portd_nl_link"'s 'addrs'. */
+    uint8_t family;
+    uint8_t prefixlen;
+    uint8_t addr[16];            /* IPv4 addresses use the first 4 bytes. */
+};
+
+/*
+ * A kernel interface known to be present in a namespace, and a shadow of its
+ * kernel state.  The shadow is updated from notifications and dumps, and
+ * from the requests portd queues, so that requests that would not change
+ * anything are not sent.
+ */
+struct portd_nl_link {
+    struct hmap_node name_node;  /* In 'links_by_name'. */
+    struct hmap_node index_node; /* In 'links_by_index'. */
+    char *name;
+    unsigned int ifindex;
+    bool stale;                  /* Not seen yet by the ongoing resync. */
+
+    /* Shadow of the kernel state, only valid if 'known' is true. */
+    bool known;
+    unsigned int flags;          /* IFF_* flags. */
+    unsigned int mtu;
+    enum portd_nl_kind kind;
+    unsigned int parent;         /* IFLA_LINK, 0 if none. */
+    uint16_t vlan_id;            /* IFLA_VLAN_ID of a "vlan" link. */
+    struct hmap addrs;           /* "struct portd_nl_addr"s. */
+};
+
+/* Per namespace netlink state.  Namespaces are identified by the socket
+ * portd receives their link notifications on, so every namespace has exactly
+ * one. */
+struct portd_nl_ns {
+    struct hmap_node node;      /* In 'nl_namespaces'. */
+    int sock;                   /* Notification socket. */
+    int cmd_sock;               /* Socket requests and queries are sent on,
+                                 * 'sock' if the namespace has none. */
+    bool replies_on_sock;       /* Replies are received on 'sock', mixed
+                                 * with the notifications. */
+
+    /* Requests queued during the current pass. */
+    char *buf;                  /* PORTD_NL_BATCH_SIZE bytes. */
+    size_t len;                 /* Bytes queued in 'buf'. */
+    unsigned int n_msgs;        /* Requests queued in 'buf'. */
+    unsigned int n_link_ops;    /* Queued link creations and deletions. */
+    unsigned int n_in_flight;   /* Requests sent and not acknowledged. */
+
+    /* Interface name to ifindex cache. */
+    struct hmap links_by_name;  /* "struct portd_nl_link"s by name. */
+    struct hmap links_by_index; /* "struct portd_nl_link"s by ifindex. */
+
+    /* Notifications lost by the kernel and resulting resyncs. */
+    unsigned long long int n_overruns;
+    unsigned long long int n_resyncs;
+
+    /* Requests queued, and requests dropped because the shadow state of
+     * the interface showed they would not change anything. */
+    unsigned long long int n_ops_sent;
+    unsigned long long int n_ops_skipped;
+};
+
+/* A request queued or sent, waiting for its acknowledgement. */
+struct portd_nl_req {
+    struct hmap_node node;      /* In 'nl_requests'. */
+    uint32_t seq;               /* Sequence number of the request. */
+    int sock;                   /* Namespace of the request. */
+    uint16_t type;              /* RTM_* type of the request. */
+    unsigned int ifindex;       /* Interface the request is about, or 0. */
+    char *owner;                /* Port the request was made for, or NULL. */
+};
+
+static struct hmap nl_namespaces = HMAP_INITIALIZER(&nl_namespaces);
+static struct hmap nl_requests = HMAP_INITIALIZER(&nl_requests);
+static uint32_t nl_batch_seq;
+
+/* NETLINK_GET_STRICT_CHK is enabled on the command sockets. */
+static bool nl_strict_chk;
+
+/* "struct portd_nl_result"s by port name, for the ports whose requests
+ * were acknowledged since the results were last taken. */
+static struct shash nl_results = SHASH_INITIALIZER(&nl_results);
+
+/*
+ * Fills 'tb', an array of 'max' + 1 attributes, with the attributes of the
+ * chain of 'len' bytes starting at 'rta', indexed by type.  Attributes whose
+ * type is above 'max' are ignored, and a repeated attribute hides the
+ * previous ones.  Nothing is copied, 'tb' points into the message.
+ */
+void
+portd_nl_parse_attrs(const struct rtattr **tb, int max,
+                     const struct rtattr *rta, int len)
+{
+    memset(tb, 0, (max + 1) * sizeof *tb);
+    for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        unsigned short type = rta->rta_type & ~NLA_F_NESTED;
+
+        if (type <= max) {
+            tb[type] = rta;
+        }
+    }
+}
+
+static enum portd_nl_kind
+portd_nl_kind_from_attr(const struct rtattr *rta)
+{
+    static const struct {
+        const char *name;
+        enum portd_nl_kind kind;
+    } kinds[] = {
+        { "vlan",   PORTD_NL_KIND_VLAN },
+        { "bond",   PORTD_NL_KIND_BOND },
+        { "bridge", PORTD_NL_KIND_BRIDGE },
+    };
+    size_t len = strnlen(RTA_DATA(rta), RTA_PAYLOAD(rta));
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(kinds); i++) {
+        if (len == strlen(kinds[i].name) &&
+            !memcmp(RTA_DATA(rta), kinds[i].name, len)) {
+            return kinds[i].kind;
+        }
+    }
+    return PORTD_NL_KIND_OTHER;
+}
+
+/*
+ * Parses the RTM_NEWLINK, RTM_DELLINK or RTM_GETLINK message 'nlh' into
+ * 'msg' in a single pass over its attributes, nested IFLA_LINKINFO and the
+ * IFLA_INFO_DATA of VLAN links included.  Returns false if 'nlh' is too
+ * short to be a link message.
+ */
+bool
+portd_nl_parse_link(const struct nlmsghdr *nlh, struct portd_nl_link_msg *msg)
+{
+    int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    const struct rtattr *rta;
+
+    if (len < 0) {
+        return false;
+    }
+    msg->type = nlh->nlmsg_type;
+    msg->ifi = NLMSG_DATA(nlh);
+    portd_nl_parse_attrs(msg->tb, IFLA_MAX, IFLA_RTA(msg->ifi), len);
+
+    msg->kind = PORTD_NL_KIND_NONE;
+    rta = msg->tb[IFLA_LINKINFO];
+    if (rta) {
+        portd_nl_parse_attrs(msg->info, IFLA_INFO_MAX, RTA_DATA(rta),
+                             RTA_PAYLOAD(rta));
+        if (msg->info[IFLA_INFO_KIND]) {
+            msg->kind = portd_nl_kind_from_attr(msg->info[IFLA_INFO_KIND]);
+        }
+    } else {
+        memset(msg->info, 0, sizeof msg->info);
+    }
+
+    rta = msg->info[IFLA_INFO_DATA];
+    if (msg->kind == PORTD_NL_KIND_VLAN && rta) {
+        portd_nl_parse_attrs(msg->vlan, IFLA_VLAN_MAX, RTA_DATA(rta),
+                             RTA_PAYLOAD(rta));
+    } else {
+        memset(msg->vlan, 0, sizeof msg->vlan);
+    }
+    return true;
+}
+
+/* Parses the RTM_NEWADDR or RTM_DELADDR message 'nlh' into 'msg'.  Returns
+ * false if 'nlh' is too short to be an address message. */
+bool
+portd_nl_parse_addr(const struct nlmsghdr *nlh, struct portd_nl_addr_msg *msg)
+{
+    int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+
+    if (len < 0) {
+        return false;
+    }
+    msg->type = nlh->nlmsg_type;
+    msg->ifa = NLMSG_DATA(nlh);
+    portd_nl_parse_attrs(msg->tb, IFA_MAX, IFA_RTA(msg->ifa), len);
+    return true;
+}
+
+static struct portd_nl_ns *
+portd_nl_ns_lookup(int sock)
+{
+    struct portd_nl_ns *ns;
+
+    HMAP_FOR_EACH_WITH_HASH (ns, node, hash_int(sock, 0), &nl_namespaces) {
+        if (ns->sock == sock) {
+            return ns;
+        }
+    }
+    return NULL;
+}
+
+static struct portd_nl_ns *
+portd_nl_ns_get(int sock)
+{
+    struct portd_nl_ns *ns = portd_nl_ns_lookup(sock);
+
+    if (!ns) {
+        ns = xzalloc(sizeof *ns);
+        ns->sock = sock;
+        ns->cmd_sock = sock;
+        ns->replies_on_sock = true;
+        ns->buf = xmalloc(PORTD_NL_BATCH_SIZE);
+        hmap_init(&ns->links_by_name);
+        hmap_init(&ns->links_by_index);
+        hmap_insert(&nl_namespaces, &ns->node, hash_int(sock, 0));
+    }
+    return ns;
+}
+
+static struct portd_nl_link *
+portd_nl_link_lookup_name(const struct portd_nl_ns *ns, const char *name)
+{
+    struct portd_nl_link *link;
+
+    HMAP_FOR_EACH_WITH_HASH (link, name_node, hash_string(name, 0),
+                             &ns->links_by_name) {
+        if (!strcmp(link->name, name)) {
+            return link;
+        }
+    }
+    return NULL;
+}
+
+static struct portd_nl_link *
+portd_nl_link_lookup_index(const struct portd_nl_ns *ns, unsigned int ifindex)
+{
+    struct portd_nl_link *link;
+
+    HMAP_FOR_EACH_WITH_HASH (link, index_node, hash_int(ifindex, 0),
+                             &ns->links_by_index) {
+        if (link->ifindex == ifindex) {
+            return link;
+        }
+    }
+    return NULL;
+}
+
+/* Forgets the shadow state of 'link', until the kernel reports it again. */
+static void
+portd_nl_link_invalidate(struct portd_nl_link *link)
+{
+    struct portd_nl_addr *addr, *next;
+
+    link->known = false;
+    HMAP_FOR_EACH_SAFE (addr, next, node, &link->addrs) {
+        hmap_remove(&link->addrs, &addr->node);
+        free(addr);
+    }
+}
+
+static void
+portd_nl_link_remove(struct portd_nl_ns *ns, struct portd_nl_link *link)
+{
+    portd_nl_link_invalidate(link);
+    hmap_destroy(&link->addrs);
+    hmap_remove(&ns->links_by_name, &link->name_node);
+    hmap_remove(&ns->links_by_index, &link->index_node);
+    free(link->name);
+    free(link);
+}
+
+/* Records that 'name' has index 'ifindex' in 'ns', replacing whatever was
+ * known about either of them. */
+static void
+portd_nl_link_set(struct portd_nl_ns *ns, const char *name,
+                  unsigned int ifindex)
+{
+    struct portd_nl_link *link = portd_nl_link_lookup_index(ns, ifindex);
+    struct portd_nl_link *stale = portd_nl_link_lookup_name(ns, name);
+
+    if (link && link == stale) {
+        link->stale = false;
+        return;
+    }
+    if (stale) {
+        portd_nl_link_remove(ns, stale);
+    }
+
+    if (link) {
+        /* Interface renamed. */
+        VLOG_DBG("Interface %u renamed from %s to %s",
+                 ifindex, link->name, name);
+        hmap_remove(&ns->links_by_name, &link->name_node);
+        free(link->name);
+    } else {
+        link = xzalloc(sizeof *link);
+        link->ifindex = ifindex;
+        hmap_init(&link->addrs);
+        hmap_insert(&ns->links_by_index, &link->index_node,
+                    hash_int(ifindex, 0));
+    }
+    link->name = xstrdup(name);
+    link->stale = false;
+    hmap_insert(&ns->links_by_name, &link->name_node, hash_string(name, 0));
+}
+
+/* Updates the shadow state of 'link' from the RTM_NEWLINK message 'msg'. */
+static void
+portd_nl_link_state_update(struct portd_nl_link *link,
+                           const struct portd_nl_link_msg *msg)
+{
+    link->known = true;
+    link->flags = msg->ifi->ifi_flags;
+    link->kind = msg->kind;
+    link->mtu = msg->tb[IFLA_MTU] ? PORTD_NL_ATTR_U32(msg->tb[IFLA_MTU]) : 0;
+    link->parent = msg->tb[IFLA_LINK] ? PORTD_NL_ATTR_U32(msg->tb[IFLA_LINK])
+                                      : 0;
+    link->vlan_id = msg->vlan[IFLA_VLAN_ID] ?
+                    PORTD_NL_ATTR_U16(msg->vlan[IFLA_VLAN_ID]) : 0;
+}
+
+/* Extracts the interface address of the RTM_NEWADDR or RTM_DELADDR message
+ * 'msg' into 'addr'.  Returns false if it has none. */
+static bool
+portd_nl_addr_from_msg(const struct portd_nl_addr_msg *msg,
+                       struct portd_nl_addr *addr)
+{
+    /* IPv6 notifications only carry IFA_ADDRESS. */
+    const struct rtattr *rta = msg->tb[IFA_LOCAL] ? msg->tb[IFA_LOCAL]
+                                                  : msg->tb[IFA_ADDRESS];
+
+    if (!rta || RTA_PAYLOAD(rta) > sizeof addr->addr) {
+        return false;
+    }
+
+    memset(addr, 0, sizeof *addr);
+    addr->family = msg->ifa->ifa_family;
+    addr->prefixlen = msg->ifa->ifa_prefixlen;
+    memcpy(addr->addr, RTA_DATA(rta), RTA_PAYLOAD(rta));
+    return true;
+}
+
+static uint32_t
+portd_nl_addr_hash(const struct portd_nl_addr *addr)
+{
+    return hash_bytes(addr->addr, sizeof addr->addr,
+                      (addr->family << 8) | addr->prefixlen);
+}
+
+static struct portd_nl_addr *
+portd_nl_addr_find(const struct portd_nl_link *link,
+                   const struct portd_nl_addr *key)
+{
+    struct portd_nl_addr *addr;
+
+    HMAP_FOR_EACH_WITH_HASH (addr, node, portd_nl_addr_hash(key),
+                             &link->addrs) {
+        if (addr->family == key->family &&
+            addr->prefixlen == key->prefixlen &&
+            !memcmp(addr->addr, key->addr, sizeof addr->addr)) {
+            return addr;
+        }
+    }
+    return NULL;
+}
+
+/* Adds ('type' is RTM_NEWADDR) or removes ('type' is RTM_DELADDR) 'key' in
+ * the address set of 'link'. */
+static void
+portd_nl_addr_set(struct portd_nl_link *link, int type,
+                  const struct portd_nl_addr *key)
+{
+    struct portd_nl_addr *addr = portd_nl_addr_find(link, key);
+
+    if (type == RTM_NEWADDR && !addr) {
+        addr = xmemdup(key, sizeof *key);
+        hmap_insert(&link->addrs, &addr->node, portd_nl_addr_hash(addr));
+    } else if (type == RTM_DELADDR && addr) {
+        hmap_remove(&link->addrs, &addr->node);
+        free(addr);
+    }
+}
+
+/*
+ * Returns true if request 'nlh' of namespace 'ns' would leave the kernel
+ * state unchanged according to the shadow state.  Only link flag and MTU
+ * changes, VLAN interface creations and address additions are checked;
+ * other requests are always sent.
+ */
+static bool
+portd_nl_shadow_match(struct portd_nl_ns *ns, const struct nlmsghdr *nlh)
+{
+    struct portd_nl_link *link;
+
+    if (nlh->nlmsg_type == RTM_NEWLINK) {
+        struct portd_nl_link_msg msg;
+        const char *name;
+        int type;
+
+        if (!portd_nl_parse_link(nlh, &msg)) {
+            return false;
+        }
+        name = PORTD_NL_ATTR_STR(msg.tb[IFLA_IFNAME]);
+        link = msg.ifi->ifi_index
+               ? portd_nl_link_lookup_index(ns, msg.ifi->ifi_index)
+               : name ? portd_nl_link_lookup_name(ns, name) : NULL;
+        if (!link || !link->known ||
+            (link->flags ^ msg.ifi->ifi_flags) & msg.ifi->ifi_change) {
+            return false;
+        }
+
+        for (type = 0; type <= IFLA_MAX; type++) {
+            if (!msg.tb[type]) {
+                continue;
+            }
+            switch (type) {
+            case IFLA_IFNAME:
+            case IFLA_LINK:
+            case IFLA_LINKINFO:
+                break;
+            case IFLA_MTU:
+                if (PORTD_NL_ATTR_U32(msg.tb[IFLA_MTU]) != link->mtu) {
+                    return false;
+                }
+                break;
+            default:
+                /* Not shadowed. */
+                return false;
+            }
+        }
+
+        if (nlh->nlmsg_flags & NLM_F_CREATE) {
+            /* Only VLAN interfaces are created over netlink. */
+            return msg.kind == PORTD_NL_KIND_VLAN &&
+                   link->kind == PORTD_NL_KIND_VLAN &&
+                   msg.tb[IFLA_LINK] && msg.vlan[IFLA_VLAN_ID] &&
+                   PORTD_NL_ATTR_U32(msg.tb[IFLA_LINK]) == link->parent &&
+                   PORTD_NL_ATTR_U16(msg.vlan[IFLA_VLAN_ID]) == link->vlan_id;
+        }
+        return !msg.tb[IFLA_LINKINFO] && !msg.tb[IFLA_LINK];
+    } else if (nlh->nlmsg_type == RTM_NEWADDR) {
+        struct portd_nl_addr_msg msg;
+        struct portd_nl_addr key;
+
+        if (!portd_nl_parse_addr(nlh, &msg)) {
+            return false;
+        }
+        link = portd_nl_link_lookup_index(ns, msg.ifa->ifa_index);
+        return link && link->known && portd_nl_addr_from_msg(&msg, &key) &&
+               portd_nl_addr_find(link, &key);
+    }
+    return false;
+}
+
+/* Updates the shadow state of namespace 'ns' with the effect request 'nlh'
+ * is expected to have, the kernel notifications confirming it later.  Links
+ * created or deleted by a request are learnt from their notification. */
+static void
+portd_nl_shadow_apply(struct portd_nl_ns *ns, const struct nlmsghdr *nlh)
+{
+    struct portd_nl_link *link;
+
+    if (nlh->nlmsg_type == RTM_NEWLINK &&
+        !(nlh->nlmsg_flags & NLM_F_CREATE)) {
+        struct portd_nl_link_msg msg;
+
+        if (!portd_nl_parse_link(nlh, &msg)) {
+            return;
+        }
+        link = portd_nl_link_lookup_index(ns, msg.ifi->ifi_index);
+        if (!link || !link->known) {
+            return;
+        }
+        link->flags = (link->flags & ~msg.ifi->ifi_change) |
+                      (msg.ifi->ifi_flags & msg.ifi->ifi_change);
+        if (msg.tb[IFLA_MTU]) {
+            link->mtu = PORTD_NL_ATTR_U32(msg.tb[IFLA_MTU]);
+        }
+    } else if (nlh->nlmsg_type == RTM_NEWADDR ||
+               nlh->nlmsg_type == RTM_DELADDR) {
+        struct portd_nl_addr_msg msg;
+        struct portd_nl_addr key;
+
+        if (!portd_nl_parse_addr(nlh, &msg)) {
+            return;
+        }
+        link = portd_nl_link_lookup_index(ns, msg.ifa->ifa_index);
+        if (link && link->known && portd_nl_addr_from_msg(&msg, &key)) {
+            portd_nl_addr_set(link, nlh->nlmsg_type, &key);
+        }
+    }
+}
+
+static struct portd_nl_req *
+portd_nl_req_lookup(uint32_t seq)
+{
+    struct portd_nl_req *req;
+
+    HMAP_FOR_EACH_WITH_HASH (req, node, hash_int(seq, 0), &nl_requests) {
+        if (req->seq == seq) {
+            return req;
+        }
+    }
+    return NULL;
+}
+
+const char *
+portd_nl_msg_type_to_string(int type)
+{
+    switch (type) {
+    case RTM_NEWLINK:
+        return "RTM_NEWLINK";
+    case RTM_DELLINK:
+        return "RTM_DELLINK";
+    case RTM_NEWADDR:
+        return "RTM_NEWADDR";
+    case RTM_DELADDR:
+        return "RTM_DELADDR";
+    default:
+        return "unknown";
+    }
+}
+
+/* Records the outcome 'error' of a request of 'type' made for port 'owner'.
+ * A failure is kept until the results are taken. */
+static void
+portd_nl_result_record(const char *owner, int type, int error)
+{
+    struct portd_nl_result *result = shash_find_data(&nl_results, owner);
+
+    if (!result) {
+        result = xzalloc(sizeof *result);
+        shash_add(&nl_results, owner, result);
+    }
+    if (error && !result->error) {
+        result->type = type;
+        result->error = error;
+    }
+}
+
+/*
+ * Completes request 'req' of namespace 'ns' with 'error' (0 or a positive
+ * errno value) and records the outcome for its owner.  A failure is kept
+ * until the results are taken, later successes do not hide it.  The caller
+ * accounts for the acknowledgement of a request that was sent.
+ */
+static void
+portd_nl_req_complete(struct portd_nl_ns *ns, struct portd_nl_req *req,
+                      int error)
+{
+    static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(5, 20);
+
+    if (error) {
+        struct portd_nl_link *link;
+
+        VLOG_ERR_RL(&rl, "Netlink %s for %s failed on socket %d (%s)",
+                    portd_nl_msg_type_to_string(req->type),
+                    req->owner ? req->owner : "-", ns->cmd_sock,
+                    strerror(error));
+        COVERAGE_INC(portd_nl_nack);
+
+        /* The shadow state assumed the request would succeed. */
+        link = req->ifindex ? portd_nl_link_lookup_index(ns, req->ifindex)
+                            : NULL;
+        if (link) {
+            portd_nl_link_invalidate(link);
+        }
+    } else {
+        COVERAGE_INC(portd_nl_ack);
+    }
+
+    if (req->owner) {
+        portd_nl_result_record(req->owner, req->type, error);
+    }
+
+    hmap_remove(&nl_requests, &req->node);
+    free(req->owner);
+    free(req);
+}
+
+/* Handles a reply received for a request of namespace 'ns'. */
+static void
+portd_nl_cmd_reply(struct portd_nl_ns *ns, const struct nlmsghdr *nlh)
+{
+    const struct nlmsgerr *err = NLMSG_DATA(nlh);
+    struct portd_nl_req *req;
+
+    if (nlh->nlmsg_type != NLMSG_ERROR) {
+        return;
+    }
+
+    req = portd_nl_req_lookup(nlh->nlmsg_seq);
+    if (req) {
+        if (ns->n_in_flight) {
+            ns->n_in_flight--;
+        }
+        portd_nl_req_complete(ns, req, -err->error);
+    } else if (err->error) {
+        static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(5, 20);
+
+        VLOG_ERR_RL(&rl, "Netlink request %d (seq %u) failed on socket %d "
+                    "(%s)", err->msg.nlmsg_type, err->msg.nlmsg_seq,
+                    ns->cmd_sock, strerror(-err->error));
+    }
+}
+
+/* Completes the requests queued in the batch of 'ns', which could not be
+ * sent, with 'error'. */
+static void
+portd_nl_batch_fail(struct portd_nl_ns *ns, int error)
+{
+    const struct nlmsghdr *nlh = (const struct nlmsghdr *) ns->buf;
+    int len = ns->len;
+
+    for (; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+        struct portd_nl_req *req = portd_nl_req_lookup(nlh->nlmsg_seq);
+
+        if (req) {
+            portd_nl_req_complete(ns, req, error);
+        }
+    }
+}
+
+/* Forgets the in flight requests of 'ns' whose acknowledgement was lost. */
+static void
+portd_nl_req_flush(struct portd_nl_ns *ns)
+{
+    struct portd_nl_req *req, *next;
+
+    HMAP_FOR_EACH_SAFE (req, next, node, &nl_requests) {
+        if (req->sock == ns->sock) {
+            hmap_remove(&nl_requests, &req->node);
+            free(req->owner);
+            free(req);
+        }
+    }
+    ns->n_in_flight = 0;
+}
+
+/*
+ * Receives a datagram from the command socket of 'ns' into a buffer of
+ * PORTD_NL_RECV_BUFFER_SIZE bytes owned by this module, which remains valid
+ * until the next call.  Waits for one until 'deadline', a time_msec()
+ * value, or not at all if 'deadline' is LLONG_MIN.  Returns the length of
+ * the datagram, stored in '*msgp', or a negative errno value: -EAGAIN if
+ * none came in time, -EMSGSIZE if it did not fit in the buffer, which is
+ * logged and counted as in portd_nl_recv().  The start of a truncated
+ * datagram is still stored in '*msgp'.
+ */
+static int
+portd_nl_cmd_recv(struct portd_nl_ns *ns, long long int deadline,
+                  struct nlmsghdr **msgp)
+{
+    static char *buf;
+    int ret;
+
+    if (!buf) {
+        buf = xmalloc(PORTD_NL_RECV_BUFFER_SIZE);
+    }
+
+    for (;;) {
+        if (deadline != LLONG_MIN) {
+            struct pollfd pfd = { .fd = ns->cmd_sock, .events = POLLIN };
+            long long int timeout = MAX(deadline - time_msec(), 0);
+
+            ret = poll(&pfd, 1, timeout);
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            } else if (!ret) {
+                return -EAGAIN;
+            }
+        }
+
+        /* MSG_TRUNC makes recv() return the full length of the datagram. */
+        ret = recv(ns->cmd_sock, buf, PORTD_NL_RECV_BUFFER_SIZE,
+                   MSG_DONTWAIT | MSG_TRUNC);
+        if (ret >= 0) {
+            break;
+        } else if (errno != EINTR
+                   && (errno != EAGAIN || deadline == LLONG_MIN)) {
+            return -errno;
+        }
+    }
+
+    if (ret > PORTD_NL_RECV_BUFFER_SIZE) {
+        static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(1, 5);
+
+        VLOG_ERR_RL(&rl, "Netlink message of %d bytes truncated to %d bytes "
+                    "on socket %d", ret, PORTD_NL_RECV_BUFFER_SIZE,
+                    ns->cmd_sock);
+        COVERAGE_INC(portd_nl_recv_trunc);
+        *msgp = (struct nlmsghdr *) buf;
+        return -EMSGSIZE;
+    }
+    *msgp = (struct nlmsghdr *) buf;
+    return ret;
+}
+
+/* Reads the replies pending on the command socket of 'ns' without
+ * blocking.  The kernel handles requests while they are being sent, so the
+ * replies to a batch are all available once sendmsg() returns. */
+static void
+portd_nl_cmd_drain(struct portd_nl_ns *ns)
+{
+    if (ns->replies_on_sock) {
+        /* Replies are received with the notifications. */
+        return;
+    }
+
+    for (;;) {
+        struct nlmsghdr *nlh;
+        int ret = portd_nl_cmd_recv(ns, LLONG_MIN, &nlh);
+
+        if (ret == -ENOBUFS) {
+            VLOG_WARN("Netlink acknowledgements lost on socket %d",
+                      ns->cmd_sock);
+            portd_nl_req_flush(ns);
+            continue;
+        } else if (ret == -EMSGSIZE) {
+            /* An error acknowledgement echoes the failed request.  Its
+             * fixed header, at the start, still tells which one failed. */
+            if (nlh->nlmsg_type == NLMSG_ERROR) {
+                portd_nl_cmd_reply(ns, nlh);
+            }
+            continue;
+        } else if (ret < 0) {
+            return;
+        }
+        for (; NLMSG_OK(nlh, ret); nlh = NLMSG_NEXT(nlh, ret)) {
+            portd_nl_cmd_reply(ns, nlh);
+        }
+    }
+}
+
+/* Sends every request queued in 'ns' with a single sendmsg().  The kernel
+ * processes the messages of one datagram in order, so requests that depend on
+ * each other (e.g. deleting and re-creating a link) keep their ordering.
+ * The acknowledgements are then collected. */
+static void
+portd_nl_batch_send(struct portd_nl_ns *ns)
+{
+    struct sockaddr_nl nladdr;
+    struct msghdr msg;
+    struct iovec iov;
+
+    if (!ns->n_msgs) {
+        return;
+    }
+
+    memset(&nladdr, 0, sizeof(nladdr));
+    nladdr.nl_family = AF_NETLINK;
+
+    iov.iov_base = ns->buf;
+    iov.iov_len = ns->len;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &nladdr;
+    msg.msg_namelen = sizeof(nladdr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (sendmsg(ns->cmd_sock, &msg, 0) == -1) {
+        VLOG_ERR("Netlink failed to send %u requests (%"PRIuSIZE" bytes) "
+                 "on socket %d (%s)", ns->n_msgs, ns->len,
+                 ns->cmd_sock, strerror(errno));
+        portd_nl_batch_fail(ns, errno);
+    } else {
+        VLOG_DBG("Netlink sent %u requests (%"PRIuSIZE" bytes) on socket %d",
+                 ns->n_msgs, ns->len, ns->cmd_sock);
+        ns->n_in_flight += ns->n_msgs;
+    }
+
+    COVERAGE_INC(portd_nl_batch_flush);
+    COVERAGE_ADD(portd_nl_batch_msgs, ns->n_msgs);
+    COVERAGE_ADD(portd_nl_batch_bytes, ns->len);
+
+    ns->len = 0;
+    ns->n_msgs = 0;
+    ns->n_link_ops = 0;
+
+    portd_nl_cmd_drain(ns);
+}
+
+/*
+ * Queues the netlink request 'nlh' to be sent on 'sock' at the end of the
+ * current pass.  The request is copied, so the caller may reuse its buffer.
+ * Its outcome is reported for port 'owner', if nonnull, by
+ * portd_nl_results_take().  Returns 0 on success, -1 if the request cannot
+ * be queued.
+ *
+ * A request that would not change the kernel state, as known from the
+ * shadow state of its interface, is dropped and reported as successful.
+ */
+int
+portd_nl_batch_add(int sock, const struct nlmsghdr *nlh, const char *owner)
+{
+    struct portd_nl_ns *ns;
+    struct portd_nl_req *req;
+    struct nlmsghdr *queued;
+    size_t len = NLMSG_ALIGN(nlh->nlmsg_len);
+
+    if (sock < 0) {
+        VLOG_ERR("Netlink request %d dropped, no socket", nlh->nlmsg_type);
+        return -1;
+    }
+
+    if (len > PORTD_NL_BATCH_SIZE) {
+        VLOG_ERR("Netlink request %d of %"PRIuSIZE" bytes exceeds batch size",
+                 nlh->nlmsg_type, len);
+        return -1;
+    }
+
+    ns = portd_nl_ns_get(sock);
+    if (portd_nl_shadow_match(ns, nlh)) {
+        VLOG_DBG("Netlink %s for %s skipped, kernel state unchanged",
+                 portd_nl_msg_type_to_string(nlh->nlmsg_type),
+                 owner ? owner : "-");
+        ns->n_ops_skipped++;
+        COVERAGE_INC(portd_nl_op_skipped);
+        if (owner) {
+            /* The kernel already matches, which clears an earlier error. */
+            portd_nl_result_record(owner, nlh->nlmsg_type, 0);
+        }
+        return 0;
+    }
+    ns->n_ops_sent++;
+    COVERAGE_INC(portd_nl_op_sent);
+
+    /* The acknowledgements received with the notifications are only read
+     * when those are serviced, they do not hold the window. */
+    if (ns->len + len > PORTD_NL_BATCH_SIZE ||
+        ns->n_msgs + (ns->replies_on_sock ? 0 : ns->n_in_flight)
+        >= PORTD_NL_ACK_WINDOW) {
+        portd_nl_batch_send(ns);
+    }
+
+    queued = (struct nlmsghdr *) (ns->buf + ns->len);
+    memcpy(queued, nlh, nlh->nlmsg_len);
+    memset((char *) queued + nlh->nlmsg_len, 0, len - nlh->nlmsg_len);
+    queued->nlmsg_seq = ++nl_batch_seq;
+    queued->nlmsg_flags |= NLM_F_ACK;
+
+    req = xzalloc(sizeof *req);
+    req->seq = queued->nlmsg_seq;
+    req->sock = sock;
+    req->type = nlh->nlmsg_type;
+    if (req->type == RTM_NEWADDR || req->type == RTM_DELADDR) {
+        req->ifindex = ((const struct ifaddrmsg *) NLMSG_DATA(nlh))->ifa_index;
+    } else {
+        req->ifindex = ((const struct ifinfomsg *) NLMSG_DATA(nlh))->ifi_index;
+    }
+    req->owner = owner ? xstrdup(owner) : NULL;
+    hmap_insert(&nl_requests, &req->node, hash_int(req->seq, 0));
+    portd_nl_shadow_apply(ns, nlh);
+
+    ns->len += len;
+    ns->n_msgs++;
+    if (nlh->nlmsg_type == RTM_DELLINK) {
+        /* Forget the link now, so that a lookup later in this pass does not
+         * return the index of an interface that is about to go away. */
+        struct portd_nl_link_msg msg;
+        struct portd_nl_link *link = NULL;
+
+        if (portd_nl_parse_link(nlh, &msg)) {
+            const char *name = PORTD_NL_ATTR_STR(msg.tb[IFLA_IFNAME]);
+
+            link = msg.ifi->ifi_index
+                   ? portd_nl_link_lookup_index(ns, msg.ifi->ifi_index)
+                   : name ? portd_nl_link_lookup_name(ns, name) : NULL;
+        }
+        if (link) {
+            portd_nl_link_remove(ns, link);
+        }
+        ns->n_link_ops++;
+    } else if (nlh->nlmsg_type == RTM_NEWLINK &&
+               nlh->nlmsg_flags & NLM_F_CREATE) {
+        ns->n_link_ops++;
+    }
+    return 0;
+}
+
+/* Sends everything queued for 'sock'. */
+void
+portd_nl_batch_flush(int sock)
+{
+    struct portd_nl_ns *ns = portd_nl_ns_lookup(sock);
+
+    if (ns) {
+        portd_nl_batch_send(ns);
+    }
+}
+
+/*
+ * Sends the requests queued for 'sock' if any of them creates or deletes a
+ * link.  Used before resolving an interface name, which must observe the
+ * links this pass has already asked for.
+ */
+void
+portd_nl_batch_flush_links(int sock)
+{
+    struct portd_nl_ns *ns = portd_nl_ns_lookup(sock);
+
+    if (ns && ns->n_link_ops) {
+        portd_nl_batch_send(ns);
+    }
+}
+
+/* Sends the requests queued for every namespace. */
+void
+portd_nl_batch_flush_all(void)
+{
+    struct portd_nl_ns *ns;
+
+    HMAP_FOR_EACH (ns, node, &nl_namespaces) {
+        portd_nl_batch_send(ns);
+    }
+}
+
+/*
+ * Sends request 'req' on the command socket of 'ns' and waits for its reply,
+ * at most PORTD_NL_REPLY_TIMEOUT ms.  Replies to batched requests that are
+ * still pending are handled on the way.  Returns the reply, which may be an
+ * NLMSG_ERROR message and remains valid until the next message is received
+ * on the socket, or NULL if the kernel cannot be reached, does not reply in
+ * time or the reply does not fit in the receive buffer.
+ */
+static struct nlmsghdr *
+portd_nl_transact(struct portd_nl_ns *ns, struct nlmsghdr *req)
+{
+    uint32_t seq = ++nl_batch_seq;
+    long long int deadline;
+
+    if (ns->replies_on_sock || ns->cmd_sock <= 0) {
+        return NULL;
+    }
+
+    req->nlmsg_flags |= NLM_F_REQUEST;
+    req->nlmsg_seq = seq;
+    if (send(ns->cmd_sock, req, req->nlmsg_len, 0) == -1) {
+        VLOG_ERR("Netlink failed to send request %d on socket %d (%s)",
+                 req->nlmsg_type, ns->cmd_sock, strerror(errno));
+        return NULL;
+    }
+
+    /* The reply is sent synchronously. */
+    deadline = time_msec() + PORTD_NL_REPLY_TIMEOUT;
+    for (;;) {
+        struct nlmsghdr *nlh;
+        int ret = portd_nl_cmd_recv(ns, deadline, &nlh);
+
+        if (ret == -ENOBUFS) {
+            /* The reply may be lost too, the deadline bounds the wait. */
+            VLOG_WARN("Netlink acknowledgements lost on socket %d",
+                      ns->cmd_sock);
+            portd_nl_req_flush(ns);
+            continue;
+        } else if (ret < 0) {
+            VLOG_ERR("Netlink failed to receive reply %d on socket %d (%s)",
+                     req->nlmsg_type, ns->cmd_sock,
+                     ret == -EAGAIN ? "timed out" : strerror(-ret));
+            return NULL;
+        }
+
+        for (; NLMSG_OK(nlh, ret); nlh = NLMSG_NEXT(nlh, ret)) {
+            if (nlh->nlmsg_seq == seq) {
+                return nlh;
+            }
+            portd_nl_cmd_reply(ns, nlh);
+        }
+    }
+}
+
+/* Appends attribute 'type' with 'len' bytes of 'data' to 'nlh'. */
+static void
+portd_nl_attr_put(struct nlmsghdr *nlh, int type, const void *data, int len)
+{
+    struct rtattr *rta = NLMSG_TAIL(nlh);
+
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+/*
+ * Asks the kernel for the index of interface 'name' on the command socket of
+ * 'ns', and caches the interface with its state.  Returns 0 if the interface
+ * does not exist or the kernel cannot be queried.
+ */
+static unsigned int
+portd_nl_ifindex_query(struct portd_nl_ns *ns, const char *name)
+{
+    struct {
+        struct nlmsghdr  n;
+        struct ifinfomsg i;
+        char             buf[64];
+    } req;
+    struct nlmsghdr *reply;
+    size_t name_len = strlen(name) + 1;
+    uint32_t ext_mask = RTEXT_FILTER_SKIP_STATS;
+
+    if (name_len > IFNAMSIZ) {
+        return 0;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    req.n.nlmsg_type = RTM_GETLINK;
+    req.i.ifi_family = AF_UNSPEC;
+    portd_nl_attr_put(&req.n, IFLA_IFNAME, name, name_len);
+    portd_nl_attr_put(&req.n, IFLA_EXT_MASK, &ext_mask, sizeof(ext_mask));
+
+    reply = portd_nl_transact(ns, &req.n);
+    if (reply && reply->nlmsg_type == RTM_NEWLINK) {
+        struct portd_nl_link_msg msg;
+        unsigned int ifindex;
+
+        if (!portd_nl_parse_link(reply, &msg)) {
+            return 0;
+        }
+        ifindex = msg.ifi->ifi_index;
+        if (ifindex) {
+            portd_nl_link_set(ns, name, ifindex);
+            portd_nl_link_state_update(portd_nl_link_lookup_index(ns, ifindex),
+                                       &msg);
+        }
+        return ifindex;
+    }
+    if (reply && reply->nlmsg_type == NLMSG_ERROR) {
+        struct nlmsgerr *err = NLMSG_DATA(reply);
+
+        VLOG_DBG("Interface %s not found (%s)", name, strerror(-err->error));
+    }
+    return 0;
+}
+
+/*
+ * Returns the index of interface 'name' in the namespace whose link
+ * notifications are received on 'sock', or 0 if there is no such interface.
+ * On a cache miss the kernel is asked on the command socket of the
+ * namespace.
+ */
+unsigned int
+portd_nl_ifindex_get(int sock, const char *name)
+{
+    struct portd_nl_ns *ns = portd_nl_ns_get(sock);
+    struct portd_nl_link *link = portd_nl_link_lookup_name(ns, name);
+    unsigned int ifindex;
+
+    if (link) {
+        COVERAGE_INC(portd_nl_ifindex_hit);
+        return link->ifindex;
+    }
+
+    COVERAGE_INC(portd_nl_ifindex_miss);
+
+    /* The link may have been created by a queued request. */
+    portd_nl_batch_flush_links(sock);
+
+    ifindex = portd_nl_ifindex_query(ns, name);
+    VLOG_DBG("ifindex of %s is %u", name, ifindex);
+    return ifindex;
+}
+
+/*
+ * Updates the ifindex cache and the shadow link state of the namespace of
+ * 'sock' from the RTM_NEWLINK or RTM_DELLINK message 'msg', received as a
+ * notification or as part of a link dump.
+ */
+void
+portd_nl_ifindex_update(int sock, const struct portd_nl_link_msg *msg)
+{
+    const struct ifinfomsg *ifi = msg->ifi;
+    struct portd_nl_ns *ns = portd_nl_ns_get(sock);
+    const char *name;
+
+    if (msg->type == RTM_DELLINK) {
+        struct portd_nl_link *link;
+
+        link = portd_nl_link_lookup_index(ns, ifi->ifi_index);
+        if (link) {
+            portd_nl_link_remove(ns, link);
+        }
+        return;
+    }
+
+    name = PORTD_NL_ATTR_STR(msg->tb[IFLA_IFNAME]);
+    if (name && ifi->ifi_index) {
+        portd_nl_link_set(ns, name, ifi->ifi_index);
+        portd_nl_link_state_update(portd_nl_link_lookup_index(ns,
+                                                              ifi->ifi_index),
+                                   msg);
+    }
+}
+
+/*
+ * Updates the address set of the interface an RTM_NEWADDR or RTM_DELADDR
+ * message 'msg' received on 'sock' is about, as a notification or as part of
+ * an address dump.
+ */
+void
+portd_nl_addr_update(int sock, const struct portd_nl_addr_msg *msg)
+{
+    struct portd_nl_ns *ns = portd_nl_ns_lookup(sock);
+    struct portd_nl_link *link;
+    struct portd_nl_addr key;
+
+    link = ns ? portd_nl_link_lookup_index(ns, msg->ifa->ifa_index) : NULL;
+    if (link && portd_nl_addr_from_msg(msg, &key)) {
+        portd_nl_addr_set(link, msg->type, &key);
+    }
+}
+
+/* Returns the name of interface 'ifindex' in the namespace of 'sock', or NULL
+ * if it is not known. */
+const char *
+portd_nl_ifindex_to_name(int sock, unsigned int ifindex)
+{
+    struct portd_nl_ns *ns = portd_nl_ns_lookup(sock);
+    struct portd_nl_link *link = ns ? portd_nl_link_lookup_index(ns, ifindex)
+                                    : NULL;
+
+    return link ? link->name : NULL;
+}
+
+/* Drops 'name' from the ifindex cache of the namespace of 'sock'. */
+void
+portd_nl_ifindex_forget(int sock, const char *name)
+{
+    struct portd_nl_ns *ns = portd_nl_ns_lookup(sock);
+    struct portd_nl_link *link = ns ? portd_nl_link_lookup_name(ns, name)
+                                    : NULL;
+
+    if (link) {
+        portd_nl_link_remove(ns, link);
+    }
+}
+
+/*
+ * Prepares for moving interface 'name' from the namespace of 'from_sock' to
+ * the one of 'to_sock'.  The move is not done over these sockets, so every
+ * queued request is sent first, and the interface gets a new identity in
+ * both namespaces.
+ */
+void
+portd_nl_link_move_prepare(int from_sock, int to_sock, const char *name)
+{
+    portd_nl_batch_flush_all();
+    portd_nl_ifindex_forget(from_sock, name);
+    portd_nl_ifindex_forget(to_sock, name);
+}
+
+/*
+ * Records that the kernel dropped notifications for 'sock' because its
+ * receive buffer was full.  The caller is expected to resync the namespace.
+ */
+void
+portd_nl_overrun(int sock)
+{
+    static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(1, 5);
+    struct portd_nl_ns *ns = portd_nl_ns_get(sock);
+
+    ns->n_overruns++;
+    COVERAGE_INC(portd_nl_overrun);
+    VLOG_WARN_RL(&rl, "Netlink notifications lost on socket %d (%llu times), "
+                 "resyncing", sock, ns->n_overruns);
+}
+
+/*
+ * Enables strict checking of the requests sent on 'sock', which lets the
+ * kernel filter dumps by interface and reject malformed requests instead
+ * of silently ignoring them.  Returns true if the kernel supports it.
+ */
+bool
+portd_nl_strict_enable(int sock)
+{
+    int one = 1;
+
+    if (setsockopt(sock, SOL_NETLINK, NETLINK_GET_STRICT_CHK,
+                   &one, sizeof(one)) < 0) {
+        VLOG_INFO_ONCE("Netlink strict checking not supported (%s), "
+                       "dumps are not filtered", strerror(errno));
+        nl_strict_chk = false;
+        return false;
+    }
+    nl_strict_chk = true;
+    return true;
+}
+
+/* Returns true if address dumps requested for a single interface only
+ * return the addresses of that interface. */
+bool
+portd_nl_dump_filtered(void)
+{
+    return nl_strict_chk;
+}
+
+/*
+ * Asks the kernel on 'cmd_sock' for the objects of 'type' (RTM_GETLINK or
+ * RTM_GETADDR) of address family 'family' (AF_UNSPEC for all families).
+ *
+ * If 'ifindex' is 0, every object of the namespace is dumped.  Otherwise only
+ * interface 'ifindex' is returned for RTM_GETLINK, as a single message, and
+ * only its addresses are dumped for RTM_GETADDR if portd_nl_dump_filtered()
+ * is true.  Link statistics are never requested.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int
+portd_nl_dump_request(int cmd_sock, int type, int family, unsigned int ifindex)
+{
+    struct {
+        struct nlmsghdr n;
+        union {
+            struct ifinfomsg i;
+            struct ifaddrmsg a;
+        } u;
+        char            buf[16];
+    } req;
+
+    memset(&req, 0, sizeof(req));
+    req.n.nlmsg_type = type;
+    req.n.nlmsg_flags = NLM_F_REQUEST;
+    req.n.nlmsg_seq = ++nl_batch_seq;
+
+    if (type == RTM_GETLINK) {
+        uint32_t ext_mask = RTEXT_FILTER_SKIP_STATS;
+
+        /* Link dumps cannot be filtered by index, a single interface is
+         * asked for with a plain get. */
+        req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+        req.u.i.ifi_family = family;
+        req.u.i.ifi_index = ifindex;
+        portd_nl_attr_put(&req.n, IFLA_EXT_MASK, &ext_mask, sizeof(ext_mask));
+        if (!ifindex) {
+            req.n.nlmsg_flags |= NLM_F_DUMP;
+        }
+    } else {
+        req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+        req.n.nlmsg_flags |= NLM_F_DUMP;
+        req.u.a.ifa_family = family;
+        req.u.a.ifa_index = ifindex;
+    }
+
+    if (send(cmd_sock, &req, req.n.nlmsg_len, 0) == -1) {
+        VLOG_ERR("Netlink failed to request dump %d on socket %d (%s)",
+                 type, cmd_sock, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Starts a resync of the namespace of 'sock': sends the queued requests,
+ * marks every cached interface as stale and forgets their shadow state.
+ * Returns the command socket the caller should dump the namespace's links
+ * on, feeding the replies to portd_nl_ifindex_update(), and then call
+ * portd_nl_resync_end().
+ */
+int
+portd_nl_resync_begin(int sock)
+{
+    struct portd_nl_ns *ns = portd_nl_ns_get(sock);
+    struct portd_nl_link *link;
+
+    portd_nl_batch_send(ns);
+    HMAP_FOR_EACH (link, index_node, &ns->links_by_index) {
+        link->stale = true;
+        portd_nl_link_invalidate(link);
+    }
+    return ns->cmd_sock;
+}
+
+/* Ends a resync of the namespace of 'sock', forgetting the interfaces the
+ * link dump did not report. */
+void
+portd_nl_resync_end(int sock)
+{
+    struct portd_nl_ns *ns = portd_nl_ns_get(sock);
+    struct portd_nl_link *link, *next;
+
+    HMAP_FOR_EACH_SAFE (link, next, index_node, &ns->links_by_index) {
+        if (link->stale) {
+            VLOG_DBG("Interface %s (%u) is gone", link->name, link->ifindex);
+            portd_nl_link_remove(ns, link);
+        }
+    }
+    ns->n_resyncs++;
+    COVERAGE_INC(portd_nl_resync);
+}
+
+/* Appends the state of the namespace of 'sock' to 'ds'. */
+void
+portd_nl_ns_format(int sock, struct ds *ds)
+{
+    struct portd_nl_ns *ns = portd_nl_ns_lookup(sock);
+
+    if (!ns) {
+        ds_put_format(ds, "  socket %d: no state\n", sock);
+        return;
+    }
+    ds_put_format(ds, "  socket %d (command socket %d)\n", ns->sock,
+                  ns->cmd_sock);
+    ds_put_format(ds, "    cached interfaces: %"PRIuSIZE"\n",
+                  hmap_count(&ns->links_by_index));
+    ds_put_format(ds, "    queued requests: %u (%"PRIuSIZE" bytes)\n",
+                  ns->n_msgs, ns->len);
+    ds_put_format(ds, "    overruns: %llu\n", ns->n_overruns);
+    ds_put_format(ds, "    resyncs: %llu\n", ns->n_resyncs);
+    ds_put_format(ds, "    requests sent: %llu, skipped: %llu\n",
+                  ns->n_ops_sent, ns->n_ops_skipped);
+}
+
+/*
+ * Sets up the namespace whose notifications are received on 'sock'.
+ * 'cmd_sock' is an unbound netlink socket opened in the same namespace, on
+ * which requests are sent and interfaces are queried, so that their replies
+ * are not mixed with notifications.
+ *
+ * When the notifications of the namespace are received on a socket shared
+ * with other namespaces, 'sock' only names the namespace and may be
+ * 'cmd_sock' itself.
+ */
+void
+portd_nl_ns_init(int sock, int cmd_sock)
+{
+    struct portd_nl_ns *ns = portd_nl_ns_get(sock);
+
+    ns->cmd_sock = cmd_sock > 0 ? cmd_sock : sock;
+    ns->replies_on_sock = cmd_sock <= 0;
+}
+
+/*
+ * Returns the id under which the namespace of 'sock' knows the namespace
+ * 'peer_sock' was opened in, assigning one if needed, or -1 on failure.
+ * The kernel only reports the events of namespaces that have an id to the
+ * sockets listening to all namespaces, and tags them with that id.
+ */
+int
+portd_nl_nsid_get(int sock, int peer_sock)
+{
+    struct {
+        struct nlmsghdr n;
+        struct rtgenmsg g;
+        char            buf[64];
+    } req;
+    struct portd_nl_ns *ns = portd_nl_ns_get(sock);
+    struct nlmsghdr *reply;
+    int32_t nsid = -1;
+    int ns_fd;
+
+    ns_fd = ioctl(peer_sock, SIOCGSKNS);
+    if (ns_fd < 0) {
+        VLOG_ERR("Failed to get the namespace of socket %d (%s)",
+                 peer_sock, strerror(errno));
+        return -1;
+    }
+
+    /* Let the kernel pick an id.  This fails with EEXIST if the namespace
+     * already has one, which is fine. */
+    memset(&req, 0, sizeof(req));
+    req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtgenmsg));
+    req.n.nlmsg_type = RTM_NEWNSID;
+    req.n.nlmsg_flags = NLM_F_ACK;
+    req.g.rtgen_family = AF_UNSPEC;
+    portd_nl_attr_put(&req.n, NETNSA_FD, &ns_fd, sizeof(ns_fd));
+    portd_nl_attr_put(&req.n, NETNSA_NSID, &nsid, sizeof(nsid));
+    portd_nl_transact(ns, &req.n);
+
+    memset(&req, 0, sizeof(req));
+    req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtgenmsg));
+    req.n.nlmsg_type = RTM_GETNSID;
+    req.g.rtgen_family = AF_UNSPEC;
+    portd_nl_attr_put(&req.n, NETNSA_FD, &ns_fd, sizeof(ns_fd));
+    reply = portd_nl_transact(ns, &req.n);
+    close(ns_fd);
+
+    if (reply && reply->nlmsg_type == RTM_NEWNSID) {
+        const struct rtattr *tb[NETNSA_MAX + 1];
+
+        portd_nl_parse_attrs(tb, NETNSA_MAX, (const struct rtattr *)
+                             ((char *) reply +
+                              NLMSG_SPACE(sizeof(struct rtgenmsg))),
+                             reply->nlmsg_len -
+                             NLMSG_SPACE(sizeof(struct rtgenmsg)));
+        if (tb[NETNSA_NSID]) {
+            nsid = *(const int32_t *) RTA_DATA(tb[NETNSA_NSID]);
+        }
+    }
+    if (nsid < 0) {
+        VLOG_ERR("Failed to get the id of the namespace of socket %d",
+                 peer_sock);
+        return -1;
+    }
+    VLOG_DBG("Namespace of socket %d has id %d", peer_sock, nsid);
+    return nsid;
+}
+
+/* Handles an NLMSG_ERROR message received on the notification socket
+ * 'sock', where the replies of a namespace with no command socket end up. */
+void
+portd_nl_ack(int sock, const struct nlmsghdr *nlh)
+{
+    struct portd_nl_ns *ns = portd_nl_ns_lookup(sock);
+
+    if (ns) {
+        portd_nl_cmd_reply(ns, nlh);
+    }
+}
+
+/* Collects the acknowledgements that were not available when their
+ * requests were sent. */
+void
+portd_nl_ack_run(void)
+{
+    struct portd_nl_ns *ns;
+
+    HMAP_FOR_EACH (ns, node, &nl_namespaces) {
+        if (ns->n_in_flight) {
+            portd_nl_cmd_drain(ns);
+        }
+    }
+}
+
+/* Wakes up the main loop when acknowledgements are pending. */
+void
+portd_nl_ack_wait(void)
+{
+    struct portd_nl_ns *ns;
+
+    HMAP_FOR_EACH (ns, node, &nl_namespaces) {
+        if (ns->n_in_flight && !ns->replies_on_sock) {
+            poll_fd_wait(ns->cmd_sock, POLLIN);
+        }
+    }
+}
+
+/*
+ * Moves the outcome of the requests acknowledged since the last call into
+ * 'results', an initialized shash of "struct portd_nl_result"s indexed by
+ * port name.  The caller owns the results and must free them.
+ */
+void
+portd_nl_results_take(struct shash *results)
+{
+    shash_swap(results, &nl_results);
+}
+
+/* Flushes and frees the state kept for the namespace of 'sock'.  Must be
+ * called before 'sock' is closed, since the descriptor number may be reused
+ * by a later socket. */
+void
+portd_nl_ns_destroy(int sock)
+{
+    struct portd_nl_ns *ns = portd_nl_ns_lookup(sock);
+    struct portd_nl_link *link, *next;
+
+    if (ns) {
+        portd_nl_batch_send(ns);
+        portd_nl_req_flush(ns);
+        HMAP_FOR_EACH_SAFE (link, next, index_node, &ns->links_by_index) {
+            portd_nl_link_remove(ns, link);
+        }
+        hmap_destroy(&ns->links_by_name);
+        hmap_destroy(&ns->links_by_index);
+        hmap_remove(&nl_namespaces, &ns->node);
+        free(ns->buf);
+        free(ns);
+    }
+}
+
+/*
+ * Receives up to PORTD_NL_RECV_BATCH datagrams from 'sock' with a single
+ * recvmmsg().  If 'wait' is true, blocks until at least one is available.
+ * On success, stores a pointer to each datagram in 'msgs' and its length in
+ * 'lens', and returns the number of datagrams, which is 0 if none is pending.
+ * Returns a negative errno value on failure.
+ *
+ * On a socket listening to all namespaces, 'nsids' receives the id of the
+ * namespace each datagram comes from, or -1 for the socket's own namespace.
+ *
+ * The datagrams are stored in buffers owned by this module and remain valid
+ * until the next call.  Each buffer is large enough for the biggest datagram
+ * rtnetlink builds, so truncation is not expected; it is logged and counted
+ * if it happens anyway.
+ */
+int
+portd_nl_recv(int sock, bool wait, struct nlmsghdr **msgs, int *lens,
+              int *nsids)
+{
+    static char *bufs;
+    struct sockaddr_nl addrs[PORTD_NL_RECV_BATCH];
+    struct mmsghdr mmsgs[PORTD_NL_RECV_BATCH];
+    struct iovec iovs[PORTD_NL_RECV_BATCH];
+    char cmsgs[PORTD_NL_RECV_BATCH][CMSG_SPACE(sizeof(int))];
+    int i, n;
+
+    if (!bufs) {
+        bufs = xmalloc(PORTD_NL_RECV_BATCH * PORTD_NL_RECV_BUFFER_SIZE);
+    }
+
+    memset(mmsgs, 0, sizeof(mmsgs));
+    for (i = 0; i < PORTD_NL_RECV_BATCH; i++) {
+        iovs[i].iov_base = bufs + i * PORTD_NL_RECV_BUFFER_SIZE;
+        iovs[i].iov_len = PORTD_NL_RECV_BUFFER_SIZE;
+        mmsgs[i].msg_hdr.msg_name = &addrs[i];
+        mmsgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        mmsgs[i].msg_hdr.msg_iov = &iovs[i];
+        mmsgs[i].msg_hdr.msg_iovlen = 1;
+        mmsgs[i].msg_hdr.msg_control = cmsgs[i];
+        mmsgs[i].msg_hdr.msg_controllen = sizeof(cmsgs[i]);
+    }
+
+    do {
+        n = recvmmsg(sock, mmsgs, PORTD_NL_RECV_BATCH,
+                     wait ? MSG_WAITFORONE : MSG_DONTWAIT, NULL);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        return errno == EAGAIN ? 0 : -errno;
+    }
+
+    COVERAGE_INC(portd_nl_recv);
+    COVERAGE_ADD(portd_nl_recv_msgs, n);
+
+    for (i = 0; i < n; i++) {
+        struct msghdr *hdr = &mmsgs[i].msg_hdr;
+        struct cmsghdr *cmsg;
+
+        msgs[i] = iovs[i].iov_base;
+        lens[i] = mmsgs[i].msg_len;
+        nsids[i] = -1;
+        for (cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+            if (cmsg->cmsg_level == SOL_NETLINK &&
+                cmsg->cmsg_type == NETLINK_LISTEN_ALL_NSID) {
+                nsids[i] = *(int *) CMSG_DATA(cmsg);
+            }
+        }
+        if (mmsgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(1, 5);
+
+            VLOG_ERR_RL(&rl, "Netlink message truncated to %d bytes on "
+                        "socket %d", PORTD_NL_RECV_BUFFER_SIZE, sock);
+            COVERAGE_INC(portd_nl_recv_trunc);
+            lens[i] = PORTD_NL_RECV_BUFFER_SIZE;
+        }
+    }
+    return n;
+}
+
+/* Records the replies to a dump of 'type' requested on the command socket
+ * of 'ns' into 'buf'.  Returns the number of messages recorded, 0 with
+ * 'buf' emptied if the dump could not be received whole. */
+static size_t
+portd_nl_dump_record(struct portd_nl_ns *ns, int type, struct ds *buf)
+{
+    size_t n = 0;
+    uint32_t seq;
+
+    if (ns->replies_on_sock ||
+        portd_nl_dump_request(ns->cmd_sock, type, AF_UNSPEC, 0)) {
+        return 0;
+    }
+    seq = nl_batch_seq;
+
+    for (;;) {
+        struct nlmsghdr *nlh;
+        int ret = portd_nl_cmd_recv(ns,
+                                    time_msec() + PORTD_NL_REPLY_TIMEOUT,
+                                    &nlh);
+
+        if (ret < 0) {
+            VLOG_ERR("Netlink failed to record dump %d on socket %d (%s)",
+                     type, ns->cmd_sock,
+                     ret == -EAGAIN ? "timed out" : strerror(-ret));
+            ds_clear(buf);
+            return 0;
+        }
+
+        for (; NLMSG_OK(nlh, ret); nlh = NLMSG_NEXT(nlh, ret)) {
+            if (nlh->nlmsg_seq != seq) {
+                portd_nl_cmd_reply(ns, nlh);
+            } else if (nlh->nlmsg_type == NLMSG_DONE ||
+                       nlh->nlmsg_type == NLMSG_ERROR) {
+                return n;
+            } else {
+                ds_put_buffer(buf, (const char *) nlh,
+                              NLMSG_ALIGN(nlh->nlmsg_len));
+                n++;
+            }
+        }
+    }
+}
+
+/*
+ * Microbenchmark of the attribute parser: records a link dump and an address
+ * dump of the namespace of 'sock', parses every recorded message
+ * 'iterations' times and appends the cost per message to 'ds'.
+ */
+void
+portd_nl_parse_bench(int sock, int iterations, struct ds *ds)
+{
+    static const int types[] = { RTM_GETLINK, RTM_GETADDR };
+    struct portd_nl_ns *ns = portd_nl_ns_lookup(sock);
+    size_t i;
+
+    if (!ns) {
+        ds_put_format(ds, "socket %d: no state\n", sock);
+        return;
+    }
+    portd_nl_batch_send(ns);
+
+    for (i = 0; i < ARRAY_SIZE(types); i++) {
+        struct ds buf = DS_EMPTY_INITIALIZER;
+        size_t n_msgs = portd_nl_dump_record(ns, types[i], &buf);
+        long long int start, elapsed;
+        size_t n_parsed = 0;
+        int iter;
+
+        start = time_usec();
+        for (iter = 0; iter < iterations; iter++) {
+            const struct nlmsghdr *nlh = (const struct nlmsghdr *) buf.string;
+            int len = buf.length;
+
+            for (; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+                if (types[i] == RTM_GETLINK) {
+                    struct portd_nl_link_msg msg;
+
+                    n_parsed += portd_nl_parse_link(nlh, &msg) &&
+                                msg.tb[IFLA_IFNAME];
+                } else {
+                    struct portd_nl_addr_msg msg;
+
+                    n_parsed += portd_nl_parse_addr(nlh, &msg) &&
+                                msg.tb[IFA_ADDRESS];
+                }
+            }
+        }
+        elapsed = time_usec() - start;
+
+        ds_put_format(ds, "%s: %"PRIuSIZE" messages (%"PRIuSIZE" bytes), "
+                      "%d iterations, %"PRIuSIZE" parsed, %lld ns/message\n",
+                      types[i] == RTM_GETLINK ? "links" : "addresses",
+                      n_msgs, buf.length, iterations, n_parsed,
+                      n_msgs && iterations
+                      ? elapsed * 1000 / ((long long int) n_msgs * iterations)
+                      : 0);
+        ds_destroy(&buf);
+    }
+}
@@ -0,0 +1,185 @@
+/*
+ * (c) Copyright 2016 Hewlett Packard Enterprise Development LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+/***************************************************************************
+ *    File               : portd_reconcile.c
+ *    Description        : Scheduling of the reconfiguration passes.  The
+ *                           database changes are collected until none came
+ *                           for the coalescing window, or the oldest one
+ *                           waited for the maximum delay, and are then
+ *                           applied in a single pass.
+ ***************************************************************************/
+
+#include <limits.h>
+
+#include "coverage.h"
+#include "dynamic-string.h"
+#include "poll-loop.h"
+#include "timeval.h"
+#include "util.h"
+#include "openvswitch/vlog.h"
+
+#include "portd_reconcile.h"
+
+VLOG_DEFINE_THIS_MODULE(portd_reconcile);
+
+COVERAGE_DEFINE(portd_reconcile_pass);
+COVERAGE_DEFINE(portd_reconcile_deferred);
+
+static int window = PORTD_RECONCILE_WINDOW_DEFAULT;
+static int max_delay = PORTD_RECONCILE_MAX_DELAY_DEFAULT;
+
+/* IDL sequence numbers last seen and last reconfigured. */
+static unsigned int seen_seqno;
+static unsigned int done_seqno;
+
+/* Times of the first and the last change of the burst being collected, or
+ * LLONG_MIN if none is.  'pending_since' is the time of the oldest change
+ * not reconfigured yet, kept over the passes that did not complete. */
+static long long int first_change = LLONG_MIN;
+static long long int last_change;
+static long long int pending_since = LLONG_MIN;
+static unsigned int pending_changes;
+
+/* Metrics of the completed passes. */
+static unsigned long long int n_passes;
+static unsigned long long int n_changes;
+static unsigned int max_changes;
+static long long int total_latency;
+static long long int max_latency;
+
+/* Starts with the IDL at sequence number 'seqno', reconfigured. */
+void
+portd_reconcile_init(unsigned int seqno)
+{
+    seen_seqno = done_seqno = seqno;
+}
+
+/*
+ * Sets the coalescing window and the maximum delay, in milliseconds.  A
+ * window of 0 reconfigures on every change.
+ */
+void
+portd_reconcile_set(int window_, int max_delay_)
+{
+    window = window_;
+    max_delay = max_delay_;
+}
+
+/* Notes that the IDL is at sequence number 'seqno'. */
+void
+portd_reconcile_note(unsigned int seqno)
+{
+    long long int now;
+
+    if (seqno == seen_seqno) {
+        return;
+    }
+
+    now = time_msec();
+    if (first_change == LLONG_MIN) {
+        first_change = now;
+    }
+    if (pending_since == LLONG_MIN) {
+        pending_since = now;
+    }
+    last_change = now;
+    pending_changes += seqno - seen_seqno;
+    seen_seqno = seqno;
+}
+
+static long long int
+portd_reconcile_deadline(void)
+{
+    long long int deadline = last_change + window;
+
+    return MIN(deadline, first_change + max_delay);
+}
+
+/*
+ * Returns true if the pass must reconfigure: the burst of changes is over
+ * or waited long enough, or the last pass did not complete.
+ */
+bool
+portd_reconcile_due(void)
+{
+    if (first_change == LLONG_MIN) {
+        return seen_seqno != done_seqno;
+    }
+    if (time_msec() < portd_reconcile_deadline()) {
+        COVERAGE_INC(portd_reconcile_deferred);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Records that the reconfiguration brought portd up to the IDL sequence
+ * number 'seqno'.  If it is behind the one seen, the pass did not complete
+ * and is made again on the next run.
+ */
+void
+portd_reconcile_done(unsigned int seqno)
+{
+    long long int latency;
+
+    first_change = LLONG_MIN;
+    done_seqno = seqno;
+    if (seqno != seen_seqno || pending_since == LLONG_MIN) {
+        return;
+    }
+
+    COVERAGE_INC(portd_reconcile_pass);
+    latency = time_msec() - pending_since;
+    n_passes++;
+    n_changes += pending_changes;
+    max_changes = MAX(max_changes, pending_changes);
+    total_latency += latency;
+    max_latency = MAX(max_latency, latency);
+    VLOG_DBG("reconfigured %u database changes, %lld ms after the first",
+             pending_changes, latency);
+
+    pending_since = LLONG_MIN;
+    pending_changes = 0;
+}
+
+/* Wakes up when the changes being collected are due.  Must not be called
+ * while they cannot be reconfigured, or the poll loop would spin. */
+void
+portd_reconcile_wait(void)
+{
+    if (first_change != LLONG_MIN) {
+        poll_timer_wait_until(portd_reconcile_deadline());
+    }
+}
+
+void
+portd_reconcile_format(struct ds *ds)
+{
+    ds_put_format(ds, "window: %d ms, max delay: %d ms\n", window, max_delay);
+    ds_put_format(ds, "passes: %llu, database changes: %llu\n",
+                  n_passes, n_changes);
+    if (n_passes) {
+        ds_put_format(ds, "changes per pass: %.1f average, %u max\n",
+                      (double) n_changes / n_passes, max_changes);
+        ds_put_format(ds, "added latency: %lld ms average, %lld ms max\n",
+                      total_latency / (long long int) n_passes, max_latency);
+    }
+    if (pending_changes) {
+        ds_put_format(ds, "pending: %u changes for %lld ms\n",
+                      pending_changes, time_msec() - pending_since);
+    }
+}
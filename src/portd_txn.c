@@ -0,0 +1,661 @@
+/*
+ * (c) Copyright 2016 Hewlett Packard Enterprise Development LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+/***************************************************************************
+ *    File               : portd_txn.c
+ *    Description        : OVSDB transactions of portd.  The changes made
+ *                           to the Port columns during a pass are buffered
+ *                           per port and written at the end of the pass,
+ *                           as mutations of the keys that change.  A
+ *                           transaction is only created when portd writes
+ *                           to the database, and is committed without
+ *                           waiting for the reply of ovsdb-server.  The
+ *                           writes of a transaction that fails are kept
+ *                           and made again.
+ ***************************************************************************/
+
+#include <limits.h>
+#include <string.h>
+
+#include "coverage.h"
+#include "dynamic-string.h"
+#include "hash.h"
+#include "hmap.h"
+#include "poll-loop.h"
+#include "shash.h"
+#include "smap.h"
+#include "timeval.h"
+#include "util.h"
+#include "uuid.h"
+#include "vswitch-idl.h"
+#include "openvswitch/vlog.h"
+
+#include "portd_txn.h"
+
+VLOG_DEFINE_THIS_MODULE(portd_txn);
+
+COVERAGE_DEFINE(portd_txn_commit);
+COVERAGE_DEFINE(portd_txn_failed);
+COVERAGE_DEFINE(portd_txn_retry);
+COVERAGE_DEFINE(portd_txn_col_write);
+COVERAGE_DEFINE(portd_txn_col_coalesced);
+COVERAGE_DEFINE(portd_txn_key_write);
+
+#define PORTD_TXN_PORT_N_COLS (PORTD_TXN_PORT_FORWARDING_STATE + 1)
+
+/* The changes made to the columns of a Port row during the pass: each key
+ * maps to its new value, or to NULL if it is removed. */
+struct portd_txn_port {
+    struct hmap_node node;          /* In 'port_bufs'. */
+    struct uuid uuid;
+    struct shash updates[PORTD_TXN_PORT_N_COLS];
+};
+
+extern struct ovsdb_idl *idl;
+extern struct ovsdb_idl_txn *txn;
+
+/* A write made in a transaction: the value of a Port column, or the
+ * addition or deletion of an internal VLAN row. */
+struct portd_txn_write {
+    struct hmap_node node;
+    bool vlan;
+
+    /* Port column, if !vlan. */
+    struct uuid uuid;
+    enum portd_txn_port_col col;
+    struct smap value;
+
+    /* Internal VLAN, if vlan. */
+    int vid;
+    char *port_name;
+    bool add;
+};
+
+static bool async_commit = true;
+static portd_txn_vlan_replay_func *vlan_replay;
+
+/* True if 'txn' was committed and ovsdb-server did not reply yet. */
+static bool in_flight;
+
+/* Writes of 'txn', and writes of the transactions that failed, to be made
+ * again from 'retry_time' on. */
+static struct hmap written = HMAP_INITIALIZER(&written);
+static struct hmap pending = HMAP_INITIALIZER(&pending);
+static long long int retry_time = LLONG_MIN;
+
+/* The 'struct portd_txn_port's of the pass, by row UUID. */
+static struct hmap port_bufs = HMAP_INITIALIZER(&port_bufs);
+
+static unsigned int n_commits;
+static unsigned int n_failures;
+static enum ovsdb_idl_txn_status last_failure = TXN_SUCCESS;
+static char *last_error;
+
+/*
+ * Initializes the transactions, committed without blocking if 'async' is
+ * true.  'replay' makes the internal VLAN changes of a failed transaction
+ * again.
+ */
+void
+portd_txn_init(bool async, portd_txn_vlan_replay_func *replay)
+{
+    async_commit = async;
+    vlan_replay = replay;
+}
+
+static uint32_t
+portd_txn_write_hash(const struct portd_txn_write *w)
+{
+    return w->vlan ? hash_int(w->vid, 0)
+                   : hash_int(w->col, uuid_hash(&w->uuid));
+}
+
+static struct portd_txn_write *
+portd_txn_write_find(const struct hmap *map, const struct portd_txn_write *key)
+{
+    struct portd_txn_write *w;
+
+    HMAP_FOR_EACH_WITH_HASH (w, node, portd_txn_write_hash(key), map) {
+        if (w->vlan == key->vlan
+            && (w->vlan ? w->vid == key->vid
+                        : (w->col == key->col
+                           && uuid_equals(&w->uuid, &key->uuid)))) {
+            return w;
+        }
+    }
+    return NULL;
+}
+
+static void
+portd_txn_write_free(struct portd_txn_write *w)
+{
+    if (!w->vlan) {
+        smap_destroy(&w->value);
+    }
+    free(w->port_name);
+    free(w);
+}
+
+/* Adds 'w' to 'map', replacing the earlier write of the same column or
+ * VLAN. */
+static void
+portd_txn_write_record(struct hmap *map, struct portd_txn_write *w)
+{
+    struct portd_txn_write *old = portd_txn_write_find(map, w);
+
+    if (old) {
+        hmap_remove(map, &old->node);
+        portd_txn_write_free(old);
+    }
+    hmap_insert(map, &w->node, portd_txn_write_hash(w));
+}
+
+static void
+portd_txn_write_clear(struct hmap *map)
+{
+    struct portd_txn_write *w, *next;
+
+    HMAP_FOR_EACH_SAFE (w, next, node, map) {
+        hmap_remove(map, &w->node);
+        portd_txn_write_free(w);
+    }
+}
+
+/*
+ * Returns the transaction of the current pass, created on the first write.
+ * Must not be called while a committed transaction is in flight: the rows
+ * read would not reflect its writes yet.
+ */
+struct ovsdb_idl_txn *
+portd_txn_get(void)
+{
+    ovs_assert(!in_flight);
+    if (!txn) {
+        txn = ovsdb_idl_txn_create(idl);
+    }
+    return txn;
+}
+
+static const struct smap *
+portd_txn_port_col_get(const struct ovsrec_port *row,
+                       enum portd_txn_port_col col)
+{
+    switch (col) {
+    case PORTD_TXN_PORT_HW_CONFIG:
+        return &row->hw_config;
+    case PORTD_TXN_PORT_STATUS:
+        return &row->status;
+    case PORTD_TXN_PORT_FORWARDING_STATE:
+        return &row->forwarding_state;
+    }
+    OVS_NOT_REACHED();
+}
+
+static struct portd_txn_port *
+portd_txn_port_find(const struct uuid *uuid)
+{
+    struct portd_txn_port *buf;
+
+    HMAP_FOR_EACH_WITH_HASH (buf, node, uuid_hash(uuid), &port_bufs) {
+        if (uuid_equals(&buf->uuid, uuid)) {
+            return buf;
+        }
+    }
+    return NULL;
+}
+
+static struct portd_txn_port *
+portd_txn_port_get_buf(const struct ovsrec_port *row)
+{
+    struct portd_txn_port *buf = portd_txn_port_find(&row->header_.uuid);
+    size_t i;
+
+    if (!buf) {
+        ovs_assert(!in_flight);
+        buf = xmalloc(sizeof *buf);
+        buf->uuid = row->header_.uuid;
+        for (i = 0; i < PORTD_TXN_PORT_N_COLS; i++) {
+            shash_init(&buf->updates[i]);
+        }
+        hmap_insert(&port_bufs, &buf->node, uuid_hash(&buf->uuid));
+    }
+    return buf;
+}
+
+static void
+portd_txn_port_buf_free(struct portd_txn_port *buf)
+{
+    size_t i;
+
+    for (i = 0; i < PORTD_TXN_PORT_N_COLS; i++) {
+        shash_destroy_free_data(&buf->updates[i]);
+    }
+    free(buf);
+}
+
+/* Buffers setting 'key' of column 'col' of 'row' to 'value', or removing it
+ * if 'value' is NULL. */
+static void
+portd_txn_port_update(const struct ovsrec_port *row,
+                      enum portd_txn_port_col col, const char *key,
+                      const char *value)
+{
+    struct portd_txn_port *buf = portd_txn_port_get_buf(row);
+
+    if (!shash_is_empty(&buf->updates[col])) {
+        /* Folded into a write of the column already due for the pass. */
+        COVERAGE_INC(portd_txn_col_coalesced);
+    }
+    free(shash_replace(&buf->updates[col], key,
+                       value ? xstrdup(value) : NULL));
+}
+
+/* Sets 'key' of column 'col' of 'row' to 'value' at the end of the pass. */
+void
+portd_txn_port_setkey(const struct ovsrec_port *row,
+                      enum portd_txn_port_col col, const char *key,
+                      const char *value)
+{
+    portd_txn_port_update(row, col, key, value);
+}
+
+/* Removes 'key' from column 'col' of 'row' at the end of the pass. */
+void
+portd_txn_port_delkey(const struct ovsrec_port *row,
+                      enum portd_txn_port_col col, const char *key)
+{
+    portd_txn_port_update(row, col, key, NULL);
+}
+
+/* Returns the value of 'key' in column 'col' of 'row', with the changes
+ * buffered during the pass, or NULL if the key is not set. */
+const char *
+portd_txn_port_get(const struct ovsrec_port *row,
+                   enum portd_txn_port_col col, const char *key)
+{
+    struct portd_txn_port *buf = portd_txn_port_find(&row->header_.uuid);
+    struct shash_node *node;
+
+    node = buf ? shash_find(&buf->updates[col], key) : NULL;
+    if (node) {
+        return node->data;
+    }
+    return smap_get(portd_txn_port_col_get(row, col), key);
+}
+
+/* Initializes 'value' with the content of column 'col' of 'row', with the
+ * changes buffered during the pass. */
+void
+portd_txn_port_get_smap(const struct ovsrec_port *row,
+                        enum portd_txn_port_col col, struct smap *value)
+{
+    struct portd_txn_port *buf = portd_txn_port_find(&row->header_.uuid);
+    struct shash_node *node;
+
+    smap_clone(value, portd_txn_port_col_get(row, col));
+    if (buf) {
+        SHASH_FOR_EACH (node, &buf->updates[col]) {
+            if (node->data) {
+                smap_replace(value, node->name, node->data);
+            } else {
+                smap_remove(value, node->name);
+            }
+        }
+    }
+}
+
+/* Makes column 'col' of 'row' equal to 'value' at the end of the pass,
+ * buffering only the keys that differ. */
+void
+portd_txn_port_set(const struct ovsrec_port *row,
+                   enum portd_txn_port_col col, const struct smap *value)
+{
+    struct smap_node *node;
+    struct smap cur;
+
+    portd_txn_port_get_smap(row, col, &cur);
+    SMAP_FOR_EACH (node, value) {
+        const char *old = smap_get(&cur, node->key);
+
+        if (!old || strcmp(old, node->value)) {
+            portd_txn_port_update(row, col, node->key, node->value);
+        }
+    }
+    SMAP_FOR_EACH (node, &cur) {
+        if (!smap_get(value, node->key)) {
+            portd_txn_port_update(row, col, node->key, NULL);
+        }
+    }
+    smap_destroy(&cur);
+}
+
+/* Sets 'key' of column 'col' of 'row' to 'value', or removes it if 'value'
+ * is NULL, with a mutation of the key alone. */
+static void
+portd_txn_port_mutate(const struct ovsrec_port *row,
+                      enum portd_txn_port_col col, const char *key,
+                      const char *value)
+{
+    switch (col) {
+    case PORTD_TXN_PORT_HW_CONFIG:
+        if (value) {
+            ovsrec_port_update_hw_config_setkey(row, key, value);
+        } else {
+            ovsrec_port_update_hw_config_delkey(row, key);
+        }
+        break;
+    case PORTD_TXN_PORT_STATUS:
+        if (value) {
+            ovsrec_port_update_status_setkey(row, key, value);
+        } else {
+            ovsrec_port_update_status_delkey(row, key);
+        }
+        break;
+    case PORTD_TXN_PORT_FORWARDING_STATE:
+        if (value) {
+            ovsrec_port_update_forwarding_state_setkey(row, key, value);
+        } else {
+            ovsrec_port_update_forwarding_state_delkey(row, key);
+        }
+        break;
+    }
+    COVERAGE_INC(portd_txn_key_write);
+}
+
+/* Writes the keys in 'updates' that change column 'col' of 'row' in the
+ * transaction of the pass, and records 'value', the resulting content of
+ * the column, to make the write again if the transaction fails. */
+static void
+portd_txn_port_write(const struct ovsrec_port *row,
+                     enum portd_txn_port_col col,
+                     const struct shash *updates, const struct smap *value)
+{
+    const struct smap *cur = portd_txn_port_col_get(row, col);
+    struct portd_txn_write *w;
+    struct shash_node *node;
+
+    portd_txn_get();
+    SHASH_FOR_EACH (node, updates) {
+        const char *old = smap_get(cur, node->name);
+
+        if (node->data ? !old || strcmp(old, node->data) : old != NULL) {
+            portd_txn_port_mutate(row, col, node->name, node->data);
+        }
+    }
+    COVERAGE_INC(portd_txn_col_write);
+
+    w = xzalloc(sizeof *w);
+    w->uuid = row->header_.uuid;
+    w->col = col;
+    smap_clone(&w->value, value);
+    portd_txn_write_record(&written, w);
+}
+
+/* Writes the buffered keys that the changes of the pass modify, once per
+ * column.  The rows deleted since are skipped. */
+static void
+portd_txn_port_flush(void)
+{
+    struct portd_txn_port *buf, *next;
+
+    HMAP_FOR_EACH_SAFE (buf, next, node, &port_bufs) {
+        const struct ovsrec_port *row;
+        size_t col;
+
+        row = ovsrec_port_get_for_uuid(idl, &buf->uuid);
+        for (col = 0; row && col < PORTD_TXN_PORT_N_COLS; col++) {
+            struct smap value;
+
+            if (shash_is_empty(&buf->updates[col])) {
+                continue;
+            }
+            portd_txn_port_get_smap(row, col, &value);
+            if (smap_equal(&value, portd_txn_port_col_get(row, col))) {
+                COVERAGE_INC(portd_txn_col_coalesced);
+            } else {
+                portd_txn_port_write(row, col, &buf->updates[col], &value);
+            }
+            smap_destroy(&value);
+        }
+        hmap_remove(&port_bufs, &buf->node);
+        portd_txn_port_buf_free(buf);
+    }
+}
+
+/* Records that the internal VLAN row 'vid' of 'port_name' was added, or
+ * handed over to the port, or deleted in the transaction of the pass. */
+void
+portd_txn_vlan_written(int vid, const char *port_name, bool add)
+{
+    struct portd_txn_write *w;
+
+    portd_txn_get();
+    w = xzalloc(sizeof *w);
+    w->vlan = true;
+    w->vid = vid;
+    w->port_name = port_name ? xstrdup(port_name) : NULL;
+    w->add = add;
+    portd_txn_write_record(&written, w);
+}
+
+/* Buffers the keys of 'value', the content of column 'col' of 'row' in a
+ * failed transaction, under the changes the pass made to them. */
+static void
+portd_txn_port_replay(const struct ovsrec_port *row,
+                      enum portd_txn_port_col col, const struct smap *value)
+{
+    struct portd_txn_port *buf = portd_txn_port_find(&row->header_.uuid);
+    const struct shash *updates = buf ? &buf->updates[col] : NULL;
+    const struct smap *cur = portd_txn_port_col_get(row, col);
+    struct smap_node *node;
+
+    SMAP_FOR_EACH (node, value) {
+        const char *old = smap_get(cur, node->key);
+
+        if ((!updates || !shash_find(updates, node->key))
+            && (!old || strcmp(old, node->value))) {
+            portd_txn_port_update(row, col, node->key, node->value);
+        }
+    }
+    SMAP_FOR_EACH (node, cur) {
+        if ((!updates || !shash_find(updates, node->key))
+            && !smap_get(value, node->key)) {
+            portd_txn_port_update(row, col, node->key, NULL);
+        }
+    }
+}
+
+/* Makes again the writes of the failed transactions, under those the
+ * current pass made itself. */
+static void
+portd_txn_replay(void)
+{
+    struct portd_txn_write *w, *next;
+
+    HMAP_FOR_EACH_SAFE (w, next, node, &pending) {
+        hmap_remove(&pending, &w->node);
+        if (!portd_txn_write_find(&written, w)) {
+            COVERAGE_INC(portd_txn_retry);
+            if (w->vlan) {
+                if (vlan_replay) {
+                    vlan_replay(w->vid, w->port_name, w->add);
+                }
+            } else {
+                const struct ovsrec_port *row;
+
+                row = ovsrec_port_get_for_uuid(idl, &w->uuid);
+                if (row) {
+                    portd_txn_port_replay(row, w->col, &w->value);
+                }
+            }
+        }
+        portd_txn_write_free(w);
+    }
+}
+
+/* Handles the final 'status' of 'txn' and destroys it. */
+static void
+portd_txn_complete(enum ovsdb_idl_txn_status status)
+{
+    struct portd_txn_write *w, *next;
+
+    in_flight = false;
+    if (status == TXN_SUCCESS || status == TXN_UNCHANGED) {
+        portd_txn_write_clear(&written);
+    } else {
+        static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(1, 5);
+        const char *error = ovsdb_idl_txn_get_error(txn);
+
+        COVERAGE_INC(portd_txn_failed);
+        n_failures++;
+        last_failure = status;
+        free(last_error);
+        last_error = error ? xstrdup(error) : NULL;
+        VLOG_WARN_RL(&rl, "database transaction failed (%s)%s%s, "
+                     "retrying its %"PRIuSIZE" writes",
+                     ovsdb_idl_txn_status_to_string(status),
+                     error ? ": " : "", error ? error : "",
+                     hmap_count(&written));
+
+        /* The writes of the failed transaction are newer than those of the
+         * transactions that failed before it. */
+        HMAP_FOR_EACH_SAFE (w, next, node, &written) {
+            hmap_remove(&written, &w->node);
+            portd_txn_write_record(&pending, w);
+        }
+
+        /* A conflict with another client is retried on the next pass,
+         * anything else after a delay. */
+        retry_time = time_msec();
+        if (status != TXN_TRY_AGAIN) {
+            retry_time += PORTD_TXN_RETRY_INTERVAL;
+        }
+    }
+    ovsdb_idl_txn_destroy(txn);
+    txn = NULL;
+}
+
+/*
+ * Completes the transaction committed by a previous pass, if ovsdb-server
+ * replied.  Returns true if it is still in flight, in which case the pass
+ * must not write to the database.
+ */
+bool
+portd_txn_run(void)
+{
+    if (in_flight) {
+        enum ovsdb_idl_txn_status status = ovsdb_idl_txn_commit(txn);
+
+        if (status == TXN_INCOMPLETE) {
+            return true;
+        }
+        portd_txn_complete(status);
+    }
+    return false;
+}
+
+/*
+ * Makes the writes of the failed transactions again once their retry time
+ * came, then commits the transaction of the pass, if anything was written.
+ * Unless the commit mode is blocking, the transaction is completed by a
+ * later portd_txn_run().
+ */
+void
+portd_txn_commit(void)
+{
+    enum ovsdb_idl_txn_status status;
+
+    if (in_flight) {
+        return;
+    }
+    if (!hmap_is_empty(&pending) && time_msec() >= retry_time) {
+        portd_txn_replay();
+    }
+    portd_txn_port_flush();
+    if (!txn) {
+        return;
+    }
+
+    COVERAGE_INC(portd_txn_commit);
+    n_commits++;
+    status = (async_commit ? ovsdb_idl_txn_commit(txn)
+                           : ovsdb_idl_txn_commit_block(txn));
+    if (status == TXN_INCOMPLETE) {
+        in_flight = true;
+    } else {
+        portd_txn_complete(status);
+    }
+}
+
+/* Returns true if a committed transaction waits for ovsdb-server's reply. */
+bool
+portd_txn_in_flight(void)
+{
+    return in_flight;
+}
+
+void
+portd_txn_wait(void)
+{
+    if (in_flight) {
+        ovsdb_idl_txn_wait(txn);
+    } else if (!hmap_is_empty(&pending)) {
+        poll_timer_wait_until(retry_time);
+    }
+}
+
+void
+portd_txn_destroy(void)
+{
+    struct portd_txn_port *buf, *next;
+
+    if (txn) {
+        ovsdb_idl_txn_destroy(txn);
+        txn = NULL;
+    }
+    in_flight = false;
+    portd_txn_write_clear(&written);
+    portd_txn_write_clear(&pending);
+    HMAP_FOR_EACH_SAFE (buf, next, node, &port_bufs) {
+        hmap_remove(&port_bufs, &buf->node);
+        portd_txn_port_buf_free(buf);
+    }
+    free(last_error);
+    last_error = NULL;
+}
+
+void
+portd_txn_format(struct ds *ds)
+{
+    ds_put_format(ds, "commit mode: %s\n",
+                  async_commit ? "async" : "block");
+    ds_put_format(ds, "in flight: %s (%"PRIuSIZE" writes)\n",
+                  in_flight ? "yes" : "no", hmap_count(&written));
+    ds_put_format(ds, "pending retry: %"PRIuSIZE" writes",
+                  hmap_count(&pending));
+    if (!hmap_is_empty(&pending)) {
+        long long int delay = retry_time - time_msec();
+
+        ds_put_format(ds, " in %lld ms", delay > 0 ? delay : 0);
+    }
+    ds_put_format(ds, "\ncommits: %u, failed: %u\n", n_commits, n_failures);
+    if (n_failures) {
+        ds_put_format(ds, "last failure: %s%s%s\n",
+                      ovsdb_idl_txn_status_to_string(last_failure),
+                      last_error ? ": " : "",
+                      last_error ? last_error : "");
+    }
+}
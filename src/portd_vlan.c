@@ -0,0 +1,584 @@
+/*
+ * (c) Copyright 2016 Hewlett Packard Enterprise Development LP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+/***************************************************************************
+ *    File               : portd_vlan.c
+ *    Description        : Internal VLAN allocator.  The VLAN ids used in
+ *                           the default bridge are kept in a bitmap, loaded
+ *                           when the bridge changes and updated as portd
+ *                           adds VLANs, and free ids are found a 64-bit
+ *                           word at a time, in the range of the pool of
+ *                           the subsystem of the port.  The VLANs released
+ *                           by L3 ports can be held for them for a while.
+ ***************************************************************************/
+
+#include <limits.h>
+#include <string.h>
+
+#include "bitmap.h"
+#include "dynamic-string.h"
+#include "hash.h"
+#include "timeval.h"
+#include "util.h"
+#include "vswitch-idl.h"
+#include "openvswitch/vlog.h"
+
+#include "portd.h"
+#include "portd_vlan.h"
+
+VLOG_DEFINE_THIS_MODULE(portd_vlan);
+
+void
+portd_vlan_alloc_init(struct portd_vlan_alloc *va)
+{
+    memset(va->used, 0, sizeof va->used);
+    va->synced = false;
+}
+
+/* Loads the ids used from the 'vlans' column of 'br'. */
+void
+portd_vlan_alloc_sync(struct portd_vlan_alloc *va,
+                      const struct ovsrec_bridge *br)
+{
+    size_t i;
+
+    memset(va->used, 0, sizeof va->used);
+    for (i = 0; i < br->n_vlans; i++) {
+        portd_vlan_alloc_mark(va, br->vlans[i]->id, true);
+    }
+    va->synced = true;
+}
+
+void
+portd_vlan_alloc_mark(struct portd_vlan_alloc *va, int vid, bool used)
+{
+    uint64_t bit;
+
+    if (vid < PORTD_VLAN_ID_MIN || vid > PORTD_VLAN_ID_MAX) {
+        return;
+    }
+    bit = UINT64_C(1) << (vid % 64);
+    if (used) {
+        va->used[vid / 64] |= bit;
+    } else {
+        va->used[vid / 64] &= ~bit;
+    }
+}
+
+bool
+portd_vlan_alloc_is_used(const struct portd_vlan_alloc *va, int vid)
+{
+    return (vid >= PORTD_VLAN_ID_MIN && vid <= PORTD_VLAN_ID_MAX
+            && (va->used[vid / 64] & (UINT64_C(1) << (vid % 64))));
+}
+
+/* Returns the lowest free id from 'from' to 'to', or -1. */
+static int
+portd_vlan_scan_up(const uint64_t *used, int from, int to)
+{
+    int i = from / 64;
+    uint64_t free = ~used[i] & (UINT64_MAX << (from % 64));
+
+    for (;;) {
+        if (free) {
+            int vid = i * 64 + raw_ctz(free);
+
+            return vid <= to ? vid : -1;
+        }
+        if (++i > to / 64) {
+            return -1;
+        }
+        free = ~used[i];
+    }
+}
+
+/* Returns the highest free id from 'from' down to 'to', or -1. */
+static int
+portd_vlan_scan_down(const uint64_t *used, int from, int to)
+{
+    int i = from / 64;
+    uint64_t free = ~used[i] & (UINT64_MAX >> (63 - from % 64));
+
+    for (;;) {
+        if (free) {
+            int vid = i * 64 + 63 - raw_clz64(free);
+
+            return vid >= to ? vid : -1;
+        }
+        if (--i < to / 64) {
+            return -1;
+        }
+        free = ~used[i];
+    }
+}
+
+/* Returns the free id of 'pool' that comes first in its allocation order,
+ * 'vid' itself included, or -1 if there is none. */
+static int
+portd_vlan_alloc_scan(const struct portd_vlan_alloc *va,
+                      const struct portd_vlan_pool *pool, int vid)
+{
+    if (pool->ascending) {
+        vid = MAX(vid, pool->min);
+        return (vid <= pool->max
+                ? portd_vlan_scan_up(va->used, vid, pool->max) : -1);
+    } else {
+        vid = MIN(vid, pool->max);
+        return (vid >= pool->min
+                ? portd_vlan_scan_down(va->used, vid, pool->min) : -1);
+    }
+}
+
+/* Returns the first free id of 'pool' in its allocation order, or -1 if
+ * there is none or the bridge was not loaded yet. */
+int
+portd_vlan_alloc_first(const struct portd_vlan_alloc *va,
+                       const struct portd_vlan_pool *pool)
+{
+    if (!va->synced) {
+        return -1;
+    }
+    return portd_vlan_alloc_scan(va, pool,
+                                 pool->ascending ? pool->min : pool->max);
+}
+
+/* Returns the free id of 'pool' that follows 'vid' in its allocation order,
+ * or -1. */
+int
+portd_vlan_alloc_next(const struct portd_vlan_alloc *va,
+                      const struct portd_vlan_pool *pool, int vid)
+{
+    return portd_vlan_alloc_scan(va, pool,
+                                 pool->ascending ? vid + 1 : vid - 1);
+}
+
+/* Returns the number of free ids in the range of 'pool'. */
+int
+portd_vlan_alloc_n_free(const struct portd_vlan_alloc *va,
+                        const struct portd_vlan_pool *pool)
+{
+    int n = 0;
+    int vid;
+
+    for (vid = pool->min; vid <= pool->max; vid++) {
+        n += !portd_vlan_alloc_is_used(va, vid);
+    }
+    return n;
+}
+
+/* Gives out the ids from 'min' to 'max', in ascending order if 'ascending'
+ * is true, descending otherwise.  The range is clamped to the valid ids. */
+void
+portd_vlan_pool_set_range(struct portd_vlan_pool *pool, int min, int max,
+                          bool ascending)
+{
+    pool->min = MAX(min, PORTD_VLAN_ID_MIN);
+    pool->max = MIN(max, PORTD_VLAN_ID_MAX);
+    pool->ascending = ascending;
+}
+
+/* Returns true if 'vid' is in the range 'pool' gives ids out from. */
+bool
+portd_vlan_pool_in_range(const struct portd_vlan_pool *pool, int vid)
+{
+    return vid >= pool->min && vid <= pool->max;
+}
+
+void
+portd_vlan_pools_init(struct portd_vlan_pools *pools)
+{
+    hmap_init(&pools->by_subsystem);
+    shash_init(&pools->by_interface);
+    pools->dflt = NULL;
+}
+
+static void
+portd_vlan_pool_destroy(struct portd_vlan_pools *pools,
+                        struct portd_vlan_pool *pool)
+{
+    hmap_remove(&pools->by_subsystem, &pool->node);
+    free(pool->subsystem);
+    free(pool->policy);
+    free(pool);
+}
+
+void
+portd_vlan_pools_destroy(struct portd_vlan_pools *pools)
+{
+    struct portd_vlan_pool *pool, *next;
+
+    shash_destroy(&pools->by_interface);
+    HMAP_FOR_EACH_SAFE (pool, next, node, &pools->by_subsystem) {
+        portd_vlan_pool_destroy(pools, pool);
+    }
+    hmap_destroy(&pools->by_subsystem);
+}
+
+/*
+ * Starts loading the pools again: the pools not got before
+ * portd_vlan_pools_finish() are deleted, and the interfaces must be mapped
+ * to their pool again.
+ */
+void
+portd_vlan_pools_start(struct portd_vlan_pools *pools)
+{
+    struct portd_vlan_pool *pool;
+
+    HMAP_FOR_EACH (pool, node, &pools->by_subsystem) {
+        pool->stale = true;
+    }
+    shash_clear(&pools->by_interface);
+    pools->dflt = NULL;
+}
+
+/* Returns the pool of 'subsystem', created with the default range if there
+ * was none. */
+struct portd_vlan_pool *
+portd_vlan_pools_get(struct portd_vlan_pools *pools, const char *subsystem)
+{
+    uint32_t hash = hash_string(subsystem, 0);
+    struct portd_vlan_pool *pool;
+
+    HMAP_FOR_EACH_WITH_HASH (pool, node, hash, &pools->by_subsystem) {
+        if (!strcmp(pool->subsystem, subsystem)) {
+            pool->stale = false;
+            return pool;
+        }
+    }
+
+    pool = xzalloc(sizeof *pool);
+    pool->subsystem = xstrdup(subsystem);
+    portd_vlan_pool_set_range(pool, PORTD_VLAN_ID_MIN, PORTD_VLAN_ID_MAX,
+                              true);
+    pool->last = -1;
+    hmap_insert(&pools->by_subsystem, &pool->node, hash);
+    return pool;
+}
+
+/* Deletes the pools of the subsystems that are gone. */
+void
+portd_vlan_pools_finish(struct portd_vlan_pools *pools)
+{
+    struct portd_vlan_pool *pool, *next;
+
+    HMAP_FOR_EACH_SAFE (pool, next, node, &pools->by_subsystem) {
+        if (pool->stale) {
+            portd_vlan_pool_destroy(pools, pool);
+        }
+    }
+}
+
+/* Returns the pool of the subsystem of the first interface of 'port_row'
+ * that one lists, the default pool if none does, or NULL if there is no
+ * pool. */
+struct portd_vlan_pool *
+portd_vlan_pools_lookup_port(const struct portd_vlan_pools *pools,
+                             const struct ovsrec_port *port_row)
+{
+    size_t i;
+
+    for (i = 0; i < port_row->n_interfaces; i++) {
+        struct portd_vlan_pool *pool;
+
+        pool = shash_find_data(&pools->by_interface,
+                               port_row->interfaces[i]->name);
+        if (pool) {
+            return pool;
+        }
+    }
+    return pools->dflt;
+}
+
+void
+portd_vlan_pools_format(const struct portd_vlan_pools *pools,
+                        const struct portd_vlan_alloc *va, struct ds *ds)
+{
+    const struct portd_vlan_pool *pool;
+
+    HMAP_FOR_EACH (pool, node, &pools->by_subsystem) {
+        ds_put_format(ds, "%s%s: ", pool->subsystem,
+                      pool == pools->dflt ? " (default)" : "");
+        if (!pool->require_vlan) {
+            ds_put_cstr(ds, "no internal vlans\n");
+            continue;
+        }
+        ds_put_format(ds, "range %d-%d %s, %d free, %llu allocated, "
+                      "%llu failed\n", pool->min, pool->max,
+                      pool->policy ? pool->policy : "(no policy)",
+                      portd_vlan_alloc_n_free(va, pool),
+                      pool->n_allocated, pool->n_failed);
+    }
+}
+
+/* An internal VLAN held for the port it was released by. */
+struct portd_vlan_held {
+    struct hmap_node node;          /* In 'by_port'. */
+    struct ovs_list lru_node;       /* In 'lru'. */
+    char *port_name;
+    int vid;
+    long long int released;
+};
+
+void
+portd_vlan_quarantine_init(struct portd_vlan_quarantine *q)
+{
+    hmap_init(&q->by_port);
+    list_init(&q->lru);
+}
+
+static struct portd_vlan_held *
+portd_vlan_quarantine_find(const struct portd_vlan_quarantine *q,
+                           const char *port_name)
+{
+    struct portd_vlan_held *held;
+
+    HMAP_FOR_EACH_WITH_HASH (held, node, hash_string(port_name, 0),
+                             &q->by_port) {
+        if (!strcmp(held->port_name, port_name)) {
+            return held;
+        }
+    }
+    return NULL;
+}
+
+/* Removes 'held' from 'q' and frees it.  Returns its VLAN id. */
+static int
+portd_vlan_quarantine_remove(struct portd_vlan_quarantine *q,
+                             struct portd_vlan_held *held)
+{
+    int vid = held->vid;
+
+    hmap_remove(&q->by_port, &held->node);
+    list_remove(&held->lru_node);
+    free(held->port_name);
+    free(held);
+    return vid;
+}
+
+void
+portd_vlan_quarantine_destroy(struct portd_vlan_quarantine *q)
+{
+    struct portd_vlan_held *held, *next;
+
+    HMAP_FOR_EACH_SAFE (held, next, node, &q->by_port) {
+        portd_vlan_quarantine_remove(q, held);
+    }
+    hmap_destroy(&q->by_port);
+}
+
+/*
+ * Holds VLAN 'vid', released at 'now' by port 'port_name', for that port.
+ * Returns the VLAN the port held before, which is no longer held, or -1.
+ */
+int
+portd_vlan_quarantine_add(struct portd_vlan_quarantine *q,
+                          const char *port_name, int vid, long long int now)
+{
+    struct portd_vlan_held *held = portd_vlan_quarantine_find(q, port_name);
+    int old_vid = held ? portd_vlan_quarantine_remove(q, held) : -1;
+
+    held = xmalloc(sizeof *held);
+    held->port_name = xstrdup(port_name);
+    held->vid = vid;
+    held->released = now;
+    hmap_insert(&q->by_port, &held->node, hash_string(port_name, 0));
+    list_push_back(&q->lru, &held->lru_node);
+    return old_vid;
+}
+
+/* Returns the VLAN held for 'port_name', no longer held, or -1. */
+int
+portd_vlan_quarantine_take(struct portd_vlan_quarantine *q,
+                           const char *port_name)
+{
+    struct portd_vlan_held *held = portd_vlan_quarantine_find(q, port_name);
+
+    return held ? portd_vlan_quarantine_remove(q, held) : -1;
+}
+
+/*
+ * Stops holding the least recently released VLAN, if it was released
+ * before 'released_before', and returns it, with the name of its port in
+ * '*port_name' for the caller to free.  Returns -1 if there is none.
+ */
+int
+portd_vlan_quarantine_pop(struct portd_vlan_quarantine *q,
+                          long long int released_before, char **port_name)
+{
+    struct portd_vlan_held *held;
+
+    if (list_is_empty(&q->lru)) {
+        return -1;
+    }
+    held = CONTAINER_OF(list_front(&q->lru), struct portd_vlan_held,
+                        lru_node);
+    if (held->released >= released_before) {
+        return -1;
+    }
+    *port_name = held->port_name;
+    held->port_name = NULL;
+    return portd_vlan_quarantine_remove(q, held);
+}
+
+/*
+ * Stops holding the least recently released VLAN in the range of 'pool',
+ * and returns it, with the name of its port in '*port_name' for the caller
+ * to free.  Returns -1 if there is none.
+ */
+int
+portd_vlan_quarantine_evict(struct portd_vlan_quarantine *q,
+                            const struct portd_vlan_pool *pool,
+                            char **port_name)
+{
+    struct portd_vlan_held *held;
+
+    LIST_FOR_EACH (held, lru_node, &q->lru) {
+        if (portd_vlan_pool_in_range(pool, held->vid)) {
+            *port_name = held->port_name;
+            held->port_name = NULL;
+            return portd_vlan_quarantine_remove(q, held);
+        }
+    }
+    return -1;
+}
+
+/* Returns the time the least recently released VLAN was released at, or
+ * LLONG_MAX if none is held. */
+long long int
+portd_vlan_quarantine_oldest(const struct portd_vlan_quarantine *q)
+{
+    const struct portd_vlan_held *held;
+
+    if (list_is_empty(&q->lru)) {
+        return LLONG_MAX;
+    }
+    held = CONTAINER_OF(list_front(&q->lru), struct portd_vlan_held,
+                        lru_node);
+    return held->released;
+}
+
+void
+portd_vlan_quarantine_format(const struct portd_vlan_quarantine *q,
+                             long long int now, struct ds *ds)
+{
+    const struct portd_vlan_held *held;
+
+    LIST_FOR_EACH (held, lru_node, &q->lru) {
+        ds_put_format(ds, "  %s: VLAN %d, released %lld ms ago\n",
+                      held->port_name, held->vid, now - held->released);
+    }
+}
+
+/*
+ * Returns the VLAN id of the VLAN interface named 'name', "vlan" followed
+ * by the id in decimal without leading zeros, or -1 if 'name' is not such
+ * a name.
+ */
+int
+portd_vlan_name_to_vid(const char *name)
+{
+    size_t len = strlen(INTERFACE_TYPE_VLAN);
+    const char *p;
+    int vid = 0;
+
+    if (strncmp(name, INTERFACE_TYPE_VLAN, len) || name[len] == '0') {
+        return -1;
+    }
+    for (p = name + len; *p; p++) {
+        if (*p < '0' || *p > '9') {
+            return -1;
+        }
+        vid = vid * 10 + (*p - '0');
+        if (vid > PORTD_VLAN_ID_MAX) {
+            return -1;
+        }
+    }
+    return p > name + len ? vid : -1;
+}
+
+/* The allocation portd used to make: a bitmap of the VLANs of the bridge,
+ * 'vids', built for the call and scanned one id at a time. */
+static int
+portd_vlan_bench_bitmap(const int *vids, int n_vids, int min, int max)
+{
+    unsigned long *bmp = bitmap_allocate(PORTD_VLAN_ID_MAX + 1);
+    int vid = -1;
+    int i;
+
+    for (i = 0; i < n_vids; i++) {
+        bitmap_set1(bmp, vids[i]);
+    }
+    for (i = min; i <= max; i++) {
+        if (!bitmap_is_set(bmp, i)) {
+            vid = i;
+            break;
+        }
+    }
+    free(bmp);
+    return vid;
+}
+
+/*
+ * Microbenchmark of the internal VLAN allocation in the default range, all
+ * of it used but for the last 'n_free' ids in ascending order.  Makes
+ * 'iterations' allocations, each freed before the next one, with the
+ * allocator, then as portd used to.  Appends the results to 'ds'.
+ */
+void
+portd_vlan_alloc_bench(int n_free, int iterations, struct ds *ds)
+{
+    int min = 1024, max = PORTD_VLAN_ID_MAX;
+    struct portd_vlan_pool pool;
+    struct portd_vlan_alloc va;
+    long long int start, alloc, bitmap;
+    int *vids;
+    int n_vids = 0;
+    int i, sum = 0;
+
+    n_free = MIN(n_free, max - min + 1);
+    vids = xmalloc((max - min + 1) * sizeof *vids);
+    portd_vlan_alloc_init(&va);
+    portd_vlan_pool_set_range(&pool, min, max, true);
+    va.synced = true;
+    for (i = min; i <= max - n_free; i++) {
+        portd_vlan_alloc_mark(&va, i, true);
+        vids[n_vids++] = i;
+    }
+
+    start = time_usec();
+    for (i = 0; i < iterations; i++) {
+        int vid = portd_vlan_alloc_first(&va, &pool);
+
+        portd_vlan_alloc_mark(&va, vid, true);
+        sum += vid;
+        portd_vlan_alloc_mark(&va, vid, false);
+    }
+    alloc = time_usec() - start;
+
+    start = time_usec();
+    for (i = 0; i < iterations; i++) {
+        sum -= portd_vlan_bench_bitmap(vids, n_vids, min, max);
+    }
+    bitmap = time_usec() - start;
+
+    ds_put_format(ds, "range %d-%d, %d used, %d free, %d allocations: "
+                  "allocator %lld ns, bitmap rebuild %lld ns per "
+                  "allocation%s\n", min, max, n_vids, max - min + 1 - n_vids,
+                  iterations, alloc * 1000 / iterations,
+                  bitmap * 1000 / iterations,
+                  sum ? " (results differ)" : "");
+    free(vids);
+}